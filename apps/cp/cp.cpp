@@ -1,5 +1,9 @@
+#include <fcntl.h>
+#include <unistd.h>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include "../syscall.h"
 
 extern "C" void main(int argc, char** argv) {
   if(argc < 3) {
@@ -7,26 +11,31 @@ extern "C" void main(int argc, char** argv) {
     exit(1);
   }
 
-  FILE* fp_src = fopen(argv[1], "r");
-  if(fp_src == nullptr) {
+  const int fd_src = open(argv[1], O_RDONLY);
+  if(fd_src < 0) {
     printf("failed to open for read: %s\n", argv[1]);
     exit(1);
   }
 
-  FILE* fp_dest = fopen(argv[2], "w");
-  if(fp_dest == nullptr) {
+  const int fd_dest = open(argv[2], O_CREAT | O_WRONLY | O_TRUNC);
+  if(fd_dest < 0) {
     printf("failed to open for write: %s\n", argv[2]);
     exit(1);
   }
-  
-  char buf[256];
-  size_t bytes;
-  while ((bytes = fread(buf, 1, sizeof(buf), fp_src)) > 0){
-    const size_t written = fwrite(buf, 1, bytes, fp_dest);
-    if(bytes != written) {
-      printf("failed to write to %s\n", argv[2]);
+
+  // データはカーネルの中だけで移す
+  const size_t kChunk = 1024 * 1024;
+  while(true) {
+    auto [bytes, err] = SyscallSplice(fd_src, fd_dest, kChunk);
+    if(err) {
+      printf("failed to copy to %s: %s\n", argv[2], strerror(err));
       exit(1);
     }
+    if(bytes == 0) {
+      break; // src の終わり
+    }
   }
+  close(fd_src);
+  close(fd_dest);
   exit(0);
-}
\ No newline at end of file
+}
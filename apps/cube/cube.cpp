@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <cstdlib>
+#include <vector>
 #include "../syscall.h"
 
 using namespace std;
@@ -15,8 +17,12 @@ struct Vector2D {
   T x, y;
 };
 
-void DrawObj(uint64_t layer_id);
-void DrawSurface(uint64_t layer_id, int sur);
+// 1 フレーム分の描画コマンド。まとめて 1 回のシステムコールで描く
+vector<WinCommand> cmds;
+
+void Fill(int x, int y, int w, int h, uint32_t color);
+void DrawObj();
+void DrawSurface(int sur);
 bool Sleep(unsigned long ms);
 
 const int kScale = 50, kMargin = 10;
@@ -72,10 +78,10 @@ extern "C" void main(int argc, char** argv) {
     }
 
     // 画面を一旦クリアし，立方体を描画
-    SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW,
-                            4, 24, kCanvasSize, kCanvasSize, 0);
-    DrawObj(layer_id | LAYER_NO_REDRAW);
-    SyscallWinRedraw(layer_id);
+    cmds.clear();
+    Fill(4, 24, kCanvasSize, kCanvasSize, 0);
+    DrawObj();
+    SyscallWinSubmit(layer_id, cmds.data(), cmds.size());
     if (Sleep(50)) {
       break;
     }
@@ -85,7 +91,13 @@ extern "C" void main(int argc, char** argv) {
   exit(0);
 }
 
-void DrawObj(uint64_t layer_id) {
+void Fill(int x, int y, int w, int h, uint32_t color) {
+  WinCommand cmd{WinCommand::kFill, x, y, color};
+  cmd.arg.fill = {w, h};
+  cmds.push_back(cmd);
+}
+
+void DrawObj() {
   // オブジェクト座標 vert を スクリーン座標 scr に変換（画面奥が Z+）
   for (int i = 0; i < kCube.size(); i++) {
     const double t = 6*kScale / (vert[i].z + 8*kScale);
@@ -109,12 +121,12 @@ void DrawObj(uint64_t layer_id) {
     const auto e0x = v1.x - v0.x, e0y = v1.y - v0.y, // v0 --> v1
                e1x = v2.x - v1.x, e1y = v2.y - v1.y; // v1 --> v2
     if (e0x * e1y <= e0y * e1x) {
-      DrawSurface(layer_id, sur);
+      DrawSurface(sur);
     }
   }
 }
 
-void DrawSurface(uint64_t layer_id, int sur) {
+void DrawSurface(int sur) {
   const auto& surface = kSurface[sur]; // 描画する面
   int ymin = kCanvasSize, ymax = 0; // 画面の描画範囲 [ymin, ymax]
   int y2x_up[kCanvasSize], y2x_down[kCanvasSize]; // Y, X 座標の組
@@ -147,7 +159,7 @@ void DrawSurface(uint64_t layer_id, int sur) {
   for (int y = ymin; y <= ymax; y++) {
     int p0x = min(y2x_up[y], y2x_down[y]);
     int p1x = max(y2x_up[y], y2x_down[y]);
-    SyscallWinFillRectangle(layer_id, 4 + p0x, 24 + y, p1x - p0x + 1, 1, kColor[sur]);
+    Fill(4 + p0x, 24 + y, p1x - p0x + 1, 1, kColor[sur]);
   }
 }
 
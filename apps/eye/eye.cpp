@@ -31,25 +31,33 @@ extern "C" void main(int argc, char** argv) {
 
   SyscallWinFillRectangle(layer_id, 4, 24, kCanvasSize, kCanvasSize, 0xffff);
 
-  AppEvent events[1];
-  while(true){
-    auto [n, err] = SyscallReadEvent(events, 1);
+  // 溜まっているイベントをまとめて受け取り、目は最後の位置で 1 回だけ描く
+  AppEvent events[16];
+  bool quit = false;
+  while(!quit){
+    auto [n, err] = SyscallReadEvent(events, 16);
     if(err){
       printf("Readevent failed: %s\n", strerror(err));
       break;
     }
-    if(events[0].type == AppEvent::kQuit) {
-      break;
+    const AppEvent* last_move = nullptr;
+    for(size_t i = 0; i < n; ++i) {
+      if(events[i].type == AppEvent::kQuit) {
+        quit = true;
+      }
+      else if(events[i].type == AppEvent::kMouseMove) {
+        last_move = &events[i];
+      }
+      else {
+        printf("unknown event: type = %d\n", events[i].type);
+      }
     }
-    else if(events[0].type == AppEvent::kMouseMove) {
-      auto& arg = events[0].arg.mouse_move;
+    if(last_move && !quit) {
+      auto& arg = last_move->arg.mouse_move;
       SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW,
         4, 24, kCanvasSize, kCanvasSize, 0xffffff);
       DrawEye(layer_id, arg.x, arg.y, 0x000000);
     }
-    else {
-      printf("unknown event: type = %d\n", events[0].type);
-    }
   }
 
   SyscallCloseWindow(layer_id);
@@ -0,0 +1,202 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include "../syscall.h"
+
+// ファイルシステムの性能を測る。作成、順次・ランダムな読み書き、ディレクトリの大きさごとの検索
+// 使い方: fsbench [size_kib]
+// /fsbench ディレクトリを作って使い、終わったら削除する
+
+// ランダムな読み書きの単位と回数
+const size_t kBlockSize = 4096;
+const int kRandomOps = 256;
+// 検索の回数
+const int kLookups = 1000;
+
+uint64_t NowNanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t PerSec(uint64_t count, uint64_t ns) {
+  return ns == 0 ? 0 : count * 1000000000ull / ns;
+}
+
+// 再現できるように固定の種から作る疑似乱数
+uint32_t Random() {
+  static uint32_t x = 2463534242;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+bool WriteAll(int fd, const char* buf, size_t len) {
+  for(size_t off = 0; off < len; ) {
+    const ssize_t w = write(fd, &buf[off], len - off);
+    if(w <= 0) {
+      return false;
+    }
+    off += w;
+  }
+  return true;
+}
+
+void FileName(char* s, size_t len, int dir_size, int i) {
+  snprintf(s, len, "/fsbench/d%d/file%04d.txt", dir_size, i);
+}
+
+// dir_size 個のファイルを持つディレクトリを作り、作成の速さと、その中での検索の速さを測る
+bool BenchDirectory(int dir_size) {
+  char path[64];
+  snprintf(path, sizeof(path), "/fsbench/d%d", dir_size);
+  if(mkdir(path, 0755) < 0) {
+    printf("failed to make %s\n", path);
+    return false;
+  }
+
+  const uint64_t c_start = NowNanoseconds();
+  for(int i = 0; i < dir_size; ++i) {
+    FileName(path, sizeof(path), dir_size, i);
+    const int fd = open(path, O_CREAT | O_WRONLY);
+    if(fd < 0) {
+      printf("failed to create %s\n", path);
+      return false;
+    }
+    close(fd);
+  }
+  const uint64_t c_ns = NowNanoseconds() - c_start;
+
+  const uint64_t l_start = NowNanoseconds();
+  for(int i = 0; i < kLookups; ++i) {
+    FileName(path, sizeof(path), dir_size, Random() % dir_size);
+    const int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+      printf("failed to open %s\n", path);
+      return false;
+    }
+    close(fd);
+  }
+  const uint64_t l_ns = NowNanoseconds() - l_start;
+
+  printf("%8d %12lu %14lu\n", dir_size, PerSec(dir_size, c_ns), l_ns / kLookups);
+  return true;
+}
+
+void RemoveDirectory(int dir_size) {
+  char path[64];
+  for(int i = 0; i < dir_size; ++i) {
+    FileName(path, sizeof(path), dir_size, i);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "/fsbench/d%d", dir_size);
+  unlink(path);
+}
+
+// 順次・ランダムな読み書きの速さを測る
+bool BenchReadWrite(size_t total) {
+  const char* path = "/fsbench/data.bin";
+  std::vector<char> buf(kBlockSize);
+  for(size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = 'a' + i % 26;
+  }
+
+  int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC);
+  if(fd < 0) {
+    printf("failed to create %s\n", path);
+    return false;
+  }
+  const uint64_t sw_start = NowNanoseconds();
+  for(size_t done = 0; done < total; done += kBlockSize) {
+    if(!WriteAll(fd, buf.data(), kBlockSize)) {
+      printf("failed to write %s\n", path);
+      return false;
+    }
+  }
+  const uint64_t sw_ns = NowNanoseconds() - sw_start;
+  close(fd);
+
+  fd = open(path, O_RDWR);
+  if(fd < 0) {
+    printf("failed to open %s\n", path);
+    return false;
+  }
+  const uint64_t sr_start = NowNanoseconds();
+  size_t read_bytes = 0;
+  ssize_t n;
+  while((n = read(fd, buf.data(), kBlockSize)) > 0) {
+    read_bytes += n;
+  }
+  const uint64_t sr_ns = NowNanoseconds() - sr_start;
+  if(read_bytes != total) {
+    printf("short read: %lu / %lu bytes\n", read_bytes, total);
+    return false;
+  }
+
+  const size_t num_blocks = total / kBlockSize;
+  const uint64_t rr_start = NowNanoseconds();
+  for(int i = 0; i < kRandomOps; ++i) {
+    if(lseek(fd, (Random() % num_blocks) * kBlockSize, SEEK_SET) < 0 ||
+       read(fd, buf.data(), kBlockSize) != kBlockSize) {
+      printf("failed to read randomly\n");
+      return false;
+    }
+  }
+  const uint64_t rr_ns = NowNanoseconds() - rr_start;
+
+  const uint64_t rw_start = NowNanoseconds();
+  for(int i = 0; i < kRandomOps; ++i) {
+    if(lseek(fd, (Random() % num_blocks) * kBlockSize, SEEK_SET) < 0 ||
+       !WriteAll(fd, buf.data(), kBlockSize)) {
+      printf("failed to write randomly\n");
+      return false;
+    }
+  }
+  const uint64_t rw_ns = NowNanoseconds() - rw_start;
+  close(fd);
+  unlink(path);
+
+  const size_t random_bytes = kRandomOps * kBlockSize;
+  printf("sequential write %8lu KiB/s\n", PerSec(total, sw_ns) / 1024);
+  printf("sequential read  %8lu KiB/s\n", PerSec(total, sr_ns) / 1024);
+  printf("random read      %8lu KiB/s (%lu ops/s)\n",
+         PerSec(random_bytes, rr_ns) / 1024, PerSec(kRandomOps, rr_ns));
+  printf("random write     %8lu KiB/s (%lu ops/s)\n",
+         PerSec(random_bytes, rw_ns) / 1024, PerSec(kRandomOps, rw_ns));
+  return true;
+}
+
+extern "C" void main(int argc, char** argv) {
+  const size_t total = std::max<size_t>(
+    (argc >= 2 ? strtoul(argv[1], nullptr, 0) : 1024) * 1024 / kBlockSize, 1) * kBlockSize;
+
+  if(mkdir("/fsbench", 0755) < 0) {
+    printf("failed to make /fsbench (remove it if it is left over)\n");
+    exit(1);
+  }
+
+  int ret = 0;
+  if(!BenchReadWrite(total)) {
+    ret = 1;
+  }
+
+  const int dir_sizes[] = {16, 64, 256, 1024};
+  printf("dir size  creates/s  lookup ns/op\n");
+  for(const int dir_size : dir_sizes) {
+    const bool ok = BenchDirectory(dir_size);
+    RemoveDirectory(dir_size);
+    if(!ok) {
+      ret = 1;
+      break;
+    }
+  }
+
+  unlink("/fsbench");
+  exit(ret);
+}
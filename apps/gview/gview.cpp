@@ -42,17 +42,6 @@ void WaitEvent() {
   }
 }
 
-uint32_t GetColorRGB(unsigned char* image_data){ 
-  return  static_cast<uint32_t>(image_data[0]) << 16 |
-          static_cast<uint32_t>(image_data[1]) << 8 |
-          static_cast<uint32_t>(image_data[2]);
-}
-
-uint32_t GetColorGray(unsigned char* image_data) {
-  const uint32_t gray = image_data[0];
-  return gray << 16 | gray << 8 | gray;
-}
-
 extern "C" void main(int argc, char** argv) {
   if(argc < 2) {
     fprintf(stderr, "usage: %s <file>\n", argv[0]);
@@ -65,8 +54,14 @@ extern "C" void main(int argc, char** argv) {
   const auto [fd, content, filesize] = MapFile(filepath);
 
   // メモリ上に配置した画像ファイルから画像を取得
+  // カーネルが変換できる RGB か RGBA で読む（グレースケールは RGB に広げる）
+  int components = 3;
+  if(stbi_info_from_memory(content, filesize, &width, &height, &bytes_per_pixel) &&
+     bytes_per_pixel == 4) {
+    components = 4;
+  }
   unsigned char* image_data = stbi_load_from_memory(
-    content, filesize, &width, &height, &bytes_per_pixel, 0
+    content, filesize, &width, &height, &bytes_per_pixel, components
   );
   if(image_data == nullptr) {
     fprintf(stderr, "failed to load image: %s\n", stbi_failure_reason());
@@ -74,10 +69,6 @@ extern "C" void main(int argc, char** argv) {
   }
 
   fprintf(stderr, "%dx%d, %d bytes/pixel\n", width, height, bytes_per_pixel);
-  auto get_color = GetColorRGB;
-  if(bytes_per_pixel <= 2) {
-    get_color = GetColorGray;
-  }
 
   // ウィンドウ生成
   const char* last_slash = strrchr(filepath, '/');
@@ -89,15 +80,14 @@ extern "C" void main(int argc, char** argv) {
   }
   const uint64_t layer_id = window.value;
 
-  // 1pxずつ描画
-  for(int y = 0; y < height; ++y) {
-    for(int x = 0; x < width; ++x) {
-      uint32_t c = get_color(&image_data[bytes_per_pixel * (y * width + x)]);
-      SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW, 4 + x, 24 + y, 1, 1, c);
-    }
+  // 画素の変換はカーネルに任せ、1 回のシステムコールで描画
+  WinBlitSource src{};
+  src.pixels = image_data;
+  src.stride = width * components;
+  src.format = components == 4 ? kWinPixelRGBA : kWinPixelRGB;
+  if(auto [n, err] = SyscallWinBlit(layer_id, 4, 24, width, height, &src); err) {
+    fprintf(stderr, "failed to draw: %s\n", strerror(err));
   }
-
-  SyscallWinRedraw(layer_id);
   WaitEvent();
 
   SyscallCloseWindow(layer_id);
@@ -0,0 +1,92 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include "../syscall.h"
+
+// 大きなファイルをいろいろなバッファサイズで書いて読み、スループットを出力する
+// 使い方: iobench [path] [size_kib]
+
+uint64_t NowNanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t KiBPerSec(size_t bytes, uint64_t ns) {
+  return ns == 0 ? 0 : bytes * 1000000000ull / 1024 / ns;
+}
+
+bool WriteFile(const char* path, std::vector<char>& buf, size_t total) {
+  const int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC);
+  if(fd < 0) {
+    printf("failed to open for write: %s\n", path);
+    return false;
+  }
+  size_t done = 0;
+  while(done < total) {
+    const size_t n = std::min(buf.size(), total - done);
+    for(size_t off = 0; off < n; ) {
+      const ssize_t w = write(fd, &buf[off], n - off);
+      if(w <= 0) {
+        printf("failed to write: %s\n", path);
+        close(fd);
+        return false;
+      }
+      off += w;
+    }
+    done += n;
+  }
+  close(fd);
+  return true;
+}
+
+size_t ReadFile(const char* path, std::vector<char>& buf) {
+  const int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    printf("failed to open for read: %s\n", path);
+    return 0;
+  }
+  size_t total = 0;
+  ssize_t n;
+  while((n = read(fd, buf.data(), buf.size())) > 0) {
+    total += n;
+  }
+  close(fd);
+  return total;
+}
+
+extern "C" void main(int argc, char** argv) {
+  const char* path = argc >= 2 ? argv[1] : "/iobench.dat";
+  const size_t total = (argc >= 3 ? strtoul(argv[2], nullptr, 0) : 4096) * 1024;
+  const size_t buf_sizes[] = {128, 512, 4096, 32768, 262144};
+
+  printf("file %s, %lu KiB\n", path, total / 1024);
+  printf("  bufsize   write KiB/s    read KiB/s\n");
+  for(const size_t buf_size : buf_sizes) {
+    std::vector<char> buf(buf_size);
+    for(size_t i = 0; i < buf_size; ++i) {
+      buf[i] = 'a' + i % 26;
+    }
+
+    const uint64_t w_start = NowNanoseconds();
+    if(!WriteFile(path, buf, total)) {
+      exit(1);
+    }
+    const uint64_t w_ns = NowNanoseconds() - w_start;
+
+    const uint64_t r_start = NowNanoseconds();
+    const size_t read_bytes = ReadFile(path, buf);
+    const uint64_t r_ns = NowNanoseconds() - r_start;
+    if(read_bytes != total) {
+      printf("short read: %lu / %lu bytes\n", read_bytes, total);
+      exit(1);
+    }
+
+    printf("%9lu %13lu %13lu\n", buf_size, KiBPerSec(total, w_ns), KiBPerSec(total, r_ns));
+  }
+  exit(0);
+}
@@ -1,5 +1,6 @@
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <random>
 #include "../syscall.h"
 
@@ -28,12 +29,18 @@ extern "C" void main(int argc, char** argv) {
     exit(err_openwin);
   }
 
+  // -a を付けるとアンチエイリアスして描く
+  uint64_t flags = 0;
+  if (argc >= 2 && strcmp(argv[1], "-a") == 0) {
+    flags = LAYER_ANTIALIAS;
+  }
+
   const int x0 = 4, y0 = 24, x1 = 4 + kRadius + 10, y1 = 24 + kRadius;
   for (int deg = 0; deg <= 90; deg += 5) {
     const int x = kRadius * cos(M_PI * deg / 180.0);
     const int y = kRadius * sin(M_PI * deg / 180.0);
-    SyscallWinDrawLine(layer_id, x0, y0, x0 + x, y0 + y, Color(deg));
-    SyscallWinDrawLine(layer_id, x1, y1, x1 + x, y1 - y, Color(deg + 90));
+    SyscallWinDrawLine(layer_id | flags, x0, y0, x0 + x, y0 + y, Color(deg));
+    SyscallWinDrawLine(layer_id | flags, x1, y1, x1 + x, y1 - y, Color(deg + 90));
   }
   exit(0);
 }
@@ -4,11 +4,34 @@
 #include <stdint.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "syscall.h"
 
+static uint64_t ClockNanoseconds(void) {
+  const volatile struct ClockPage* page = (const volatile struct ClockPage*)CLOCK_PAGE_ADDR;
+  return ClockPageNanoseconds(page, __builtin_ia32_rdtsc());
+}
+
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  // 実時間時計を持たないので、どの時計も起動時からの経過時間を返す
+  const uint64_t ns = ClockNanoseconds();
+  tp->tv_sec = ns / 1000000000;
+  tp->tv_nsec = ns % 1000000000;
+  return 0;
+}
+
+struct SyscallResult GetCurrentTickFast(void) {
+  struct SyscallResult res = { ClockNanoseconds() / 1000, 1000000 };
+  return res;
+}
+
 int close(int fd) {
-  errno = EBADF;
+  struct SyscallResult res = SyscallCloseFile(fd);
+  if(res.error == 0) {
+    return 0;
+  }
+  errno = res.error;
   return -1;
 }
 
@@ -21,6 +44,15 @@ pid_t getpid(void) {
   return 0;
 }
 
+int ftruncate(int fd, off_t length) {
+  struct SyscallResult res = SyscallTruncateFile(fd, length);
+  if(res.error == 0) {
+    return 0;
+  }
+  errno = res.error;
+  return -1;
+}
+
 int isatty(int fd) {
   errno = EBADF;
   return -1;
@@ -32,7 +64,20 @@ int kill(pid_t pid, int sig) {
 }
 
 off_t lseek(int fd, off_t offset, int whence) {
-  errno = EBADF;
+  struct SyscallResult res = SyscallSeekFile(fd, offset, whence);
+  if(res.error == 0) {
+    return res.value;
+  }
+  errno = res.error;
+  return -1;
+}
+
+int mkdir(const char* path, mode_t mode) {
+  struct SyscallResult res = SyscallMakeDirectory(path, mode);
+  if(res.error == 0) {
+    return 0;
+  }
+  errno = res.error;
   return -1;
 }
 
@@ -55,6 +100,24 @@ int posix_memalign(void** memptr, size_t alignment, size_t size) {
   return 0;
 }
 
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+  struct SyscallResult res = SyscallPRead(fd, buf, count, offset);
+  if(res.error == 0) {
+    return res.value;
+  }
+  errno = res.error;
+  return -1;
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+  struct SyscallResult res = SyscallPWrite(fd, buf, count, offset);
+  if(res.error == 0) {
+    return res.value;
+  }
+  errno = res.error;
+  return -1;
+}
+
 ssize_t read(int fd, void* buf, size_t count) {
   struct SyscallResult res = SyscallReadFile(fd, buf, count);
   if(res.error == 0) {
@@ -64,6 +127,15 @@ ssize_t read(int fd, void* buf, size_t count) {
   return -1;
 }
 
+int rename(const char* old_path, const char* new_path) {
+  struct SyscallResult res = SyscallRename(old_path, new_path);
+  if(res.error == 0) {
+    return 0;
+  }
+  errno = res.error;
+  return -1;
+}
+
 caddr_t sbrk(int incr) {
   static uint64_t dpage_end = 0;
   static uint64_t program_break = 0;
@@ -85,8 +157,17 @@ caddr_t sbrk(int incr) {
   return (caddr_t)prev_break;
 }
 
+int unlink(const char* path) {
+  struct SyscallResult res = SyscallUnlink(path);
+  if(res.error == 0) {
+    return 0;
+  }
+  errno = res.error;
+  return -1;
+}
+
 ssize_t write(int fd, const void* buf, size_t count) {
-  struct SyscallResult res = SyscallPutString(fd, buf, count);
+  struct SyscallResult res = SyscallWriteFile(fd, buf, count);
   if (res.error == 0) {
     return res.value;
   }
@@ -0,0 +1,81 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include "../syscall.h"
+
+// ファイルを SQ / CQ で読み、標準出力に書く。
+// kDepth 個の読み込みをまとめて 1 回のシステムコールで処理してから、同じように書き出す
+// 使い方: ringcat <file>
+
+const unsigned int kDepth = 8;
+const size_t kBlockSize = 4096;
+char bufs[kDepth][kBlockSize];
+
+IoRingHeader* ring;
+
+void Submit(uint32_t opcode, int fd, void* addr, size_t len, uint64_t offset, uint64_t user_data) {
+  IoSubmission* sqe = IoRingGetSubmission(ring);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = addr;
+  sqe->len = len;
+  sqe->offset = offset;
+  sqe->user_data = user_data;
+}
+
+extern "C" void main(int argc, char** argv) {
+  if(argc < 2) {
+    printf("Usage: %s <file>\n", argv[0]);
+    exit(1);
+  }
+
+  const int fd = open(argv[1], O_RDONLY);
+  if(fd < 0) {
+    printf("failed to open: %s\n", argv[1]);
+    exit(1);
+  }
+
+  auto [addr, err] = SyscallIoRingSetup(kDepth);
+  if(err) {
+    printf("failed to set up io ring: %d\n", err);
+    exit(1);
+  }
+  ring = reinterpret_cast<IoRingHeader*>(addr);
+
+  size_t offset = 0;
+  bool eof = false;
+  while(!eof) {
+    for(unsigned int i = 0; i < kDepth; ++i) {
+      Submit(kIoRead, fd, bufs[i], kBlockSize, offset + i * kBlockSize, i);
+    }
+    SyscallIoRingEnter(kDepth);
+
+    // 完了は順不同でありうるので、user_data でどのバッファかを知る
+    size_t lens[kDepth] = {};
+    while(IoCompletion* cqe = IoRingPeekCompletion(ring)) {
+      if(cqe->error) {
+        printf("failed to read: %d\n", cqe->error);
+        exit(1);
+      }
+      lens[cqe->user_data] = cqe->result;
+      IoRingSeen(ring);
+    }
+
+    unsigned int n = 0;
+    while(n < kDepth && lens[n] > 0) {
+      Submit(kIoWrite, STDOUT_FILENO, bufs[n], lens[n], IO_OFFSET_CURRENT, n);
+      eof = lens[n] < kBlockSize;
+      ++n;
+    }
+    eof = eof || n < kDepth;
+    SyscallIoRingEnter(n);
+    while(IoRingPeekCompletion(ring)) {
+      IoRingSeen(ring);
+    }
+    offset += kDepth * kBlockSize;
+  }
+
+  close(fd);
+  exit(0);
+}
@@ -4,35 +4,56 @@
 
 static constexpr int kWidth = 100, kHeight = 100;
 
+// 0xRRGGBB を画素の形式に合わせる
+uint32_t ToPixel(const WinSurface& surface, uint32_t color) {
+  if(surface.format == kPixelRGBResv8BitPerColor) {
+    return (color & 0x00ff00) | (color >> 16 & 0xff) | (color & 0xff) << 16;
+  }
+  return color;
+}
+
+void FillRect(const WinSurface& surface, int x, int y, int w, int h, uint32_t color) {
+  const uint32_t c = ToPixel(surface, color);
+  for(int dy = 0; dy < h; ++dy) {
+    uint32_t* line = &surface.pixels[(y + dy) * surface.stride + x];
+    for(int dx = 0; dx < w; ++dx) {
+      line[dx] = c;
+    }
+  }
+}
+
 extern "C" void main(int argc, char** argv) {
   auto [layer_id, err_openwin] = SyscallOpenWindow(kWidth + 8, kHeight + 28, 10, 10, "stars");
   if(err_openwin) {
     exit(err_openwin);
   }
 
+  // ウィンドウの画素に直接描き、最後に 1 回だけ画面に反映する
+  WinSurface surface;
+  if(auto [addr, err] = SyscallWinMapSurface(layer_id, &surface); err) {
+    exit(err);
+  }
+
   // 背景を黒で塗りつぶす
-  SyscallWinFillRectangle(layer_id | LAYER_NO_REDRAW, 4, 24, kWidth, kHeight, 0x000000);
+  FillRect(surface, 4, 24, kWidth, kHeight, 0x000000);
 
   int num_stars = 100;
   if(argc >= 2) {
     num_stars = atoi(argv[1]);
   }
 
-  auto [tick_start, timer_freq] = SyscallGetCurrentTick();
+  auto [tick_start, timer_freq] = GetCurrentTickFast();
 
   std::default_random_engine rand_engine;
   std::uniform_int_distribution x_dist(0, kWidth - 2), y_dist(0, kHeight - 2);
   for(int i = 0; i < num_stars; ++i) {
     int x = x_dist(rand_engine);
     int y = y_dist(rand_engine);
-    SyscallWinFillRectangle(
-      layer_id | LAYER_NO_REDRAW,
-      4 + x, 24 + y, 2, 2, 0xfff100
-    );
+    FillRect(surface, 4 + x, 24 + y, 2, 2, 0xfff100);
   }
-  SyscallWinRedraw(layer_id);
+  SyscallWinPresent(layer_id, 4, 24, kWidth, kHeight);
 
-  auto tick_end = SyscallGetCurrentTick();
+  auto tick_end = GetCurrentTickFast();
   printf("%d starts in %lu ms.\n", num_stars, (tick_end.value - tick_start) * 1000 / timer_freq);
 
   exit(0);
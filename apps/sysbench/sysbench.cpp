@@ -0,0 +1,39 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../syscall.h"
+#include "../../kernel/histogram.hpp"
+
+// schedbench と同じ形式でシステムコールの往復にかかるサイクル数を出力する
+
+const int kRounds = 10000;
+
+void PrintHistogram(const char* name, std::vector<uint64_t>& samples) {
+  const auto stats = SortSamples(samples);
+  printf("%s: n=%lu\n", name, stats.n);
+  PrintSampleHistogram([](const char* format, auto... args) {
+    printf(format, args...);
+  }, samples, stats);
+}
+
+extern "C" void main(int argc, char** argv) {
+  std::vector<uint64_t> samples(kRounds);
+
+  // 何もしないに近いシステムコール（syscall 命令で入って sysret で戻るまで）
+  for(int i = 0; i < kRounds; ++i) {
+    const uint64_t start = __builtin_ia32_rdtsc();
+    SyscallGetCurrentTick();
+    samples[i] = __builtin_ia32_rdtsc() - start;
+  }
+  PrintHistogram("syscall round trip", samples);
+
+  // 比較用：時計ページを読むだけならカーネルに入らない
+  for(int i = 0; i < kRounds; ++i) {
+    const uint64_t start = __builtin_ia32_rdtsc();
+    GetCurrentTickFast();
+    samples[i] = __builtin_ia32_rdtsc() - start;
+  }
+  PrintHistogram("clock page read", samples);
+
+  exit(0);
+}
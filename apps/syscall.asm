@@ -26,3 +26,23 @@ define_syscall OpenFile,          0x8000000c
 define_syscall ReadFile,          0x8000000d
 define_syscall DemandPages,       0x8000000e
 define_syscall MapFile,           0x8000000f
+define_syscall MakeDirectory,     0x80000010
+define_syscall Unlink,            0x80000011
+define_syscall Rename,            0x80000012
+define_syscall TruncateFile,      0x80000013
+define_syscall SeekFile,          0x80000014
+define_syscall CloseFile,         0x80000015
+define_syscall WinSubmit,         0x80000016
+define_syscall WinMapSurface,     0x80000017
+define_syscall WinPresent,        0x80000018
+define_syscall WinBlit,           0x80000019
+define_syscall WinDrawPolyline,   0x8000001a
+define_syscall WriteFile,         0x8000001b
+define_syscall ReadV,             0x8000001c
+define_syscall WriteV,            0x8000001d
+define_syscall PRead,             0x8000001e
+define_syscall PWrite,            0x8000001f
+define_syscall Splice,            0x80000020
+define_syscall IoRingSetup,       0x80000021
+define_syscall IoRingEnter,       0x80000022
+define_syscall ReadEventTimeout,  0x80000023
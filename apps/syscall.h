@@ -12,6 +12,10 @@ extern "C" {
 
 #include "../kernel/logger.hpp"
 #include "../kernel/app_event.hpp"
+#include "../kernel/win_command.hpp"
+#include "../kernel/clock_page.hpp"
+#include "../kernel/io_vec.hpp"
+#include "../kernel/io_ring.hpp"
 
 struct SyscallResult {
   uint64_t value;
@@ -24,28 +28,71 @@ void SyscallExit(int exit_code);
 struct SyscallResult SyscallOpenWindow(int w, int h, int x, int y, const char* title);
 
 #define LAYER_NO_REDRAW (0x00000001ull << 32)
+// 線を Wu の方法でアンチエイリアスして描く（SyscallWinDrawLine, SyscallWinDrawPolyline）
+#define LAYER_ANTIALIAS (0x00000002ull << 32)
 struct SyscallResult SyscallWinWriteString(
   uint64_t layer_id_flags, int x, int y, uint32_t color, const char* s);
 struct SyscallResult SyscallWinFillRectangle(
   uint64_t layer_id_flags, int x, int y, int w, int h, uint32_t color);
 struct SyscallResult SyscallGetCurrentTick();
+// 時計ページを読むだけなのでシステムコールは発生しない（SyscallGetCurrentTick と同じ形式で返す）
+struct SyscallResult GetCurrentTickFast();
 struct SyscallResult SyscallWinRedraw(uint64_t layer_id_flags);
 struct SyscallResult SyscallWinDrawLine(uint64_t layer_id_flags, int x0, int y0, int x1, int y1, uint32_t color);
+// points[0], points[1], ... を順に結ぶ線を 1 回で描く
+struct SyscallResult SyscallWinDrawPolyline(
+  uint64_t layer_id_flags, const struct WinPoint* points, size_t num_points, uint32_t color);
 struct SyscallResult SyscallCloseWindow(uint64_t layer_id_flags);
+// コマンドを順に実行し、描いた範囲だけを 1 回で画面に反映する（LAYER_NO_REDRAW なら反映しない）。
+// 引数が不正なら何も描かず、value に最初の不正なコマンドの添字を返す
+struct SyscallResult SyscallWinSubmit(uint64_t layer_id_flags, const struct WinCommand* cmds, size_t num_cmds);
+// ウィンドウの画素をアプリのアドレス空間に見せる。value は画素の先頭アドレス。
+// 書いた画素は SyscallWinPresent で範囲を指定するまで画面には反映されない
+struct SyscallResult SyscallWinMapSurface(uint64_t layer_id_flags, struct WinSurface* surface);
+struct SyscallResult SyscallWinPresent(uint64_t layer_id_flags, int x, int y, int w, int h);
+// src の画素を変換しながらウィンドウの (x, y) に w x h だけ描く。はみ出した部分は描かない
+struct SyscallResult SyscallWinBlit(uint64_t layer_id_flags, int x, int y, int w, int h,
+                                    const struct WinBlitSource* src);
 struct SyscallResult SyscallReadEvent(struct AppEvent* events, size_t len);
+// 溜まっているイベントを最大 len 個まとめて取り出す（続けて届いたマウスの移動は 1 つにまとまっている）。
+// 1 つもなければ timeout_ms ミリ秒まで待つ。負なら届くまで待ち、0 なら待たずに 0 個で返る
+struct SyscallResult SyscallReadEventTimeout(struct AppEvent* events, size_t len, long timeout_ms);
 
 #define TIMER_ONESHOT_REL 1
 #define TIMER_ONESHOT_ABS 0
+#define TIMER_UNIT_US     2 // timeout_ms をマイクロ秒として扱う
 struct SyscallResult SyscallCreateTimer(
   unsigned int type, int timer_value, unsigned long timeout_ms, const char* description
 );
 
 struct SyscallResult SyscallOpenFile(const char* path, int flags);
 struct SyscallResult SyscallReadFile(int fd, void* buf, size_t count);
+// PutString と違い、1 回で書ける量に上限はない
+struct SyscallResult SyscallWriteFile(int fd, const void* buf, size_t count);
+// iov のバッファを順に読み書きする。足りなかったところで止め、value に合計のバイト数を返す
+struct SyscallResult SyscallReadV(int fd, const struct IoVec* iov, size_t iovcnt);
+struct SyscallResult SyscallWriteV(int fd, const struct IoVec* iov, size_t iovcnt);
+// offset の位置を読み書きする。ファイルの読み書きの位置は動かない
+struct SyscallResult SyscallPRead(int fd, void* buf, size_t count, size_t offset);
+struct SyscallResult SyscallPWrite(int fd, const void* buf, size_t count, size_t offset);
+// fd_in から最大 len バイトを読んで fd_out に書く。アプリのバッファは経由しない
+struct SyscallResult SyscallSplice(int fd_in, int fd_out, size_t len);
+
+// SQ / CQ を作ってマップし、value に IoRingHeader のアドレスを返す。1 つのアプリに 1 つまで
+struct SyscallResult SyscallIoRingSetup(unsigned int entries);
+// SQ に積んだ要求をまとめて処理し、CQ に min_complete 個以上たまるまで待つ。value は取り出した要求の数
+struct SyscallResult SyscallIoRingEnter(unsigned int min_complete);
 
 struct SyscallResult SyscallDemandPages(size_t num_pages, int flags);
 struct SyscallResult SyscallMapFile(int fd, size_t* file_size, int flags);
 
+struct SyscallResult SyscallMakeDirectory(const char* path, int mode);
+struct SyscallResult SyscallUnlink(const char* path);
+struct SyscallResult SyscallRename(const char* old_path, const char* new_path);
+struct SyscallResult SyscallTruncateFile(int fd, size_t length);
+struct SyscallResult SyscallSeekFile(int fd, long offset, int whence);
+struct SyscallResult SyscallCloseFile(int fd);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -124,4 +124,14 @@ namespace acpi {
     while(IoIn32(fadt->pm_tmr_blk) < end);
   }
 
+  uint32_t ReadPMTimer(){
+    return IoIn32(fadt->pm_tmr_blk);
+  }
+
+  uint32_t PMTimerElapsed(uint32_t start, uint32_t end){
+    const bool pm_timer_32 = (fadt->flags >> 8) & 1;
+    const uint32_t mask = pm_timer_32 ? 0xffffffffu : 0x00ffffffu;
+    return (end - start) & mask;
+  }
+
 } //namespace acpi
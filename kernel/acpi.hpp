@@ -69,5 +69,9 @@ namespace acpi {
   const uint32_t kPMTimerFreq = 3579545;
   void WaitMilliseconds(unsigned long msec);
 
+  // PM タイマの現在値と、2 点間のカウント数（24bit タイマの桁あふれを考慮）
+  uint32_t ReadPMTimer();
+  uint32_t PMTimerElapsed(uint32_t start, uint32_t end);
+
 } // namespace acpi
 
@@ -14,6 +14,34 @@ IoIn32:
   in eax, dx
   ret
 
+global IoOut16  ; void IoOut16(uint16_t addr, uint16_t data);
+IoOut16:
+  mov dx, di
+  mov ax, si
+  out dx, ax
+  ret
+
+global IoIn16  ; uint16_t IoIn16(uint16_t addr);
+IoIn16:
+  mov dx, di
+  xor eax, eax
+  in ax, dx
+  ret
+
+global IoOut8  ; void IoOut8(uint16_t addr, uint8_t data);
+IoOut8:
+  mov dx, di
+  mov al, sil
+  out dx, al
+  ret
+
+global IoIn8  ; uint8_t IoIn8(uint16_t addr);
+IoIn8:
+  mov dx, di
+  xor eax, eax
+  in al, dx
+  ret
+
 global GetCS  ; uint16_t GetCS(void);
 GetCS:
     xor eax, eax  ; also clears upper 32 bits of rax
@@ -76,6 +104,16 @@ SetCR0:
   mov cr0, rdi
   ret
 
+global GetCR4 ; uint64_t GetCR4();
+GetCR4:
+  mov rax, cr4
+  ret
+
+global SetCR4 ; void SetCR4(uint64_t value);
+SetCR4:
+  mov cr4, rdi
+  ret
+
 global GetCR2 ; uint64_t GetCR2();
 GetCR2:
   mov rax, cr2
@@ -127,9 +165,8 @@ SwitchContext:
   mov cx, fs
   mov [rsi + 0x30], rcx
   mov dx, gs
-  mov [rsi + 0x38], rdx
-
-  fxsave [rsi + 0xc0]       ; コンテキストの保存が完了
+  mov [rsi + 0x38], rdx     ; コンテキストの保存が完了
+                            ; FPU/SSE の状態は #NM を契機に遅延して退避する（IntHandlerNM）
 
 
 global RestoreContext
@@ -141,9 +178,7 @@ RestoreContext:  ; void RestoreContext(void* task_context);
   push qword [rdi + 0x20] ; CS
   push qword [rdi + 0x08] ; RIP
 
-  ; コンテキストの復帰
-  fxrstor [rdi + 0xc0]
-
+  ; コンテキストの復帰（FPU/SSE の状態は #NM を契機に遅延して復帰する）
   mov rax, [rdi + 0x00]
   mov cr3, rax
   mov rax, [rdi + 0x30]
@@ -204,8 +239,15 @@ IntHandlerLAPICTimer:  ; void IntHandlerLAPICTimer();
     mov rbp, rsp
 
     ; スタック上に TaskContext 型の構造を構築する
+    ; 割り込み処理中のコードが SSE レジスタを壊すので、その時点で載っている
+    ; FPU 状態（持ち主は実行中のタスクとは限らない）を一時的に退避しておく。
+    ; カーネルは AVX を使わないので、レガシー領域（fxsave）だけで十分。
     sub rsp, 512
+    mov [rsp + 464], rax     ; 464~511 は fxsave が書き込まない領域
+    mov rax, cr0
+    clts
     fxsave [rsp]
+    xchg rax, [rsp + 464]    ; RAX を戻し、代わりに CR0 を控えておく
     push r15
     push r14
     push r13
@@ -256,12 +298,91 @@ IntHandlerLAPICTimer:  ; void IntHandlerLAPICTimer();
     pop r14
     pop r15
     fxrstor [rsp]
+    push rax
+    mov rax, [rsp + 8 + 464]
+    mov cr0, rax             ; CR0.TS を割り込み前の状態に戻す
+    pop rax
 
     mov rsp, rbp
     pop rbp
     iretq
 
 
+extern cpu_local
+extern fpu_owner_state
+extern fpu_save_method
+; fpu.cpp の FPUSaveMethod と同じ値
+%define FPU_FXSAVE   0
+%define FPU_XSAVE    1
+
+global IntHandlerNM
+IntHandlerNM:  ; void IntHandlerNM();
+    ; CR0.TS が立っている状態で FPU/SSE 命令を実行すると来る。
+    ; 持ち主の状態を保存し終えるまでは SSE を使うかもしれない C++ のコードを呼べないので、
+    ; 保存と復帰はここで行う
+    push rax
+    push rcx
+    push rdx
+    push rsi
+
+    clts
+    mov rsi, [cpu_local + 8]       ; cpu_local.fpu_state : 実行中のタスクの保存領域
+    mov rcx, [fpu_owner_state]     ; いまの持ち主の保存領域
+    cmp rcx, rsi
+    je .done
+    mov eax, 0xffffffff            ; XCR0 で有効にしたすべての状態を対象にする
+    mov edx, eax
+    test rcx, rcx
+    jz .restore                    ; 持ち主が終了していれば保存は要らない
+
+    cmp dword [fpu_save_method], FPU_XSAVE
+    jb .fxsave
+    je .xsave
+    xsaveopt64 [rcx]
+    jmp .restore
+.fxsave:
+    fxsave64 [rcx]
+    jmp .restore
+.xsave:
+    xsave64 [rcx]
+
+.restore:
+    cmp dword [fpu_save_method], FPU_FXSAVE
+    jne .xrstor
+    fxrstor64 [rsi]
+    jmp .owner
+.xrstor:
+    xrstor64 [rsi]
+.owner:
+    mov [fpu_owner_state], rsi
+
+.done:
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+    iretq
+
+
+global RestoreInterruptedFPU
+RestoreInterruptedFPU:  ; void RestoreInterruptedFPU(const void* fxsave_area);
+  ; 割り込みハンドラ内から別タスクへ切り替える前に、割り込み時点の FPU 状態へ戻す
+  mov rax, cr0
+  clts
+  fxrstor [rdi]
+  mov cr0, rax
+  ret
+
+global XSetBV  ; void XSetBV(uint32_t xcr, uint64_t value);
+XSetBV:
+  mov ecx, edi
+  mov eax, esi
+  mov rdx, rsi
+  shr rdx, 32
+  xsetbv
+  ret
+
+
 global WriteMSR
 WriteMSR:       ; void WriteMSR(uint32_t msr, uint64_t value);
   mov rdx, rsi
@@ -274,6 +395,9 @@ WriteMSR:       ; void WriteMSR(uint32_t msr, uint64_t value);
 
 extern GetCurrentTaskOSStackPointer
 extern syscall_table
+extern syscall_table_size
+extern SyscallAccount
+extern SyscallNotFound
 global SyscallEntry
 SyscallEntry:       ; void SyscallEntry(void);
   push rbp
@@ -290,9 +414,7 @@ SyscallEntry:       ; void SyscallEntry(void);
   and rsp, 0xfffffffffffffff0
   push rax
   push rdx
-  cli
-  call GetCurrentTaskOSStackPointer
-  sti
+  call GetCurrentTaskOSStackPointer  ; cpu_local を読むだけなので割り込みは禁止しない
   mov rdx, [rsp + 0]  ; RDX
   mov [rax - 16], rdx
   mov rdx, [rsp + 8]  ; RAX
@@ -303,8 +425,32 @@ SyscallEntry:       ; void SyscallEntry(void);
   pop rax
   and rsp, 0xfffffffffffffff0
 
-  call [syscall_table + 8 * eax]
+  ; 表の外の番号は呼ばずに ENOSYS を返す
+  cmp eax, [syscall_table_size]
+  jae .not_found
 
+  ; 番号と開始時の TSC を取っておく（rdtsc が壊す rdx は第 3 引数なので戻す）
+  push rax
+  push rdx
+  rdtsc
+  shl rdx, 32
+  or rax, rdx
+  mov rdx, [rsp]
+  mov [rsp], rax
+  mov eax, [rsp + 8]
+
+  call [syscall_table + 8 * rax]
+
+  ; 呼び出し回数とかかったサイクル数を数える
+  push rax
+  push rdx
+  mov rdi, [rsp + 24] ; 番号
+  mov rsi, [rsp + 16] ; 開始時の TSC
+  call SyscallAccount
+  pop rdx
+  pop rax
+
+.return:
   mov rsp, rbp
 
   pop rsi   ; システムコール番号を復帰
@@ -320,6 +466,10 @@ SyscallEntry:       ; void SyscallEntry(void);
   mov rdi, rax  ; スタックをアプリ用からOS用に切り替える
   mov esi, edx  ; CallApp() の戻り値を設定
   jmp ExitApp
+
+.not_found:
+  call SyscallNotFound
+  jmp .return
   
 
 global ExitApp  ; void ExitApp(uint64_t rsp, int32_t ret_val);
@@ -341,6 +491,28 @@ InvalidateTLB:
   invlpg [rdi]
   ret
 
+global ReadTSC  ; uint64_t ReadTSC();
+ReadTSC:
+  rdtsc
+  shl rdx, 32
+  or rax, rdx
+  ret
+
+global CPUID  ; void CPUID(uint32_t eax, uint32_t ecx, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d);
+CPUID:
+  push rbx        ; RBX は呼び出し先保存レジスタ
+  mov r10, rdx
+  mov r11, rcx
+  mov eax, edi
+  mov ecx, esi
+  cpuid
+  mov [r10], eax
+  mov [r11], ebx
+  mov [r8], ecx
+  mov [r9], edx
+  pop rbx
+  ret
+
 
 
 extern kernel_main_stack;
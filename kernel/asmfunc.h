@@ -5,6 +5,10 @@
 extern "C" {
   void IoOut32(uint16_t addr, uint32_t data);
   uint32_t IoIn32(uint16_t addr);
+  void IoOut16(uint16_t addr, uint16_t data);
+  uint16_t IoIn16(uint16_t addr);
+  void IoOut8(uint16_t addr, uint8_t data);
+  uint8_t IoIn8(uint16_t addr);
   uint16_t GetCS(void);
   void LoadIDT(uint16_t limit, uint64_t offset);
   void LoadGDT(uint16_t limit, uint64_t offset);
@@ -12,6 +16,8 @@ extern "C" {
   void SetDSAll(uint16_t value);
   uint64_t GetCR0();
   void SetCR0(uint64_t value);
+  uint64_t GetCR4();
+  void SetCR4(uint64_t value);
   uint64_t GetCR2();
   void SetCR3(uint64_t value);
   uint64_t GetCR3();
@@ -20,10 +26,15 @@ extern "C" {
   int CallApp(int argc, char** argv, uint16_t ss, uint64_t rip, uint64_t rsp, uint64_t* os_stack_ptr);
   void LoadTR(uint16_t sel);
   void IntHandlerLAPICTimer();
+  void IntHandlerNM();
+  void RestoreInterruptedFPU(const void* fxsave_area);
+  void XSetBV(uint32_t xcr, uint64_t value);
   void WriteMSR(uint32_t msr, uint64_t value);
   void SyscallEntry(void);
   void ExitApp(uint64_t rsp, int32_t ret_val);
   void InvalidateTLB(uint64_t addr);
+  uint64_t ReadTSC();
+  void CPUID(uint32_t eax, uint32_t ecx, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d);
 }
 
 /*
@@ -0,0 +1,183 @@
+#include "benchmark.hpp"
+
+#include "asmfunc.h"
+#include "histogram.hpp"
+#include "message.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+  const int kYieldRounds = 1000;
+  const int kPingPongRounds = 1000;
+  const int kTimerRounds = 100;
+  const unsigned long kTimerDelay = kTimerFreq / 1000; // 1 ms
+
+  struct BenchmarkData {
+    std::vector<uint64_t> yield;
+    std::vector<uint64_t> ping_pong;
+    std::vector<uint64_t> timer;
+  };
+
+  uint64_t NanosecondsToCycles(uint64_t ns) {
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(ns) * tsc_freq / 1'000'000'000);
+  }
+
+  uint64_t CyclesToNanoseconds(uint64_t cycles) {
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(cycles) * 1'000'000'000 / tsc_freq);
+  }
+
+  // 止めるよう言われるまで CPU を譲り続ける
+  void TaskYieldPartner(uint64_t task_id, int64_t data) {
+    auto stop = reinterpret_cast<volatile bool*>(data);
+    while(!*stop) {
+      __asm__("cli");
+      task_manager->Yield();
+      __asm__("sti");
+    }
+
+    __asm__("cli");
+    task_manager->Finish(0);
+  }
+
+  // 受け取った kBenchmark をそのまま送り返す
+  void TaskPingPongPartner(uint64_t task_id, int64_t data) {
+    __asm__("cli");
+    Task& task = task_manager->CurrentTask();
+    __asm__("sti");
+
+    while(true) {
+      __asm__("cli");
+      auto msg = task.ReceiveMessage();
+      if(!msg) {
+        task.Sleep();
+        __asm__("sti");
+        continue;
+      }
+      __asm__("sti");
+
+      if(msg->type != Message::kBenchmark) {
+        continue;
+      }
+      if(msg->arg.benchmark.stop) {
+        break;
+      }
+
+      Message reply{Message::kBenchmark, task_id};
+      reply.arg.benchmark.seq = msg->arg.benchmark.seq;
+      reply.arg.benchmark.stop = false;
+      __asm__("cli");
+      task_manager->SendMessage(msg->src_task, reply);
+      __asm__("sti");
+    }
+
+    __asm__("cli");
+    task_manager->Finish(0);
+  }
+
+  // 割り込み禁止状態で呼ぶ。pred を満たすメッセージが届くまでスリープする
+  template <class Pred>
+  void WaitMessage(Task& task, Pred pred) {
+    while(true) {
+      auto msg = task.ReceiveMessage();
+      if(!msg) {
+        task.Sleep();
+        continue;
+      }
+      if(pred(*msg)) {
+        return;
+      }
+    }
+  }
+
+  void TaskSchedBenchmark(uint64_t task_id, int64_t data) {
+    auto bench = reinterpret_cast<BenchmarkData*>(data);
+
+    __asm__("cli");
+    Task& task = task_manager->CurrentTask();
+
+    // yield : 同じレベルの相手と交互に動くので、1 回の測定にタスク切り替え 2 回分が含まれる
+    volatile bool stop_yield = false;
+    uint64_t partner_id = task_manager->NewTask()
+      .InitContext(TaskYieldPartner, reinterpret_cast<int64_t>(&stop_yield))
+      .Wakeup()
+      .ID();
+    for(int i = 0; i < kYieldRounds; ++i) {
+      const uint64_t start = ReadTSC();
+      task_manager->Yield();
+      bench->yield.push_back(ReadTSC() - start);
+    }
+    stop_yield = true;
+    task_manager->WaitFinish(partner_id);
+
+    // メッセージの往復 : 送信 → 相手の起床 → 返信 → 自分の起床
+    partner_id = task_manager->NewTask()
+      .InitContext(TaskPingPongPartner, 0)
+      .Wakeup()
+      .ID();
+    for(int i = 0; i < kPingPongRounds; ++i) {
+      Message ping{Message::kBenchmark, task_id};
+      ping.arg.benchmark.seq = i;
+      ping.arg.benchmark.stop = false;
+
+      const uint64_t start = ReadTSC();
+      task_manager->SendMessage(partner_id, ping);
+      WaitMessage(task, [i](const Message& m) {
+        return m.type == Message::kBenchmark && m.arg.benchmark.seq == i;
+      });
+      bench->ping_pong.push_back(ReadTSC() - start);
+    }
+    Message stop{Message::kBenchmark, task_id};
+    stop.arg.benchmark.stop = true;
+    task_manager->SendMessage(partner_id, stop);
+    task_manager->WaitFinish(partner_id);
+
+    // タイマ満了時刻から、メッセージを受け取って動き出すまで
+    for(int i = 0; i < kTimerRounds; ++i) {
+      const unsigned long timeout = timer_manager->CurrentTick() + kTimerDelay;
+      timer_manager->AddTimer(Timer{timeout, i, task_id, "Bench"});
+      WaitMessage(task, [i](const Message& m) {
+        return m.type == Message::kTimerTimeout && m.arg.timer.value == i;
+      });
+
+      const uint64_t deadline_ns = timeout * (1'000'000'000 / kTimerFreq);
+      const uint64_t now_ns = CurrentNanoseconds();
+      bench->timer.push_back(NanosecondsToCycles(now_ns > deadline_ns ? now_ns - deadline_ns : 0));
+    }
+
+    task_manager->Finish(0);
+  }
+}
+
+void PrintHistogram(FileDescriptor& fd, const char* name, std::vector<uint64_t>& samples) {
+  if(samples.empty()) {
+    PrintToFD(fd, "%s: no samples\n", name);
+    return;
+  }
+
+  const auto stats = SortSamples(samples);
+  PrintToFD(fd, "%s: n=%lu p50=%luns\n", name, stats.n, CyclesToNanoseconds(stats.p50));
+  PrintSampleHistogram([&fd](const char* format, auto... args) {
+    PrintToFD(fd, format, args...);
+  }, samples, stats);
+}
+
+void RunSchedBenchmark(FileDescriptor& fd) {
+  // 測定中にメモリを確保しないよう先に確保しておく
+  BenchmarkData bench;
+  bench.yield.reserve(kYieldRounds);
+  bench.ping_pong.reserve(kPingPongRounds);
+  bench.timer.reserve(kTimerRounds);
+
+  __asm__("cli");
+  const uint64_t task_id = task_manager->NewTask()
+    .InitContext(TaskSchedBenchmark, reinterpret_cast<int64_t>(&bench))
+    .Wakeup()
+    .ID();
+  task_manager->WaitFinish(task_id);
+  __asm__("sti");
+
+  PrintToFD(fd, "TSC %lu MHz\n", tsc_freq / 1000000);
+  PrintHistogram(fd, "yield (2 switches)", bench.yield);
+  PrintHistogram(fd, "message round trip", bench.ping_pong);
+  PrintHistogram(fd, "timer to wakeup", bench.timer);
+}
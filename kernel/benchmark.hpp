@@ -0,0 +1,19 @@
+/**
+ * @file benchmark.hpp
+ *
+ * スケジューラ周りの所要時間を TSC のサイクル数で測るセルフベンチマーク
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "file.hpp"
+
+// samples を昇順に並べ替え、統計値と log2 のヒストグラムを出力する
+void PrintHistogram(FileDescriptor& fd, const char* name, std::vector<uint64_t>& samples);
+
+// カーネルタスク間の yield、メッセージの往復、タイマ満了から起床までを測って出力する。
+// 測定は別タスクで行い、呼び出し元は終わるまでスリープする（割り込み許可状態で呼ぶこと）
+void RunSchedBenchmark(FileDescriptor& fd);
@@ -0,0 +1,32 @@
+#include "block_device.hpp"
+
+#include <cstring>
+
+RamBlockDevice::RamBlockDevice(void* image, size_t sector_size, uint64_t sector_count)
+  : image_{reinterpret_cast<uint8_t*>(image)},
+    sector_size_{sector_size}, sector_count_{sector_count}
+{
+}
+
+Error RamBlockDevice::Read(uint64_t lba, void* buf, size_t count) {
+  if(lba + count > sector_count_) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+  memcpy(buf, &image_[lba * sector_size_], count * sector_size_);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error RamBlockDevice::Write(uint64_t lba, const void* buf, size_t count) {
+  if(lba + count > sector_count_) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+  memcpy(&image_[lba * sector_size_], buf, count * sector_size_);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void* RamBlockDevice::DirectMap(uint64_t lba) {
+  if(lba >= sector_count_) {
+    return nullptr;
+  }
+  return &image_[lba * sector_size_];
+}
@@ -0,0 +1,45 @@
+/**
+ * @file block_device.hpp
+ *
+ * セクタ単位で読み書きするデバイスの共通インターフェース
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "error.hpp"
+
+class BlockDevice {
+  public:
+    virtual ~BlockDevice() = default;
+    // 1 セクタのバイト数
+    virtual size_t SectorSize() const = 0;
+    // セクタ数
+    virtual uint64_t SectorCount() const = 0;
+    // lba から count セクタを buf に読む
+    virtual Error Read(uint64_t lba, void* buf, size_t count) = 0;
+    // buf の内容を lba から count セクタに書く
+    virtual Error Write(uint64_t lba, const void* buf, size_t count) = 0;
+
+    // 内容がそのままメモリ上に置いてあるデバイスなら lba のアドレスを返す。
+    // そうでなければ nullptr を返す
+    virtual void* DirectMap(uint64_t lba) { return nullptr; }
+};
+
+// ブートローダが読み込んだメモリ上のディスクイメージ
+class RamBlockDevice : public BlockDevice {
+  public:
+    RamBlockDevice(void* image, size_t sector_size, uint64_t sector_count);
+    size_t SectorSize() const override { return sector_size_; }
+    uint64_t SectorCount() const override { return sector_count_; }
+    Error Read(uint64_t lba, void* buf, size_t count) override;
+    Error Write(uint64_t lba, const void* buf, size_t count) override;
+    void* DirectMap(uint64_t lba) override;
+
+  private:
+    uint8_t* image_;
+    size_t sector_size_;
+    uint64_t sector_count_;
+};
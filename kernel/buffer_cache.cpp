@@ -0,0 +1,339 @@
+#include "buffer_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "logger.hpp"
+
+BufferCache* buffer_cache;
+Mutex fs_mutex;
+
+namespace {
+  // 1 回の書き戻し要求にまとめる最大のバイト数
+  const size_t kMaxWriteBackBytes = 256 * 1024;
+  // キャッシュの容量
+  const size_t kBufferCacheBytes = 8 * 1024 * 1024;
+}
+
+void InitializeBufferCache(BlockDevice& dev) {
+  // マウントに失敗して別のデバイスに替えるときは作り直す
+  delete buffer_cache;
+  buffer_cache = new BufferCache{dev, kBufferCacheBytes};
+}
+
+BufferCache::BufferCache(BlockDevice& dev, size_t capacity_bytes)
+  : dev_{dev}, capacity_bytes_{capacity_bytes}
+{
+}
+
+BufferCache::Ref::Ref(BufferCache* cache, Buffer* buf) : cache_{cache}, buf_{buf} {
+  cache_->Pin(buf_);
+}
+
+BufferCache::Ref::Ref(Ref&& rhs) : cache_{rhs.cache_}, buf_{rhs.buf_} {
+  rhs.buf_ = nullptr;
+}
+
+BufferCache::Ref& BufferCache::Ref::operator=(Ref&& rhs) {
+  if(this != &rhs) {
+    _Release();
+    cache_ = rhs.cache_;
+    buf_ = rhs.buf_;
+    rhs.buf_ = nullptr;
+  }
+  return *this;
+}
+
+BufferCache::Ref::~Ref() {
+  _Release();
+}
+
+void BufferCache::Ref::_Release() {
+  if(buf_) {
+    cache_->Unpin(buf_);
+    buf_ = nullptr;
+  }
+}
+
+void BufferCache::Pin(Buffer* buf) {
+  MutexGuard lock{fs_mutex};
+  ++buf->pins;
+}
+
+void BufferCache::Unpin(Buffer* buf) {
+  MutexGuard lock{fs_mutex};
+  --buf->pins;
+}
+
+BufferCache::Buffer* BufferCache::_Insert(uint64_t lba, size_t sectors) {
+  const size_t bytes = sectors * dev_.SectorSize();
+  auto [it, inserted] = buffers_.emplace(lba, Buffer{
+    lba, sectors, std::make_unique<uint8_t[]>(bytes), false, 0, {}
+  });
+  auto buf = &it->second;
+  lru_.push_front(buf);
+  buf->lru_it = lru_.begin();
+  used_bytes_ += bytes;
+  return buf;
+}
+
+void BufferCache::_Touch(Buffer* buf) {
+  lru_.splice(lru_.begin(), lru_, buf->lru_it);
+}
+
+Error BufferCache::_MakeRoom(size_t bytes) {
+  const size_t sector_size = dev_.SectorSize();
+  auto it = lru_.end();
+  while(used_bytes_ + bytes > capacity_bytes_ && it != lru_.begin()) {
+    --it;
+    Buffer* victim = *it;
+    if(victim->pins > 0) {
+      continue;
+    }
+    if(victim->dirty) {
+      // 1 つずつ書かずに、汚れているものをまとめて書き戻してから追い出す
+      if(auto err = Flush()) {
+        return err;
+      }
+    }
+
+    it = lru_.erase(it);
+    used_bytes_ -= victim->sectors * sector_size;
+    buffers_.erase(victim->lba);
+    ++stat_.evictions;
+  }
+  // 全部固定されていて追い出せない場合は容量を超えて確保する
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+WithError<BufferCache::Ref> BufferCache::Get(uint64_t lba, size_t sectors) {
+  MutexGuard lock{fs_mutex};
+  if(auto it = buffers_.find(lba); it != buffers_.end()) {
+    ++stat_.hits;
+    _Touch(&it->second);
+    return {Ref{this, &it->second}, MAKE_ERROR(Error::kSuccess)};
+  }
+
+  ++stat_.misses;
+  if(auto err = _MakeRoom(sectors * dev_.SectorSize())) {
+    return {Ref{}, err};
+  }
+  auto buf = _Insert(lba, sectors);
+  ++stat_.device_reads;
+  if(auto err = dev_.Read(lba, buf->data.get(), sectors)) {
+    lru_.erase(buf->lru_it);
+    used_bytes_ -= sectors * dev_.SectorSize();
+    buffers_.erase(lba);
+    return {Ref{}, err};
+  }
+  return {Ref{this, buf}, MAKE_ERROR(Error::kSuccess)};
+}
+
+WithError<BufferCache::Ref> BufferCache::GetForOverwrite(uint64_t lba, size_t sectors) {
+  MutexGuard lock{fs_mutex};
+  if(auto it = buffers_.find(lba); it != buffers_.end()) {
+    _Touch(&it->second);
+    return {Ref{this, &it->second}, MAKE_ERROR(Error::kSuccess)};
+  }
+
+  if(auto err = _MakeRoom(sectors * dev_.SectorSize())) {
+    return {Ref{}, err};
+  }
+  return {Ref{this, _Insert(lba, sectors)}, MAKE_ERROR(Error::kSuccess)};
+}
+
+Error BufferCache::Read(uint64_t lba, size_t sectors, size_t offset, void* buf, size_t len) {
+  MutexGuard lock{fs_mutex};
+  const size_t bytes = sectors * dev_.SectorSize();
+  const size_t end = (offset + len + bytes - 1) / bytes;
+  auto dst = reinterpret_cast<uint8_t*>(buf);
+  size_t i = offset / bytes;
+  size_t off = offset % bytes;
+
+  std::vector<uint8_t> tmp;
+  while(len > 0) {
+    if(auto it = buffers_.find(lba + i * sectors); it != buffers_.end()) {
+      ++stat_.hits;
+      _Touch(&it->second);
+      // buf がアプリのメモリならページフォルトの処理でキャッシュが使われうるので、写す間は固定する
+      const Ref ref{this, &it->second};
+      const size_t n = std::min(len, bytes - off);
+      memcpy(dst, &ref->data[off], n);
+      dst += n;
+      len -= n;
+      off = 0;
+      ++i;
+      continue;
+    }
+
+    size_t count = 1;
+    while(i + count < end && buffers_.count(lba + (i + count) * sectors) == 0) {
+      ++count;
+    }
+    stat_.misses += count;
+    if(auto err = _MakeRoom(count * bytes)) {
+      return err;
+    }
+
+    const uint64_t start = lba + i * sectors;
+    tmp.resize(count * bytes);
+    ++stat_.device_reads;
+    if(auto err = dev_.Read(start, tmp.data(), count * sectors)) {
+      return err;
+    }
+    for(size_t k = 0; k < count; ++k) {
+      auto b = _Insert(start + k * sectors, sectors);
+      memcpy(b->data.get(), &tmp[k * bytes], bytes);
+    }
+    const size_t n = std::min(len, count * bytes - off);
+    memcpy(dst, &tmp[off], n);
+    dst += n;
+    len -= n;
+    off = 0;
+    i += count;
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+BufferCache::Buffer* BufferCache::Find(uint64_t lba) {
+  MutexGuard lock{fs_mutex};
+  auto it = buffers_.find(lba);
+  return it == buffers_.end() ? nullptr : &it->second;
+}
+
+void BufferCache::ReadAhead(uint64_t lba, size_t sectors, size_t n) {
+  MutexGuard lock{fs_mutex};
+  const size_t bytes = sectors * dev_.SectorSize();
+  // 先読みでキャッシュの大半を入れ替えてしまわないようにする
+  size_t budget = std::max<size_t>(1, capacity_bytes_ / 4 / bytes);
+  n = std::min<uint64_t>(n, (dev_.SectorCount() - std::min(dev_.SectorCount(), lba)) / sectors);
+
+  // 既に載っているものは飛ばし、載っていない連続した範囲ごとに 1 回の要求で読む
+  std::vector<uint8_t> tmp;
+  size_t i = 0;
+  while(i < n && budget > 0) {
+    if(buffers_.count(lba + i * sectors)) {
+      ++i;
+      continue;
+    }
+    size_t count = 1;
+    while(i + count < n && count < budget && buffers_.count(lba + (i + count) * sectors) == 0) {
+      ++count;
+    }
+    if(_MakeRoom(count * bytes)) {
+      return;
+    }
+
+    const uint64_t start = lba + i * sectors;
+    tmp.resize(count * bytes);
+    ++stat_.device_reads;
+    if(dev_.Read(start, tmp.data(), count * sectors)) {
+      return;
+    }
+    stat_.readahead_sectors += count * sectors;
+    for(size_t k = 0; k < count; ++k) {
+      auto buf = _Insert(start + k * sectors, sectors);
+      memcpy(buf->data.get(), &tmp[k * bytes], bytes);
+    }
+    i += count;
+    budget -= count;
+  }
+}
+
+void BufferCache::Discard(uint64_t lba) {
+  MutexGuard lock{fs_mutex};
+  auto it = buffers_.find(lba);
+  if(it == buffers_.end() || it->second.pins > 0) {
+    return;
+  }
+  const size_t bytes = it->second.sectors * dev_.SectorSize();
+  if(it->second.dirty) {
+    dirty_bytes_ -= bytes;
+  }
+  used_bytes_ -= bytes;
+  lru_.erase(it->second.lru_it);
+  buffers_.erase(it);
+}
+
+void BufferCache::MarkDirty(Buffer* buf) {
+  MutexGuard lock{fs_mutex};
+  if(buf->dirty) {
+    return;
+  }
+  buf->dirty = true;
+  dirty_bytes_ += buf->sectors * dev_.SectorSize();
+  if(dirty_bytes_ > capacity_bytes_ / 2) {
+    // 溜まりすぎたらまとめて書き戻す
+    if(auto err = Flush()) {
+      Log(kError, "failed to flush buffer cache: %s\n", err.Name());
+    }
+  }
+}
+
+Error BufferCache::_WriteBack(std::list<Buffer*>& dirty) {
+  dirty.sort([](const Buffer* a, const Buffer* b) { return a->lba < b->lba; });
+
+  const size_t sector_size = dev_.SectorSize();
+  std::vector<uint8_t> tmp;
+  auto it = dirty.begin();
+  while(it != dirty.end()) {
+    // lba が連続しているバッファを 1 回の要求にまとめる
+    auto run_end = std::next(it);
+    size_t run_sectors = (*it)->sectors;
+    while(run_end != dirty.end() &&
+          (*std::prev(run_end))->lba + (*std::prev(run_end))->sectors == (*run_end)->lba &&
+          (run_sectors + (*run_end)->sectors) * sector_size <= kMaxWriteBackBytes) {
+      run_sectors += (*run_end)->sectors;
+      ++run_end;
+    }
+
+    const uint64_t lba = (*it)->lba;
+    Error err = MAKE_ERROR(Error::kSuccess);
+    ++stat_.device_writes;
+    if(std::next(it) == run_end) {
+      err = dev_.Write(lba, (*it)->data.get(), run_sectors);
+    }
+    else {
+      tmp.resize(run_sectors * sector_size);
+      size_t off = 0;
+      for(auto b = it; b != run_end; ++b) {
+        memcpy(&tmp[off], (*b)->data.get(), (*b)->sectors * sector_size);
+        off += (*b)->sectors * sector_size;
+      }
+      err = dev_.Write(lba, tmp.data(), run_sectors);
+    }
+    if(err) {
+      return err;
+    }
+
+    stat_.written_sectors += run_sectors;
+    for(; it != run_end; ++it) {
+      (*it)->dirty = false;
+      dirty_bytes_ -= (*it)->sectors * sector_size;
+    }
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error BufferCache::Flush() {
+  MutexGuard lock{fs_mutex};
+  std::list<Buffer*> dirty;
+  for(auto buf : lru_) {
+    if(buf->dirty) {
+      dirty.push_back(buf);
+    }
+  }
+  return _WriteBack(dirty);
+}
+
+Error BufferCache::FlushRange(uint64_t lba, size_t sectors) {
+  MutexGuard lock{fs_mutex};
+  std::list<Buffer*> dirty;
+  for(auto buf : lru_) {
+    if(buf->dirty && buf->lba < lba + sectors && lba < buf->lba + buf->sectors) {
+      dirty.push_back(buf);
+    }
+  }
+  return _WriteBack(dirty);
+}
@@ -0,0 +1,115 @@
+/**
+ * @file buffer_cache.hpp
+ *
+ * ブロックデバイスの内容をメモリに置いておく LRU キャッシュ（書き戻し式）
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "block_device.hpp"
+#include "error.hpp"
+#include "mutex.hpp"
+
+// バッファキャッシュと、それを使うファイルシステムの管理情報を守る。
+// 読むだけでも LRU やキャッシュの中身が変わるので、必ず取ってから触ること
+extern Mutex fs_mutex;
+
+class BufferCache {
+  public:
+    // lba から sectors セクタ分の内容。同じセクタが 2 つのバッファに載らないよう、
+    // 呼び出し側は領域ごとに決まった区切り（FAT ならクラスタ）で要求すること
+    struct Buffer {
+      uint64_t lba;
+      size_t sectors;
+      std::unique_ptr<uint8_t[]> data;
+      bool dirty;
+      int pins; // 0 より大きければ追い出さない
+      std::list<Buffer*>::iterator lru_it;
+    };
+
+    // 固定したバッファへの参照。持っている間は追い出されない
+    class Ref {
+      public:
+        Ref() = default;
+        Ref(BufferCache* cache, Buffer* buf);
+        Ref(Ref&& rhs);
+        Ref& operator=(Ref&& rhs);
+        ~Ref();
+        Ref(const Ref&) = delete;
+        Ref& operator=(const Ref&) = delete;
+
+        Buffer* Get() const { return buf_; }
+        Buffer* operator->() const { return buf_; }
+        explicit operator bool() const { return buf_ != nullptr; }
+
+      private:
+        BufferCache* cache_ = nullptr;
+        Buffer* buf_ = nullptr;
+        void _Release();
+    };
+
+    struct Stat {
+      uint64_t hits, misses;
+      uint64_t readahead_sectors;      // 先読みで読んだセクタ数
+      uint64_t device_reads, device_writes; // デバイスへの要求の回数
+      uint64_t written_sectors;
+      uint64_t evictions;
+    };
+
+    BufferCache(BlockDevice& dev, size_t capacity_bytes);
+
+    BlockDevice& Device() { return dev_; }
+
+    // バッファを固定して返す。載っていなければデバイスから読む
+    WithError<Ref> Get(uint64_t lba, size_t sectors);
+    // 全体を上書きする予定のバッファを固定して返す。載っていなくてもデバイスからは読まない（ゼロ埋め）
+    WithError<Ref> GetForOverwrite(uint64_t lba, size_t sectors);
+    // lba から sectors 刻みで並ぶバッファを 1 続きとみて、先頭から offset バイト目から len バイトを buf に写す。
+    // 載っていないバッファが連続していれば 1 回の要求にまとめて読み、キャッシュにも載せる
+    Error Read(uint64_t lba, size_t sectors, size_t offset, void* buf, size_t len);
+    // 載っていればそれを返す。LRU の順番は変えない。
+    // 固定しないので、fs_mutex を持っている間にキャッシュを操作せずに使い終えること
+    Buffer* Find(uint64_t lba);
+
+    // lba から sectors 刻みで n 個先までのうち、まだ載っていないものを読む。
+    // 載っていないものが連続していれば 1 回の要求にまとめる
+    void ReadAhead(uint64_t lba, size_t sectors, size_t n);
+
+    void MarkDirty(Buffer* buf);
+    // 載っていれば書き戻さずに捨てる（解放したクラスタ用）。固定されていれば何もしない
+    void Discard(uint64_t lba);
+    void Pin(Buffer* buf);
+    void Unpin(Buffer* buf);
+
+    // 汚れたバッファをセクタ順に書き戻す。連続しているものは 1 回の要求にまとめる
+    Error Flush();
+    // [lba, lba + sectors) に掛かる汚れたバッファだけを書き戻す
+    Error FlushRange(uint64_t lba, size_t sectors);
+
+    const Stat& GetStat() const { return stat_; }
+    size_t UsedBytes() const { return used_bytes_; }
+    size_t DirtyBytes() const { return dirty_bytes_; }
+    size_t CapacityBytes() const { return capacity_bytes_; }
+
+  private:
+    BlockDevice& dev_;
+    const size_t capacity_bytes_;
+    size_t used_bytes_ = 0, dirty_bytes_ = 0;
+    std::unordered_map<uint64_t, Buffer> buffers_; // lba → バッファ
+    std::list<Buffer*> lru_; // 先頭が最近使ったもの
+    Stat stat_{};
+
+    Buffer* _Insert(uint64_t lba, size_t sectors);
+    void _Touch(Buffer* buf);
+    Error _MakeRoom(size_t bytes);
+    Error _WriteBack(std::list<Buffer*>& dirty);
+};
+
+extern BufferCache* buffer_cache;
+void InitializeBufferCache(BlockDevice& dev);
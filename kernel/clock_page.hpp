@@ -0,0 +1,32 @@
+/**
+ * clock_page.hpp
+ *
+ * 全アプリに読み込み専用で共有される時計ページの定義。
+ * アプリはシステムコールを使わずに TSC と組み合わせて現在時刻を得られる。
+*/
+
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C" {
+#else
+#include <stdint.h>
+#endif
+
+// アプリの仮想アドレス空間上の配置先（スタック領域のすぐ下）
+#define CLOCK_PAGE_ADDR 0xfffffffffffee000ull
+
+struct ClockPage {
+  uint64_t tsc_base;  // 時刻 0 に対応する TSC の値
+  uint64_t tsc_mult;  // ns = (tsc - tsc_base) * tsc_mult >> 32
+  uint64_t tsc_freq;  // TSC の周波数 [Hz]
+};
+
+static inline uint64_t ClockPageNanoseconds(const volatile struct ClockPage* page, uint64_t tsc) {
+  return (uint64_t)(((unsigned __int128)(tsc - page->tsc_base) * page->tsc_mult) >> 32);
+}
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
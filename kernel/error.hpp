@@ -35,6 +35,9 @@ class Error {
     kIsDirectory,
     kNoSuchEntry,
     kFreeTypeError,
+    kAlreadyExists,
+    kNotEmpty,
+    kBusy,
 
     kLastOfCode
   };
@@ -70,6 +73,9 @@ class Error {
     "kIsDirectory",
     "kNoSuchEntry",
     "kFreeTypeError",
+    "kAlreadyExists",
+    "kNotEmpty",
+    "kBusy",
   };
   static_assert(Error::Code::kLastOfCode == code_names_.size());
 
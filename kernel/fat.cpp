@@ -3,47 +3,874 @@
 #include <iostream>
 #include <utility>
 #include <cstring>
+#include <cstdio>
 #include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "logger.hpp"
+#include "task.hpp"
+#include "timer.hpp"
 
 namespace {
 
   std::pair<const char*, bool>
-  NextPathElement(const char* path, char* path_elem) {
+  NextPathElement(const char* path, std::string& path_elem) {
     const char* next_slash = strchr(path, '/');
     if(next_slash == nullptr) {
       // '/'で区切られた次の要素がないのでそのまま返す
-      strcpy(path_elem, path);
+      path_elem.assign(path);
       return {nullptr, false};
     }
 
-    const auto elem_len = next_slash - path;
-    strncpy(path_elem, path, elem_len);
-    path_elem[elem_len] = '\0';
+    path_elem.assign(path, next_slash - path);
     // '/'で区切った次の要素を返す
     return {&next_slash[1], true};
   }
 
+  void AppendUTF8(std::string& s, char32_t c) {
+    if(c < 0x80) {
+      s.push_back(c);
+    }
+    else if(c < 0x800) {
+      s.push_back(0xc0 | (c >> 6));
+      s.push_back(0x80 | (c & 0x3f));
+    }
+    else if(c < 0x10000) {
+      s.push_back(0xe0 | (c >> 12));
+      s.push_back(0x80 | ((c >> 6) & 0x3f));
+      s.push_back(0x80 | (c & 0x3f));
+    }
+    else {
+      s.push_back(0xf0 | (c >> 18));
+      s.push_back(0x80 | ((c >> 12) & 0x3f));
+      s.push_back(0x80 | ((c >> 6) & 0x3f));
+      s.push_back(0x80 | (c & 0x3f));
+    }
+  }
+
+  // UTF-8 を UTF-16 に変換する。不正な並びなら空を返す
+  std::vector<uint16_t> ConvertUTF8To16(const char* s) {
+    std::vector<uint16_t> u16;
+    auto p = reinterpret_cast<const uint8_t*>(s);
+    while(*p) {
+      char32_t c;
+      int len;
+      if(p[0] < 0x80) { c = p[0]; len = 1; }
+      else if((p[0] & 0xe0) == 0xc0) { c = p[0] & 0x1f; len = 2; }
+      else if((p[0] & 0xf0) == 0xe0) { c = p[0] & 0x0f; len = 3; }
+      else if((p[0] & 0xf8) == 0xf0) { c = p[0] & 0x07; len = 4; }
+      else { return {}; }
+
+      for(int i = 1; i < len; ++i) {
+        if((p[i] & 0xc0) != 0x80) {
+          return {};
+        }
+        c = (c << 6) | (p[i] & 0x3f);
+      }
+      p += len;
+
+      if(c >= 0x10000) {
+        c -= 0x10000;
+        u16.push_back(0xd800 | (c >> 10));
+        u16.push_back(0xdc00 | (c & 0x3ff));
+      }
+      else {
+        u16.push_back(c);
+      }
+    }
+    return u16;
+  }
+
 }//namespace
 
 namespace fat {
 
   BPB* boot_volume_image;
   unsigned long bytes_per_cluster;
+  Volume volume;
+  IOStat io_stat;
+
+  namespace {
+    // 空きクラスタのビットマップ（1 = 空き）。Initialize で FAT を 1 度だけ走査して作る
+    std::vector<uint64_t> free_map;
+    unsigned long free_count;
+    unsigned long next_free;      // next-fit で次に探し始める位置
+    FSInfo* fs_info;
+    BufferCache::Buffer* fs_info_buf;
+
+    // GetClusterAddr で固定したバッファ。キーはバッファのアドレス
+    std::map<uintptr_t, BufferCache::Buffer*> pinned_buffers;
+
+    // 開いている FileDescriptor。エントリを消す・動かす・切り詰めるときに確かめる（fs_mutex で守る）
+    std::vector<FileDescriptor*> open_files;
+
+    // キャッシュにない FAT を読むとき、後ろに続く区切りを何個まで一緒に読むか
+    const size_t kReadAheadClusters = 8;
+    // ファイルの先読みの窓の初期値と上限（クラスタ数）
+    const size_t kInitialReadAheadWindow = 4;
+    const size_t kMaxReadAheadWindow = 64;
+    // 連続して何クラスタ書いたら書き戻すか
+    const size_t kWriteBehindClusters = 64;
+
+    uint64_t ClusterLBA(unsigned long cluster) {
+      return volume.cluster_lba_base + cluster * volume.cluster_sectors;
+    }
+
+    size_t BufferBytes(const BufferCache::Buffer* buf) {
+      return buf->sectors * buffer_cache->Device().SectorSize();
+    }
+
+    // Read / Write の呼び出し 1 回分の統計を数え、増えた分を実行中のタスクにも足す。
+    // 途中で他のタスクが読み書きすると、その分もこのタスクに入る
+    class IOAccount {
+      public:
+        IOAccount(uint64_t IOStat::* calls, uint64_t IOStat::* ns)
+          : calls_{calls}, ns_{ns}, start_{io_stat}, start_ns_{CurrentNanoseconds()} {
+        }
+
+        ~IOAccount() {
+          io_stat.*calls_ += 1;
+          io_stat.*ns_ += CurrentNanoseconds() - start_ns_;
+          if(task_manager == nullptr) {
+            return; // 起動中（フォントの読み込みなど）
+          }
+
+          IOStat delta = io_stat;
+          delta -= start_;
+          __asm__("cli");
+          task_manager->CurrentTask().IOStats() += delta;
+          __asm__("sti");
+        }
+
+      private:
+        uint64_t IOStat::* calls_;
+        uint64_t IOStat::* ns_;
+        const IOStat start_;
+        const uint64_t start_ns_;
+    };
+
+    // クラスタの内容をキャッシュから得る。先読みはファイルごとに FileDescriptor が行う
+    BufferCache::Ref GetClusterBuffer(unsigned long cluster) {
+      auto [buf, err] = buffer_cache->Get(ClusterLBA(cluster), volume.cluster_sectors);
+      if(err) {
+        Log(kError, "failed to read cluster %lu: %s\n", cluster, err.Name());
+      }
+      return std::move(buf);
+    }
+
+    // fat_index 番目の FAT のうち cluster 番目の要素を含むバッファと、バッファ内での添字を返す。
+    // FAT はクラスタと同じ大きさで区切ってキャッシュに載せる（末尾だけは短くなる）
+    std::pair<BufferCache::Ref, size_t> GetFatChunk(unsigned long cluster, unsigned int fat_index) {
+      if(cluster >= volume.num_clusters) {
+        return {BufferCache::Ref{}, 0};
+      }
+      const size_t chunk_sectors = volume.cluster_sectors;
+      const uint64_t chunk_offset = (cluster >> volume.fat_chunk_shift) * chunk_sectors;
+      const uint64_t lba = volume.fat_lba + fat_index * volume.fat_sectors + chunk_offset;
+      const size_t chunk_len = std::min<uint64_t>(chunk_sectors, volume.fat_sectors - chunk_offset);
+
+      if(chunk_len == chunk_sectors && buffer_cache->Find(lba) == nullptr) {
+        const size_t full_chunks = (volume.fat_sectors - chunk_offset) / chunk_sectors;
+        buffer_cache->ReadAhead(lba, chunk_sectors, std::min(kReadAheadClusters, full_chunks));
+      }
+      auto [buf, err] = buffer_cache->Get(lba, chunk_len);
+      if(err) {
+        Log(kError, "failed to read FAT for cluster %lu: %s\n", cluster, err.Name());
+        return {BufferCache::Ref{}, 0};
+      }
+      return {std::move(buf), cluster & ((1ul << volume.fat_chunk_shift) - 1)};
+    }
+
+    // 以下の索引とキャッシュ、open_files は読むだけの検索でも書き換わるので、fs_mutex で守る。
+    // 外から呼ばれる関数は入口で fs_mutex を取り、DirectoryIndex& などは取っている間だけ使う
+
+    // ディレクトリの索引。キーはディレクトリの先頭クラスタ
+    struct DirectoryIndex {
+      std::vector<DirectoryItem> items;
+      // 名前（大文字に揃えたもの）→ items の添字。長い名前と短い名前の両方を登録する
+      std::unordered_map<std::string, size_t> by_name;
+    };
+    std::unordered_map<unsigned long, DirectoryIndex> dir_indexes;
+
+    // FindFile の結果のキャッシュ。キーは（探し始めたディレクトリ、パス）
+    const size_t kPathCacheSize = 64;
+    std::map<std::pair<unsigned long, std::string>, std::pair<DirectoryEntry*, bool>> path_cache;
+
+    std::string NormalizeName(const char* name) {
+      std::string s{name};
+      for(auto& c : s) {
+        c = toupper(static_cast<unsigned char>(c)); // UTF-8 の長い名前では 0x80 以上が来る
+      }
+      return s;
+    }
+
+    // entry の直前に集めた長い名前のエントリ lfn から名前を復元する。
+    // 順番やチェックサムが合わなければ（長い名前を知らない OS に書き換えられた等）空を返す
+    std::string DecodeLongName(const std::vector<DirectoryEntry*>& lfn, const DirectoryEntry& entry) {
+      const size_t n = lfn.size();
+      const uint8_t checksum = ShortNameChecksum(entry.name);
+      std::vector<uint16_t> u16(n * kLongNameCharsPerEntry);
+      for(size_t k = 0; k < n; ++k) {
+        auto l = reinterpret_cast<const LongNameEntry*>(lfn[k]);
+        if((l->ord & 0x1f) != n - k || l->checksum != checksum) {
+          return {};
+        }
+        // ディスク上では名前の後ろの部分から並んでいる
+        uint16_t* dest = &u16[(n - k - 1) * kLongNameCharsPerEntry];
+        memcpy(&dest[0], l->name1, sizeof(l->name1));
+        memcpy(&dest[5], l->name2, sizeof(l->name2));
+        memcpy(&dest[11], l->name3, sizeof(l->name3));
+      }
+
+      std::string name;
+      for(size_t i = 0; i < u16.size() && u16[i] != 0; ++i) {
+        char32_t c = u16[i];
+        if(0xd800 <= c && c < 0xdc00 && i + 1 < u16.size()) {
+          c = 0x10000 + ((c - 0xd800) << 10) + (u16[i + 1] - 0xdc00);
+          ++i;
+        }
+        AppendUTF8(name, c);
+      }
+      return name;
+    }
+
+    DirectoryIndex& GetDirectoryIndex(unsigned long dir_cluster) {
+      if(auto it = dir_indexes.find(dir_cluster); it != dir_indexes.end()) {
+        return it->second;
+      }
+
+      auto& index = dir_indexes[dir_cluster];
+      std::vector<DirectoryEntry*> lfn; // 次の短い名前のエントリに付く長い名前のエントリ
+      for(auto cluster = dir_cluster; cluster != kEndOfClusterchain; cluster = NextCluster(cluster)) {
+        auto dir = GetSectorByCluster<DirectoryEntry>(cluster);
+        for(int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); ++i) {
+          if(dir[i].name[0] == 0x00) {
+            return index;
+          }
+          if(dir[i].name[0] == 0xe5) {
+            lfn.clear();
+            continue;
+          }
+          if(dir[i].attr == Attribute::kLongName) {
+            if(dir[i].name[0] & 0x40) {
+              lfn.clear(); // 新しい長い名前の始まり
+            }
+            else if(lfn.empty()) {
+              continue;    // 始まりが見つかっていないので使えない
+            }
+            lfn.push_back(&dir[i]);
+            continue;
+          }
+
+          char short_name[13];
+          FormatName(dir[i], short_name);
+          DirectoryItem item{&dir[i]};
+          if(auto long_name = lfn.empty() ? std::string{} : DecodeLongName(lfn, dir[i]);
+             !long_name.empty()) {
+            item.name = std::move(long_name);
+            item.long_name_entries = std::move(lfn);
+          }
+          else {
+            item.name = short_name;
+          }
+          lfn.clear();
+
+          // 同名があれば先に見つかった方を使う（線形探索と同じ結果にする）
+          const size_t pos = index.items.size();
+          index.by_name.emplace(NormalizeName(short_name), pos);
+          index.by_name.emplace(NormalizeName(item.name.c_str()), pos);
+          index.items.push_back(std::move(item));
+        }
+      }
+      return index;
+    }
+
+    // 拡張子を含めて 8.3 形式にそのまま収まる名前か（大文字小文字の違いは区別しない）
+    bool FitsShortName(const char* name) {
+      const char* dot_pos = strrchr(name, '.');
+      const size_t len = strlen(name);
+      const size_t base_len = dot_pos ? dot_pos - name : len;
+      const size_t ext_len = dot_pos ? len - base_len - 1 : 0;
+      if(base_len == 0 || base_len > 8 || ext_len > 3 || (dot_pos && ext_len == 0)) {
+        return false;
+      }
+      for(size_t i = 0; i < len; ++i) {
+        const unsigned char c = name[i];
+        if(&name[i] == dot_pos) {
+          continue;
+        }
+        if(c <= 0x20 || c >= 0x7f || strchr("\"*+,./:;<=>?[\\]|", c)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // 長い名前に対応する "BASENA~1.EXT" 形式の短い名前を、ディレクトリ内で重複しないように作る
+    void MakeShortAlias(unsigned long dir_cluster, const char* name, unsigned char* name83) {
+      auto to_short_char = [](unsigned char c) -> char {
+        if(c >= 0x80 || strchr("+,;=[]", c)) {
+          return '_';
+        }
+        return toupper(c);
+      };
+
+      const char* dot_pos = strrchr(name, '.');
+      std::string base, ext;
+      for(const char* p = name; *p && p != dot_pos; ++p) {
+        if(*p != ' ' && *p != '.') {
+          base.push_back(to_short_char(*p));
+        }
+      }
+      if(dot_pos) {
+        for(const char* p = dot_pos + 1; *p && ext.size() < 3; ++p) {
+          if(*p != ' ') {
+            ext.push_back(to_short_char(*p));
+          }
+        }
+      }
+      if(base.empty()) {
+        base = "_";
+      }
+
+      const auto& index = GetDirectoryIndex(dir_cluster);
+      for(int n = 1; ; ++n) {
+        char tail[9];
+        snprintf(tail, sizeof(tail), "~%d", n);
+        std::string alias = base.substr(0, 8 - strlen(tail)) + tail;
+        memset(name83, ' ', 11);
+        memcpy(name83, alias.data(), alias.size());
+        memcpy(&name83[8], ext.data(), ext.size());
+        if(!ext.empty()) {
+          alias += "." + ext;
+        }
+        if(index.by_name.count(alias) == 0) {
+          return;
+        }
+      }
+    }
+
+    void InvalidateDirectoryIndex(unsigned long dir_cluster) {
+      dir_indexes.erase(dir_cluster);
+      path_cache.clear();
+    }
+
+    // 作ったエントリを索引の末尾に加える（ディレクトリ全体を読み直さない）
+    void IndexAdd(unsigned long dir_cluster, DirectoryEntry* entry,
+                  std::vector<DirectoryEntry*> long_name_entries, const char* name) {
+      auto& index = GetDirectoryIndex(dir_cluster);
+      char short_name[13];
+      FormatName(*entry, short_name);
+
+      const size_t pos = index.items.size();
+      index.items.push_back({entry, long_name_entries.empty() ? short_name : name,
+                             std::move(long_name_entries)});
+      index.by_name.emplace(NormalizeName(short_name), pos);
+      index.by_name.emplace(NormalizeName(index.items[pos].name.c_str()), pos);
+      path_cache.clear(); // 「見つからなかった」という結果も覚えているので捨てる
+    }
+
+    // 索引から外す。項目は添字を変えないよう entry を nullptr にして残す
+    void IndexRemove(unsigned long dir_cluster, size_t pos) {
+      auto& index = GetDirectoryIndex(dir_cluster);
+      auto& item = index.items[pos];
+      char short_name[13];
+      FormatName(*item.entry, short_name);
+      for(const auto& name : {NormalizeName(short_name), NormalizeName(item.name.c_str())}) {
+        if(auto it = index.by_name.find(name); it != index.by_name.end() && it->second == pos) {
+          index.by_name.erase(it);
+        }
+      }
+      item.entry = nullptr;
+      item.long_name_entries.clear();
+      path_cache.clear();
+    }
+
+    // path を親ディレクトリと最後の要素に分ける。親ディレクトリのクラスタを返す
+    WithError<unsigned long> ResolveParent(const char* path, std::string& name) {
+      if(boot_volume_image == nullptr) {
+        return {0, MAKE_ERROR(Error::kNoSuchEntry)}; // ボリュームをマウントしていない
+      }
+      unsigned long parent_dir_cluster = boot_volume_image->root_cluster;
+      const char* slash_pos = strrchr(path, '/');
+      if(slash_pos == nullptr) {
+        name = path;
+        return {parent_dir_cluster, MAKE_ERROR(Error::kSuccess)};
+      }
 
-  void Initialize(void* volume_image){
-    boot_volume_image = reinterpret_cast<fat::BPB*>(volume_image);
+      name = &slash_pos[1];
+      if(name.empty()) {
+        return {0, MAKE_ERROR(Error::kIsDirectory)};
+      }
+      const std::string parent_dir_name{path, slash_pos};
+      if(!parent_dir_name.empty()) {
+        auto [parent_dir, post_slash] = FindFile(parent_dir_name.c_str());
+        if(parent_dir == nullptr || parent_dir->attr != Attribute::kDirectory) {
+          return {0, MAKE_ERROR(Error::kNoSuchEntry)};
+        }
+        if(parent_dir->FirstCluster() != 0) { // ".." がルートを指すときは 0 になっている
+          parent_dir_cluster = parent_dir->FirstCluster();
+        }
+      }
+      return {parent_dir_cluster, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    // ディレクトリエントリに書く名前。8.3 に収まらなければ長い名前と別名を使う
+    struct EntryName {
+      unsigned char name83[11];
+      std::vector<uint16_t> name16; // 空なら長い名前のエントリは作らない
+
+      size_t NumLongNameEntries() const {
+        return (name16.size() + kLongNameCharsPerEntry - 1) / kLongNameCharsPerEntry;
+      }
+    };
+
+    WithError<EntryName> MakeEntryName(unsigned long dir_cluster, const char* name) {
+      EntryName n{};
+      if(FitsShortName(name)) {
+        DirectoryEntry tmp;
+        SetFileName(tmp, name);
+        memcpy(n.name83, tmp.name, sizeof(n.name83));
+        return {n, MAKE_ERROR(Error::kSuccess)};
+      }
+
+      n.name16 = ConvertUTF8To16(name);
+      if(n.name16.empty() || n.name16.size() > kLongNameMax) {
+        return {n, MAKE_ERROR(Error::kInvalidFormat)};
+      }
+      MakeShortAlias(dir_cluster, name, n.name83);
+      return {n, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    // slots の最後に短い名前を、その前に長い名前を書く（名前以外の項目は変えない）
+    void WriteEntryName(const std::vector<DirectoryEntry*>& slots, const EntryName& n) {
+      const size_t num_lfn = n.NumLongNameEntries();
+      const uint8_t checksum = ShortNameChecksum(n.name83);
+      for(size_t k = 0; k < num_lfn; ++k) {
+        const size_t seq = num_lfn - k; // 1 始まり。後ろの部分から並べる
+        // 名前の終わりには 0x0000 を 1 つ置き、残りは 0xffff で埋める
+        uint16_t chars[kLongNameCharsPerEntry];
+        for(int i = 0; i < kLongNameCharsPerEntry; ++i) {
+          const size_t pos = (seq - 1) * kLongNameCharsPerEntry + i;
+          chars[i] = pos < n.name16.size() ? n.name16[pos] : pos == n.name16.size() ? 0x0000 : 0xffff;
+        }
+
+        auto l = reinterpret_cast<LongNameEntry*>(slots[k]);
+        memset(l, 0, sizeof(*l));
+        l->ord = seq | (k == 0 ? 0x40 : 0);
+        l->attr = Attribute::kLongName;
+        l->checksum = checksum;
+        memcpy(l->name1, &chars[0], sizeof(l->name1));
+        memcpy(l->name2, &chars[5], sizeof(l->name2));
+        memcpy(l->name3, &chars[11], sizeof(l->name3));
+        MarkDirty(l);
+      }
+
+      auto dir = slots.back();
+      memcpy(dir->name, n.name83, sizeof(n.name83));
+      MarkDirty(dir);
+    }
+
+    // dir_cluster のディレクトリに name という名前の空のエントリを作る
+    WithError<DirectoryEntry*> CreateEntry(unsigned long dir_cluster, const char* name, Attribute attr) {
+      auto [n, err] = MakeEntryName(dir_cluster, name);
+      if(err) {
+        return {nullptr, err};
+      }
+
+      auto slots = AllocateEntries(dir_cluster, n.NumLongNameEntries() + 1);
+      if(slots.empty()) {
+        return {nullptr, MAKE_ERROR(Error::kNoEnoughMemory)};
+      }
+      auto dir = slots.back();
+      // 削除済みのエントリを再利用することもあるので、クラスタ番号等も消しておく
+      memset(dir, 0, sizeof(*dir));
+      dir->attr = attr;
+      WriteEntryName(slots, n);
+
+      slots.pop_back();
+      IndexAdd(dir_cluster, dir, std::move(slots), name);
+      return {dir, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    // 名前のエントリを削除済みにする（クラスタは解放しない）
+    void RemoveEntry(unsigned long dir_cluster, size_t pos) {
+      auto& item = GetDirectoryIndex(dir_cluster).items[pos];
+      const auto entry = item.entry;
+      const auto long_name_entries = item.long_name_entries;
+      IndexRemove(dir_cluster, pos); // 名前を消す前に索引から外す
+      for(auto l : long_name_entries) {
+        l->name[0] = 0xe5;
+        MarkDirty(l);
+      }
+      entry->name[0] = 0xe5;
+      MarkDirty(entry);
+    }
+
+    std::pair<DirectoryEntry*, bool> FindFileUncached(const char* path, unsigned long directory_cluster) {
+      if(path[0] == '/') {
+        directory_cluster = boot_volume_image->root_cluster;
+        ++path;
+      }
+      else if(directory_cluster == 0) {
+        directory_cluster = boot_volume_image->root_cluster;
+      }
+
+      std::string path_elem;
+      const auto [next_path, post_slash] = NextPathElement(path, path_elem);
+      const bool path_last = next_path == nullptr || next_path[0] == '\0';
+
+      const auto& index = GetDirectoryIndex(directory_cluster);
+      const auto it = index.by_name.find(NormalizeName(path_elem.c_str()));
+      if(it == index.by_name.end()) {
+        return {nullptr, post_slash};
+      }
+
+      DirectoryEntry* entry = index.items[it->second].entry;
+      if(entry->attr == Attribute::kDirectory && !path_last) {
+        return FindFileUncached(next_path, entry->FirstCluster());
+      }
+      // entry がディレクトリでないか、パスの末尾に来てしまったので探索をやめる
+      return {entry, post_slash};
+    }
+
+    bool IsFreeCluster(unsigned long cluster) {
+      return (free_map[cluster / 64] >> (cluster % 64)) & 1;
+    }
+
+    void MarkClusterUsed(unsigned long cluster) {
+      free_map[cluster / 64] &= ~(1ull << (cluster % 64));
+      --free_count;
+      next_free = cluster + 1 < volume.num_clusters ? cluster + 1 : 2;
+      if(fs_info) {
+        fs_info->free_count = free_count;
+        fs_info->next_free = next_free;
+        buffer_cache->MarkDirty(fs_info_buf);
+      }
+    }
+
+    void MarkClusterFree(unsigned long cluster) {
+      free_map[cluster / 64] |= 1ull << (cluster % 64);
+      ++free_count;
+      if(fs_info) {
+        fs_info->free_count = free_count;
+        buffer_cache->MarkDirty(fs_info_buf);
+      }
+    }
+
+    // start 以降で最初の空きクラスタを探す（末尾まで行ったら先頭に戻る）。なければ 0
+    unsigned long FindFreeCluster(unsigned long start) {
+      if(free_count == 0) {
+        return 0;
+      }
+      const size_t num_words = free_map.size();
+      size_t w = start / 64;
+      uint64_t word = free_map[w] & (~0ull << (start % 64));
+      for(size_t i = 0; i <= num_words; ++i) {
+        if(word) {
+          return w * 64 + __builtin_ctzll(word);
+        }
+        w = (w + 1) % num_words;
+        word = free_map[w];
+      }
+      return 0;
+    }
+
+    // prev の直後が空いていればそれを（連続した領域になるように）、
+    // なければ next-fit で見つけた空きクラスタを確保する。なければ 0
+    unsigned long AllocateCluster(unsigned long prev) {
+      unsigned long cluster;
+      if(prev != 0 && prev + 1 < volume.num_clusters && IsFreeCluster(prev + 1)) {
+        cluster = prev + 1;
+      }
+      else {
+        cluster = FindFreeCluster(next_free);
+      }
+      if(cluster != 0) {
+        MarkClusterUsed(cluster);
+      }
+      return cluster;
+    }
+
+    bool IsPowerOf2(unsigned long value) {
+      return value != 0 && (value & (value - 1)) == 0;
+    }
+
+    // BPB を検査して、クラスタや FAT の位置を求めるための値を計算しておく
+    WithError<Volume> MakeVolume(const BPB& bpb, size_t device_sector_size) {
+      const unsigned long total_sectors =
+        bpb.total_sectors_32 != 0 ? bpb.total_sectors_32 : bpb.total_sectors_16;
+      const unsigned long data_start_sector =
+        bpb.reserved_sector_count + static_cast<unsigned long>(bpb.num_fats) * bpb.fat_size_32;
+      if(!IsPowerOf2(bpb.bytes_per_sector) || bpb.bytes_per_sector < 512 || bpb.bytes_per_sector > 4096 ||
+         bpb.bytes_per_sector % device_sector_size != 0 ||
+         !IsPowerOf2(bpb.sectors_per_cluster) ||
+         bpb.reserved_sector_count == 0 || bpb.num_fats == 0 ||
+         bpb.fat_size_16 != 0 || bpb.fat_size_32 == 0 || bpb.root_entry_count != 0 || // FAT32 でない
+         total_sectors <= data_start_sector) {
+        return {{}, MAKE_ERROR(Error::kInvalidFormat)};
+      }
+
+      const unsigned long scale = bpb.bytes_per_sector / device_sector_size;
+      Volume v{};
+      v.sector_scale = scale;
+      v.fat_lba = bpb.reserved_sector_count * scale;
+      v.fat_sectors = bpb.fat_size_32 * scale;
+      v.cluster_sectors = bpb.sectors_per_cluster * scale;
+      // クラスタは 2 始まりなので 2 クラスタ分手前にずらしておく（符号なしの桁あふれは足すと戻る）
+      v.cluster_lba_base = data_start_sector * scale - 2 * v.cluster_sectors;
+      v.fat_chunk_shift = __builtin_ctzl(
+        static_cast<unsigned long>(bpb.bytes_per_sector) * bpb.sectors_per_cluster / sizeof(uint32_t));
+      v.num_fats = bpb.num_fats;
+      v.num_clusters = std::min<unsigned long>(
+        (total_sectors - data_start_sector) / bpb.sectors_per_cluster + 2,
+        static_cast<unsigned long>(bpb.fat_size_32) * bpb.bytes_per_sector / sizeof(uint32_t)
+      );
+      v.root_cluster = bpb.root_cluster;
+      v.fs_info_lba = bpb.fs_info != 0 && bpb.fs_info != 0xffff ? bpb.fs_info * scale : 0;
+      if(v.root_cluster < 2 || v.root_cluster >= v.num_clusters) {
+        return {{}, MAKE_ERROR(Error::kInvalidFormat)};
+      }
+      return {v, MAKE_ERROR(Error::kSuccess)};
+    }
+
+    void InitializeFreeMap() {
+      const unsigned long num_clusters = volume.num_clusters;
+      free_map.assign((num_clusters + 63) / 64, 0);
+      free_count = 0;
+      // FAT をキャッシュの区切りごとにまとめて走査する
+      for(unsigned long cluster = 0; cluster < num_clusters; ) {
+        auto [buf, i] = GetFatChunk(cluster, 0);
+        if(!buf) {
+          break;
+        }
+        const auto fat = reinterpret_cast<const uint32_t*>(buf->data.get());
+        const unsigned long n = std::min<unsigned long>(
+          num_clusters - cluster, BufferBytes(buf.Get()) / sizeof(uint32_t) - i);
+        for(unsigned long k = 0; k < n; ++k, ++cluster) {
+          if(cluster >= 2 && (fat[i + k] & 0x0ffffffflu) == 0) {
+            free_map[cluster / 64] |= 1ull << (cluster % 64);
+            ++free_count;
+          }
+        }
+      }
+      next_free = 2;
+
+      fs_info = nullptr;
+      if(volume.fs_info_lba != 0) {
+        auto [buf, err] = buffer_cache->Get(volume.fs_info_lba, volume.sector_scale);
+        auto info = buf ? reinterpret_cast<FSInfo*>(buf->data.get()) : nullptr;
+        if(info && info->lead_signature == 0x41615252 && info->struct_signature == 0x61417272) {
+          buffer_cache->Pin(buf.Get()); // 使い続けるので固定したままにする
+          fs_info = info;
+          fs_info_buf = buf.Get();
+          if(2 <= info->next_free && info->next_free < volume.num_clusters) {
+            next_free = info->next_free;
+          }
+          // 空きクラスタ数は数え直した値で上書きしておく
+          if(info->free_count != free_count) {
+            info->free_count = free_count;
+            buffer_cache->MarkDirty(buf.Get());
+          }
+        }
+      }
+    }
+  }
+
+  Error Initialize(){
+    MutexGuard lock{fs_mutex};
+    auto [bpb_buf, err] = buffer_cache->Get(0, 1);
+    if(err) {
+      return err;
+    }
+    const auto bpb = reinterpret_cast<fat::BPB*>(bpb_buf->data.get());
+    auto [v, err_bpb] = MakeVolume(*bpb, buffer_cache->Device().SectorSize());
+    if(err_bpb) {
+      return err_bpb;
+    }
+    buffer_cache->Pin(bpb_buf.Get()); // 使い続けるので固定したままにする
+    boot_volume_image = bpb;
+    volume = v;
     bytes_per_cluster = 
       static_cast<unsigned long>(boot_volume_image->bytes_per_sector) *
       boot_volume_image->sectors_per_cluster;
+    InitializeFreeMap();
+
+    // パスの検索は必ずルートから始まるので、索引を先に作っておく
+    GetDirectoryIndex(volume.root_cluster);
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  unsigned long FreeClusterCount() {
+    MutexGuard lock{fs_mutex};
+    return free_count;
+  }
+
+  namespace {
+    // FAT の [first_chunk, last_chunk) 番目の区切りについて、各クラスタを指している要素の数を refs に足す。
+    // 区切りの範囲ごとに独立しているので、分けて実行してから結果を足し合わせてもよい
+    void CountFatReferences(unsigned long first_chunk, unsigned long last_chunk,
+                            std::vector<uint8_t>& refs, CheckResult& result) {
+      for(unsigned long chunk = first_chunk; chunk < last_chunk; ++chunk) {
+        const unsigned long first = chunk << volume.fat_chunk_shift;
+        auto [buf, i] = GetFatChunk(first, 0);
+        if(!buf) {
+          return;
+        }
+        const auto fat = reinterpret_cast<const uint32_t*>(buf->data.get());
+        const unsigned long end = std::min<unsigned long>(
+          volume.num_clusters, first + BufferBytes(buf.Get()) / sizeof(uint32_t));
+        for(unsigned long c = std::max(first, 2ul); c < end; ++c) {
+          const uint32_t next = fat[c - first] & 0x0ffffffflu;
+          if(next == 0 || IsEndOfClusterchain(next)) {
+            continue;
+          }
+          if(next < 2 || next >= volume.num_clusters || IsFreeCluster(next)) {
+            ++result.bad_links;
+          }
+          else if(refs[next] < 0xff) {
+            ++refs[next];
+          }
+        }
+      }
+    }
+
+    // ルートディレクトリから辿れるクラスタに印を付ける
+    void MarkReachable(std::vector<uint64_t>& reached, const std::vector<uint8_t>& refs,
+                       CheckResult& result) {
+      struct Chain {
+        unsigned long first;
+        bool is_dir;
+        uint32_t file_size;
+      };
+      std::vector<Chain> stack{{volume.root_cluster, true, 0}};
+      std::vector<unsigned long> clusters;
+      auto is_reached = [&](unsigned long c) { return (reached[c / 64] >> (c % 64)) & 1; };
+
+      while(!stack.empty()) {
+        const auto chain = stack.back();
+        stack.pop_back();
+
+        // 先頭が他のチェーンの途中から指されていたり、他のエントリと同じだったりすれば共有されている
+        if(refs[chain.first] > 0 || is_reached(chain.first)) {
+          ++result.cross_links;
+        }
+        clusters.clear();
+        for(auto c = chain.first; !is_reached(c); ) {
+          reached[c / 64] |= 1ull << (c % 64);
+          clusters.push_back(c);
+          const auto next = GetFatEntry(c);
+          if(IsEndOfClusterchain(next) || next < 2 || next >= volume.num_clusters || IsFreeCluster(next)) {
+            break; // 不正な要素は CountFatReferences で数えている
+          }
+          c = next;
+        }
+
+        if(!chain.is_dir) {
+          if(clusters.size() != (chain.file_size + bytes_per_cluster - 1) / bytes_per_cluster) {
+            ++result.size_mismatches;
+          }
+          continue;
+        }
+
+        for(auto c : clusters) {
+          auto buf = GetClusterBuffer(c);
+          if(!buf) {
+            break;
+          }
+          const auto entries = reinterpret_cast<const DirectoryEntry*>(buf->data.get());
+          bool end = false;
+          for(size_t i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); ++i) {
+            const auto& e = entries[i];
+            if(e.name[0] == 0x00) {
+              end = true;
+              break;
+            }
+            const auto attr = static_cast<uint8_t>(e.attr);
+            if(e.name[0] == 0xe5 || e.name[0] == '.' || e.attr == Attribute::kLongName ||
+               (attr & static_cast<uint8_t>(Attribute::kVolumeID))) {
+              continue;
+            }
+            const bool is_dir = attr & static_cast<uint8_t>(Attribute::kDirectory);
+            ++(is_dir ? result.directories : result.files);
+            const auto first = e.FirstCluster();
+            if(2 <= first && first < volume.num_clusters && !IsFreeCluster(first)) {
+              stack.push_back({first, is_dir, e.file_size});
+            }
+            else if(first != 0 || (!is_dir && e.file_size != 0)) {
+              ++result.bad_links;
+            }
+          }
+          if(end) {
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  CheckResult CheckVolume() {
+    MutexGuard lock{fs_mutex};
+    CheckResult result{};
+    const unsigned long num_clusters = volume.num_clusters;
+    result.used_clusters = num_clusters - 2 - free_count;
+
+    std::vector<uint8_t> refs(num_clusters);
+    const unsigned long num_chunks = ((num_clusters - 1) >> volume.fat_chunk_shift) + 1;
+    CountFatReferences(0, num_chunks, refs, result);
+    for(unsigned long c = 2; c < num_clusters; ++c) {
+      if(refs[c] > 1) {
+        ++result.cross_links;
+      }
+    }
+
+    std::vector<uint64_t> reached((num_clusters + 63) / 64);
+    MarkReachable(reached, refs, result);
+
+    // 使用中なのにどこからも届かないクラスタ。他から指されていないものがチェーンの先頭
+    for(unsigned long c = 2; c < num_clusters; ++c) {
+      if(IsFreeCluster(c) || (reached[c / 64] >> (c % 64)) & 1) {
+        continue;
+      }
+      ++result.lost_clusters;
+      if(refs[c] == 0) {
+        ++result.lost_chains;
+      }
+    }
+    return result;
   }
 
   uintptr_t GetClusterAddr(unsigned long cluster){
-    unsigned long sector_num =
-      boot_volume_image->reserved_sector_count + 
-      boot_volume_image->num_fats * boot_volume_image->fat_size_32 + 
-      (cluster - 2) * boot_volume_image->sectors_per_cluster;
-    uintptr_t offset = sector_num * boot_volume_image->bytes_per_sector;
-    return reinterpret_cast<uintptr_t>(boot_volume_image) + offset;
+    MutexGuard lock{fs_mutex};
+    auto buf = GetClusterBuffer(cluster);
+    if(!buf) {
+      return 0;
+    }
+    const auto addr = reinterpret_cast<uintptr_t>(buf->data.get());
+    if(pinned_buffers.emplace(addr, buf.Get()).second) {
+      buffer_cache->Pin(buf.Get()); // buf を手放しても固定したままにする
+    }
+    return addr;
+  }
+
+  void MarkDirty(const void* p) {
+    MutexGuard lock{fs_mutex};
+    const auto addr = reinterpret_cast<uintptr_t>(p);
+    auto it = pinned_buffers.upper_bound(addr);
+    if(it == pinned_buffers.begin()) {
+      return;
+    }
+    --it;
+    if(addr < it->first + BufferBytes(it->second)) {
+      buffer_cache->MarkDirty(it->second);
+    }
+  }
+
+  Error Flush() {
+    MutexGuard lock{fs_mutex};
+    return buffer_cache->Flush();
   }
 
   void ReadName(const DirectoryEntry& entry, char* base, char* ext){
@@ -69,8 +896,9 @@ namespace fat {
   }
 
   unsigned long NextCluster(unsigned long cluster){
-    uint32_t next = GetFat()[cluster];
-    if(IsEndOfClusterchain(cluster)) {
+    MutexGuard lock{fs_mutex};
+    uint32_t next = GetFatEntry(cluster);
+    if(IsEndOfClusterchain(next)) {
       return kEndOfClusterchain;
     }
     return next;
@@ -80,43 +908,70 @@ namespace fat {
     return cluster >= 0x0ffffff8ul;
   }
 
-  uint32_t* GetFat(){
-    uintptr_t fat_offset = 
-      boot_volume_image->reserved_sector_count * 
-      boot_volume_image->bytes_per_sector;
-    return reinterpret_cast<uint32_t*>(
-      reinterpret_cast<uintptr_t>(boot_volume_image) + fat_offset
-    );
+  uint32_t GetFatEntry(unsigned long cluster) {
+    MutexGuard lock{fs_mutex};
+    ++io_stat.fat_lookups;
+    auto [buf, i] = GetFatChunk(cluster, 0);
+    if(!buf) {
+      return kEndOfClusterchain;
+    }
+    return reinterpret_cast<const uint32_t*>(buf->data.get())[i] & 0x0ffffffflu;
+  }
+
+  void SetFatEntry(unsigned long cluster, uint32_t value) {
+    MutexGuard lock{fs_mutex};
+    for(unsigned int k = 0; k < volume.num_fats; ++k) {
+      auto [buf, i] = GetFatChunk(cluster, k);
+      if(!buf) {
+        continue;
+      }
+      auto fat = reinterpret_cast<uint32_t*>(buf->data.get());
+      // 上位 4 ビットは予約されているので残す
+      fat[i] = (fat[i] & 0xf0000000lu) | (value & 0x0ffffffflu);
+      buffer_cache->MarkDirty(buf.Get());
+    }
   }
 
   unsigned long ExtendCluster(unsigned long eoc_cluster, size_t n){
-    uint32_t* fat = GetFat();
+    MutexGuard lock{fs_mutex};
     // クラスタ末尾まで移動
-    while(!IsEndOfClusterchain(fat[eoc_cluster])){
-      eoc_cluster = fat[eoc_cluster];
+    for(auto next = GetFatEntry(eoc_cluster); !IsEndOfClusterchain(next); next = GetFatEntry(eoc_cluster)) {
+      eoc_cluster = next;
     }
 
-    size_t num_allocated = 0;
     auto current = eoc_cluster;
-
-    for(unsigned long candidate = 2; num_allocated < n; ++candidate) {
-      if(fat[candidate] != 0) {//空いてない
-        continue;
+    for(size_t i = 0; i < n; ++i) {
+      const auto cluster = AllocateCluster(current);
+      if(cluster == 0) {
+        break; // 空きがない
       }
-      fat[current] = candidate;
-      current = candidate;
-      ++num_allocated;
+      SetFatEntry(current, cluster);
+      current = cluster;
     }
-    fat[current] = kEndOfClusterchain;
+    SetFatEntry(current, kEndOfClusterchain);
     return current;
   }
 
   DirectoryEntry* AllocateEntry(unsigned long dir_cluster){
+    MutexGuard lock{fs_mutex};
+    auto entries = AllocateEntries(dir_cluster, 1);
+    return entries.empty() ? nullptr : entries[0];
+  }
+
+  std::vector<DirectoryEntry*> AllocateEntries(unsigned long dir_cluster, size_t n){
+    MutexGuard lock{fs_mutex};
+    std::vector<DirectoryEntry*> run; // 連続している空きエントリ
     while(true) {
       auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
       for(int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); ++i) {
         if(dir[i].name[0] == 0 || dir[i].name[0] == 0xe5) {
-          return &dir[i];
+          run.push_back(&dir[i]);
+          if(run.size() == n) {
+            return run;
+          }
+        }
+        else {
+          run.clear();
         }
       }
       auto next = NextCluster(dir_cluster);
@@ -126,11 +981,34 @@ namespace fat {
       dir_cluster = next;
     }
 
-    // 空きが見つからなかったのでクラスタを伸長する
-    dir_cluster = ExtendCluster(dir_cluster, 1);
-    auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
-    memset(dir, 0, bytes_per_cluster); //ゼロクリア
-    return &dir[0];
+    // 空きが足りなかったのでクラスタを伸長する（末尾の空きに続けて使う）
+    while(run.size() < n) {
+      const auto new_cluster = ExtendCluster(dir_cluster, 1);
+      if(new_cluster == dir_cluster) {
+        return {}; // ボリュームに空きがない
+      }
+      dir_cluster = new_cluster;
+      auto dir = GetSectorByCluster<DirectoryEntry>(dir_cluster);
+      memset(dir, 0, bytes_per_cluster); //ゼロクリア
+      MarkDirty(dir);
+      for(int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry) && run.size() < n; ++i) {
+        run.push_back(&dir[i]);
+      }
+    }
+    return run;
+  }
+
+  std::vector<DirectoryItem> ReadDirectory(unsigned long dir_cluster) {
+    MutexGuard lock{fs_mutex};
+    return GetDirectoryIndex(dir_cluster).items;
+  }
+
+  uint8_t ShortNameChecksum(const unsigned char* name) {
+    uint8_t sum = 0;
+    for(int i = 0; i < 11; ++i) {
+      sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+    }
+    return sum;
   }
 
   void SetFileName(DirectoryEntry& entry, const char* name){
@@ -138,89 +1016,219 @@ namespace fat {
     memset(entry.name, ' ', 8+3);
     if(dot_pos) {
       for(int i = 0; i < 8 && i < dot_pos - name; ++i) {
-        entry.name[i] = toupper(name[i]);
+        entry.name[i] = toupper(static_cast<unsigned char>(name[i]));
       }
       for(int i = 0; i < 3 && dot_pos[i + 1]; ++i) {
-        entry.name[8 + i] = toupper(dot_pos[i + 1]);
+        entry.name[8 + i] = toupper(static_cast<unsigned char>(dot_pos[i + 1]));
       }
     }
     else {
       for(int i = 0; i < 8 && name[i]; ++i) {
-        entry.name[i] = toupper(name[i]);
+        entry.name[i] = toupper(static_cast<unsigned char>(name[i]));
       }
     }
   }
 
   WithError<DirectoryEntry*> CreateFile(const char* path){
-    auto parent_dir_cluster = fat::boot_volume_image->root_cluster;
-    const char* filename = path;
+    MutexGuard lock{fs_mutex};
+    std::string filename;
+    auto [parent_dir_cluster, err] = ResolveParent(path, filename);
+    if(err) {
+      return {nullptr, err};
+    }
+    return CreateEntry(parent_dir_cluster, filename.c_str(), Attribute::kArchive);
+  }
 
-    // ルート以外のディレクトリに新規ファイル作成
-    if(const char* slash_pos = strrchr(path, '/')) {
-      filename = &slash_pos[1];
-      if(slash_pos[1] == '\0') {
-        return {nullptr, MAKE_ERROR(Error::kIsDirectory)};
-      }
+  WithError<DirectoryEntry*> MakeDirectory(const char* path) {
+    MutexGuard lock{fs_mutex};
+    std::string dirname;
+    auto [parent_dir_cluster, err] = ResolveParent(path, dirname);
+    if(err) {
+      return {nullptr, err};
+    }
+    if(GetDirectoryIndex(parent_dir_cluster).by_name.count(NormalizeName(dirname.c_str()))) {
+      return {nullptr, MAKE_ERROR(Error::kAlreadyExists)};
+    }
+
+    const auto cluster = AllocateClusterChain(1);
+    if(cluster == 0) {
+      return {nullptr, MAKE_ERROR(Error::kNoEnoughMemory)};
+    }
+    auto [dir, err2] = CreateEntry(parent_dir_cluster, dirname.c_str(), Attribute::kDirectory);
+    if(err2) {
+      FreeClusterChain(cluster);
+      return {nullptr, err2};
+    }
+    dir->first_cluster_low = cluster & 0xffff;
+    dir->first_cluster_high = (cluster >> 16) & 0xffff;
+    MarkDirty(dir);
+
+    // "." と ".."。ルートを指す ".." のクラスタ番号は 0 にする決まり
+    auto entries = GetSectorByCluster<DirectoryEntry>(cluster);
+    memset(entries, 0, bytes_per_cluster);
+    const unsigned long parent = parent_dir_cluster == boot_volume_image->root_cluster ? 0 : parent_dir_cluster;
+    for(int i = 0; i < 2; ++i) {
+      memset(entries[i].name, ' ', sizeof(entries[i].name));
+      memset(entries[i].name, '.', i + 1);
+      entries[i].attr = Attribute::kDirectory;
+      const unsigned long c = i == 0 ? cluster : parent;
+      entries[i].first_cluster_low = c & 0xffff;
+      entries[i].first_cluster_high = (c >> 16) & 0xffff;
+    }
+    MarkDirty(entries);
+    return {dir, MAKE_ERROR(Error::kSuccess)};
+  }
 
-      char parent_dir_name[slash_pos - path + 1];
-      strncpy(parent_dir_name, path, slash_pos - path);
-      parent_dir_name[slash_pos - path] = '\0';
+  Error Remove(const char* path) {
+    MutexGuard lock{fs_mutex};
+    std::string name;
+    auto [parent_dir_cluster, err] = ResolveParent(path, name);
+    if(err) {
+      return err;
+    }
+    auto& index = GetDirectoryIndex(parent_dir_cluster);
+    const auto it = index.by_name.find(NormalizeName(name.c_str()));
+    if(it == index.by_name.end()) {
+      return MAKE_ERROR(Error::kNoSuchEntry);
+    }
+    const size_t pos = it->second;
+    const auto entry = index.items[pos].entry;
+    const auto cluster = entry->FirstCluster();
+    if(FileDescriptor::IsOpen(*entry)) {
+      return MAKE_ERROR(Error::kBusy); // 開いている記述子が解放したクラスタや空いたエントリを指してしまう
+    }
 
-      if(parent_dir_name[0] != '\0') {
-        auto [parent_dir, post_slash2] = fat::FindFile(parent_dir_name);
-        if(parent_dir == nullptr) {
-          return {nullptr, MAKE_ERROR(Error::kNoSuchEntry)};
+    if(entry->attr == Attribute::kDirectory) {
+      if(name == "." || name == "..") {
+        return MAKE_ERROR(Error::kInvalidFile);
+      }
+      for(const auto& item : ReadDirectory(cluster)) {
+        if(item.entry && item.name != "." && item.name != "..") {
+          return MAKE_ERROR(Error::kNotEmpty);
         }
-        parent_dir_cluster = parent_dir->FirstCluster();
       }
+      InvalidateDirectoryIndex(cluster);
     }
 
-    auto dir = fat::AllocateEntry(parent_dir_cluster);
-    if(dir == nullptr) {
-      return {nullptr, MAKE_ERROR(Error::kNoEnoughMemory)};
-    }
-    fat::SetFileName(*dir, filename);
-    dir->file_size = 0;
-    return {dir, MAKE_ERROR(Error::kSuccess)};
+    RemoveEntry(parent_dir_cluster, pos);
+    FreeClusterChain(cluster);
+    return MAKE_ERROR(Error::kSuccess);
   }
 
-  std::pair<DirectoryEntry*, bool> FindFile(const char* path, unsigned long directory_cluster){
-    if(path[0] == '/') {
-      directory_cluster = boot_volume_image->root_cluster;
-      ++path;
+  Error Rename(const char* old_path, const char* new_path) {
+    MutexGuard lock{fs_mutex};
+    std::string old_name, new_name;
+    auto [old_parent, err] = ResolveParent(old_path, old_name);
+    if(err) {
+      return err;
     }
-    else if(directory_cluster == 0) {
-      directory_cluster = boot_volume_image->root_cluster;
+    auto [new_parent, err2] = ResolveParent(new_path, new_name);
+    if(err2) {
+      return err2;
     }
 
-    char path_elem[13];
-    const auto [next_path, post_slash] = NextPathElement(path, path_elem);
-    const bool path_last = next_path == nullptr || next_path[0] == '\0';
+    const auto old_it = GetDirectoryIndex(old_parent).by_name.find(NormalizeName(old_name.c_str()));
+    if(old_it == GetDirectoryIndex(old_parent).by_name.end()) {
+      return MAKE_ERROR(Error::kNoSuchEntry);
+    }
+    size_t old_pos = old_it->second;
+    DirectoryEntry* src = GetDirectoryIndex(old_parent).items[old_pos].entry;
+    const bool is_dir = src->attr == Attribute::kDirectory;
 
-    while(directory_cluster != kEndOfClusterchain) {
-      auto dir = GetSectorByCluster<DirectoryEntry>(directory_cluster);
-      for(int i = 0; i < bytes_per_cluster / sizeof(DirectoryEntry); ++i) {
-        if(dir[i].name[0] == 0x00) {
-          goto not_found;
+    if(is_dir) {
+      // 自分の下に移すとたどり着けなくなる
+      for(auto c = new_parent; c != boot_volume_image->root_cluster; ) {
+        if(c == src->FirstCluster()) {
+          return MAKE_ERROR(Error::kInvalidFile);
         }
-        else if(!NameIsEqual(dir[i], path_elem)){
-          continue;
+        c = GetSectorByCluster<DirectoryEntry>(c)[1].FirstCluster(); // ".."
+        if(c == 0) {
+          break;
         }
+      }
+    }
 
-        if(dir[i].attr == Attribute::kDirectory && !path_last) {
-          return FindFile(next_path, dir[i].FirstCluster());
+    // 移動先に別のファイルがあれば置き換える（ディレクトリは置き換えない）
+    auto& new_index = GetDirectoryIndex(new_parent);
+    if(auto it = new_index.by_name.find(NormalizeName(new_name.c_str())); it != new_index.by_name.end()) {
+      auto dst = new_index.items[it->second].entry;
+      if(dst != src) {
+        if(is_dir || dst->attr == Attribute::kDirectory) {
+          return MAKE_ERROR(Error::kAlreadyExists);
         }
-        else {
-          // dir[i] がディレクトリでないか、パスの末尾に来てしまったので探索をやめる
-          return {&dir[i], post_slash};
+        if(FileDescriptor::IsOpen(*dst)) {
+          return MAKE_ERROR(Error::kBusy);
         }
+        const auto cluster = dst->FirstCluster();
+        RemoveEntry(new_parent, it->second);
+        FreeClusterChain(cluster);
+      }
+    }
+
+    auto [n, err3] = MakeEntryName(new_parent, new_name.c_str());
+    if(err3) {
+      return err3;
+    }
+
+    auto& old_item = GetDirectoryIndex(old_parent).items[old_pos];
+    if(old_parent == new_parent && n.NumLongNameEntries() <= old_item.long_name_entries.size()) {
+      // その場で書き換える。余った長い名前のエントリは先頭側から削除済みにする
+      auto lfn = old_item.long_name_entries;
+      IndexRemove(old_parent, old_pos);
+      const size_t unused = lfn.size() - n.NumLongNameEntries();
+      for(size_t k = 0; k < unused; ++k) {
+        lfn[k]->name[0] = 0xe5;
+        MarkDirty(lfn[k]);
       }
+      std::vector<DirectoryEntry*> slots(lfn.begin() + unused, lfn.end());
+      slots.push_back(src);
+      WriteEntryName(slots, n);
+      slots.pop_back();
+      IndexAdd(new_parent, src, std::move(slots), new_name.c_str());
+      return MAKE_ERROR(Error::kSuccess);
+    }
+
+    // 新しい場所にエントリを作り、名前以外の項目を移す
+    auto [dst, err4] = CreateEntry(new_parent, new_name.c_str(), src->attr);
+    if(err4) {
+      return err4;
+    }
+    memcpy(&dst->attr, &src->attr, sizeof(DirectoryEntry) - sizeof(src->name));
+    MarkDirty(dst);
+    FileDescriptor::MoveEntry(*src, *dst);
+    RemoveEntry(old_parent, old_pos);
+
+    if(is_dir && old_parent != new_parent) {
+      auto dotdot = &GetSectorByCluster<DirectoryEntry>(dst->FirstCluster())[1];
+      const unsigned long parent = new_parent == boot_volume_image->root_cluster ? 0 : new_parent;
+      dotdot->first_cluster_low = parent & 0xffff;
+      dotdot->first_cluster_high = (parent >> 16) & 0xffff;
+      MarkDirty(dotdot);
+      path_cache.clear();
+    }
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  std::pair<DirectoryEntry*, bool> FindFile(const char* path, unsigned long directory_cluster){
+    MutexGuard lock{fs_mutex};
+    if(boot_volume_image == nullptr) {
+      return {nullptr, false}; // ボリュームをマウントしていない
+    }
+    if(directory_cluster == 0) {
+      directory_cluster = boot_volume_image->root_cluster;
+    }
 
-      directory_cluster = NextCluster(directory_cluster);
+    auto key = std::make_pair(directory_cluster, std::string{path});
+    if(auto it = path_cache.find(key); it != path_cache.end()) {
+      return it->second;
     }
 
-not_found:
-    return {nullptr, post_slash};
+    const auto result = FindFileUncached(path, directory_cluster);
+    if(path_cache.size() >= kPathCacheSize) {
+      path_cache.clear();
+    }
+    path_cache.emplace(std::move(key), result);
+    return result;
   }
 
   bool NameIsEqual(const DirectoryEntry& entry, const char* name){
@@ -234,25 +1242,47 @@ not_found:
         i83 = 7;
         continue;
       }
-      name83[i83] = std::toupper(name[i]);
+      name83[i83] = std::toupper(static_cast<unsigned char>(name[i]));
     }
 
     return memcmp(entry.name, name83, sizeof(name83)) == 0;
   }
 
   size_t LoadFile(void* buf, size_t len, DirectoryEntry& entry){
+    MutexGuard lock{fs_mutex};
     return FileDescriptor{entry}.Read(buf, len);
   }
 
-  unsigned long AllocateClusterChain(size_t n) {
-    uint32_t* fat = GetFat();
-    unsigned long first_cluster;
-    for(first_cluster = 2; ; ++first_cluster) {
-      if(fat[first_cluster] == 0){
-        fat[first_cluster] = kEndOfClusterchain;
+  void FreeClusterChain(unsigned long cluster) {
+    MutexGuard lock{fs_mutex};
+    while(2 <= cluster && cluster < volume.num_clusters && !IsFreeCluster(cluster)) {
+      const auto next = GetFatEntry(cluster);
+      SetFatEntry(cluster, 0);
+      MarkClusterFree(cluster);
+
+      // 固定していたディレクトリのクラスタも外し、書き戻さずに捨てる
+      const auto lba = ClusterLBA(cluster);
+      if(auto buf = buffer_cache->Find(lba)) {
+        if(pinned_buffers.erase(reinterpret_cast<uintptr_t>(buf->data.get()))) {
+          buffer_cache->Unpin(buf);
+        }
+      }
+      buffer_cache->Discard(lba);
+
+      if(IsEndOfClusterchain(next)) {
         break;
       }
+      cluster = next;
+    }
+  }
+
+  unsigned long AllocateClusterChain(size_t n) {
+    MutexGuard lock{fs_mutex};
+    const unsigned long first_cluster = AllocateCluster(0);
+    if(first_cluster == 0) {
+      return 0;
     }
+    SetFatEntry(first_cluster, kEndOfClusterchain);
 
     if(n > 1) {
       ExtendCluster(first_cluster, n - 1);
@@ -261,49 +1291,73 @@ not_found:
   }
 
   FileDescriptor::FileDescriptor(DirectoryEntry& fat_entry)
-    : fat_entry_{fat_entry}
+    : fat_entry_{&fat_entry}
   {
+    MutexGuard lock{fs_mutex};
+    open_files.push_back(this);
   }
 
-  size_t FileDescriptor::Read(void* buf, size_t len){
-    if(rd_cluster_ == 0) {
-      rd_cluster_ = fat_entry_.FirstCluster();
-    }
-    uint8_t* buf8 = reinterpret_cast<uint8_t*>(buf);
-    len = std::min(len, fat_entry_.file_size - rd_off_);
+  FileDescriptor::~FileDescriptor() {
+    MutexGuard lock{fs_mutex};
+    open_files.erase(std::find(open_files.begin(), open_files.end(), this));
+  }
 
-    size_t total = 0;
-    while(total < len) {
-      uint8_t* sec = GetSectorByCluster<uint8_t>(rd_cluster_);
-      size_t n = std::min(len - total, bytes_per_cluster - rd_cluster_off_);
-      memcpy(&buf8[total], &sec[rd_cluster_off_], n);
-      total += n;
+  bool FileDescriptor::IsOpen(const DirectoryEntry& entry) {
+    MutexGuard lock{fs_mutex};
+    return std::any_of(open_files.begin(), open_files.end(),
+                       [&entry](const FileDescriptor* fd) { return fd->fat_entry_ == &entry; });
+  }
 
-      rd_cluster_off_ += n;
-      if(rd_cluster_off_ == bytes_per_cluster) {
-        rd_cluster_ = NextCluster(rd_cluster_);
-        rd_cluster_off_ = 0;
+  void FileDescriptor::MoveEntry(const DirectoryEntry& entry, DirectoryEntry& new_entry) {
+    MutexGuard lock{fs_mutex};
+    for(auto fd : open_files) {
+      if(fd->fat_entry_ == &entry) {
+        fd->fat_entry_ = &new_entry;
       }
     }
+  }
+
+  void FileDescriptor::_OnTruncated(size_t len) {
+    cluster_index_.clear();
+    _SeekWrite(std::min(wr_off_, len));
+    ra_window_ = 0;
+  }
 
+  size_t FileDescriptor::Read(void* buf, size_t len){
+    MutexGuard lock{fs_mutex};
+    IOAccount account{&IOStat::reads, &IOStat::read_ns};
+    _ReadAhead(rd_off_, len);
+    const size_t total = _ReadAt(buf, len, rd_off_);
     rd_off_ += total;
+    wrote_last_ = false;
     return total;
   }
 
   size_t FileDescriptor::Write(const void* buf, size_t len) {
+    MutexGuard lock{fs_mutex};
+    wrote_last_ = true;
+    return _Write(buf, len);
+  }
+
+  size_t FileDescriptor::_Write(const void* buf, size_t len) {
+    IOAccount account{&IOStat::writes, &IOStat::write_ns};
     auto num_cluster = [](size_t bytes) {
       return (bytes + bytes_per_cluster - 1) / bytes_per_cluster;
     };
 
     if(wr_cluster_ == 0) {
-      if(fat_entry_.FirstCluster() != 0) {
+      if(fat_entry_->FirstCluster() != 0) {
         // 既存ファイル
-        wr_cluster_ = fat_entry_.FirstCluster();
+        wr_cluster_ = fat_entry_->FirstCluster();
       }
       else {
         wr_cluster_ = AllocateClusterChain(num_cluster(len));
-        fat_entry_.first_cluster_low = wr_cluster_ & 0xffff;
-        fat_entry_.first_cluster_high = (wr_cluster_ >> 16) & 0xffff;
+        if(wr_cluster_ == 0) {
+          return 0; // ボリュームに空きがない
+        }
+        fat_entry_->first_cluster_low = wr_cluster_ & 0xffff;
+        fat_entry_->first_cluster_high = (wr_cluster_ >> 16) & 0xffff;
+        MarkDirty(fat_entry_);
       }
     }
 
@@ -314,8 +1368,12 @@ not_found:
       if(wr_cluster_off_ == bytes_per_cluster) {
         const auto next_cluster = NextCluster(wr_cluster_);
         if(next_cluster == kEndOfClusterchain) {
-          // クラスタチェーンの末尾に来たので増やす
-          wr_cluster_ = ExtendCluster(wr_cluster_, num_cluster(len-total));
+          // クラスタチェーンの末尾に来たので増やす（wr_cluster_ が末尾なので辿り直しは起きない）
+          const auto new_tail = ExtendCluster(wr_cluster_, num_cluster(len-total));
+          if(new_tail == wr_cluster_) {
+            break; // ボリュームに空きがない
+          }
+          wr_cluster_ = NextCluster(wr_cluster_);
         }
         else {
           wr_cluster_ = next_cluster;
@@ -323,32 +1381,297 @@ not_found:
         wr_cluster_off_ = 0;
       }
 
-      uint8_t* sec = GetSectorByCluster<uint8_t>(wr_cluster_);
-      size_t n = std::min(len, bytes_per_cluster - wr_cluster_off_);
-      memcpy(&sec[wr_cluster_off_], &buf8[total], n);
+      size_t n = std::min(len - total, bytes_per_cluster - wr_cluster_off_);
+      BufferCache::Ref sec;
+      if(n == bytes_per_cluster) {
+        // クラスタ全体を書き換えるので、元の内容は読まなくてよい
+        sec = std::move(buffer_cache->GetForOverwrite(ClusterLBA(wr_cluster_), volume.cluster_sectors).value);
+      }
+      else {
+        sec = GetClusterBuffer(wr_cluster_);
+      }
+      if(!sec) {
+        break;
+      }
+      memcpy(&sec->data[wr_cluster_off_], &buf8[total], n);
+      buffer_cache->MarkDirty(sec.Get());
       total += n;
+      ++io_stat.clusters_written;
 
       wr_cluster_off_ += n;
     }
 
     wr_off_ += total;
-    fat_entry_.file_size = wr_off_;
+    io_stat.bytes_written += total;
+    fat_entry_->file_size = std::max<size_t>(fat_entry_->file_size, wr_off_);
+    MarkDirty(fat_entry_);
+
+    if(const size_t written = wr_off_ / bytes_per_cluster; written >= wb_index_ + kWriteBehindClusters) {
+      _WriteBehind(wb_index_, written);
+      wb_index_ = written;
+    }
     return total;
   }
 
+  void FileDescriptor::_SeekWrite(size_t offset) {
+    wr_off_ = offset;
+    wb_index_ = offset / bytes_per_cluster;
+    if(offset == 0) {
+      wr_cluster_ = 0; // 次の Write で先頭のクラスタから書く
+      wr_cluster_off_ = 0;
+      return;
+    }
+    // クラスタ境界ちょうどなら前のクラスタの末尾を指しておく（Write が次のクラスタに進む）
+    const size_t index = (offset - 1) / bytes_per_cluster;
+    wr_cluster_ = _ClusterAt(index);
+    wr_cluster_off_ = offset - index * bytes_per_cluster;
+  }
+
+  WithError<size_t> FileDescriptor::Seek(long offset, int whence) {
+    MutexGuard lock{fs_mutex};
+    long base;
+    switch(whence) {
+      case SEEK_SET: base = 0; break;
+      case SEEK_CUR: base = wrote_last_ ? wr_off_ : rd_off_; break;
+      case SEEK_END: base = fat_entry_->file_size; break;
+      default: return {0, MAKE_ERROR(Error::kNotImplemented)};
+    }
+    const long pos = base + offset;
+    if(pos < 0 || pos > fat_entry_->file_size) {
+      return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
+    }
+    rd_off_ = pos;
+    _SeekWrite(pos);
+    return {static_cast<size_t>(pos), MAKE_ERROR(Error::kSuccess)};
+  }
+
+  Error FileDescriptor::Truncate(size_t len) {
+    MutexGuard lock{fs_mutex};
+    const size_t size = fat_entry_->file_size;
+    if(len < size) {
+      const size_t keep = (len + bytes_per_cluster - 1) / bytes_per_cluster;
+      if(keep == 0) {
+        FreeClusterChain(fat_entry_->FirstCluster());
+        fat_entry_->first_cluster_low = 0;
+        fat_entry_->first_cluster_high = 0;
+      }
+      else if(const auto last = _ClusterAt(keep - 1); last != kEndOfClusterchain) {
+        if(const auto next = GetFatEntry(last); !IsEndOfClusterchain(next)) {
+          SetFatEntry(last, kEndOfClusterchain);
+          FreeClusterChain(next);
+        }
+      }
+      cluster_index_.resize(std::min(cluster_index_.size(), keep));
+      fat_entry_->file_size = len;
+      MarkDirty(fat_entry_);
+      for(auto fd : open_files) {
+        if(fd != this && fd->fat_entry_ == fat_entry_) {
+          fd->_OnTruncated(len);
+        }
+      }
+    }
+    else if(len > size) {
+      // 末尾から 0 を書いて伸ばす
+      const size_t wr_off = wr_off_;
+      _SeekWrite(size);
+      static const uint8_t zeros[512] = {};
+      while(wr_off_ < len) {
+        if(_Write(zeros, std::min(sizeof(zeros), len - wr_off_)) == 0) {
+          _SeekWrite(wr_off);
+          return MAKE_ERROR(Error::kNoEnoughMemory);
+        }
+      }
+      _SeekWrite(wr_off);
+    }
+
+    if(wr_off_ > len) {
+      _SeekWrite(len);
+    }
+    ra_window_ = 0;
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
+  void FileDescriptor::_ReadAhead(size_t offset, size_t len) {
+    if(len == 0 || offset >= fat_entry_->file_size) {
+      return;
+    }
+    len = std::min(len, fat_entry_->file_size - offset);
+    const size_t first = offset / bytes_per_cluster;
+    const size_t last = (offset + len - 1) / bytes_per_cluster;
+    const size_t file_clusters = (fat_entry_->file_size + bytes_per_cluster - 1) / bytes_per_cluster;
+
+    if(offset != ra_next_off_) {
+      ra_window_ = 0; // 連続していないので先読みをやめる
+    }
+    else if(ra_window_ == 0) {
+      ra_window_ = kInitialReadAheadWindow;
+      ra_end_ = first;
+    }
+    ra_next_off_ = offset + len;
+    if(ra_window_ == 0) {
+      return;
+    }
+
+    // 要求済みの範囲の残りが窓の半分を切ったら、次の窓を要求して窓を広げる
+    if(last + ra_window_ / 2 < ra_end_) {
+      return;
+    }
+    const size_t start = std::max(ra_end_, first);
+    const size_t end = std::min(file_clusters, std::max(start, last + 1) + ra_window_);
+    _FetchClusters(start, end);
+    ra_end_ = end;
+    ra_window_ = std::min(ra_window_ * 2, kMaxReadAheadWindow);
+  }
+
+  void FileDescriptor::_FetchClusters(size_t first, size_t end) {
+    size_t i = first;
+    while(i < end) {
+      const auto run_first = _ClusterAt(i);
+      if(run_first == kEndOfClusterchain) {
+        return;
+      }
+      size_t n = 1;
+      while(i + n < end && _ClusterAt(i + n) == run_first + n) {
+        ++n;
+      }
+      buffer_cache->ReadAhead(ClusterLBA(run_first), volume.cluster_sectors, n);
+      i += n;
+    }
+  }
+
+  void FileDescriptor::_WriteBehind(size_t first, size_t end) {
+    size_t i = first;
+    while(i < end) {
+      const auto run_first = _ClusterAt(i);
+      if(run_first == kEndOfClusterchain) {
+        return;
+      }
+      size_t n = 1;
+      while(i + n < end && _ClusterAt(i + n) == run_first + n) {
+        ++n;
+      }
+      // 汚れたクラスタは番号順に並んでいるので 1 回の書き込みにまとまる
+      if(auto err = buffer_cache->FlushRange(ClusterLBA(run_first), n * volume.cluster_sectors)) {
+        Log(kError, "failed to write back clusters: %s\n", err.Name());
+        return;
+      }
+      i += n;
+    }
+  }
+
   size_t FileDescriptor::Load(void* buf, size_t len, size_t offset) {
-    FileDescriptor fd{fat_entry_};
-    fd.rd_off_ = offset;
+    MutexGuard lock{fs_mutex};
+    return _ReadAt(buf, len, offset);
+  }
+
+  WithError<size_t> FileDescriptor::Store(const void* buf, size_t len, size_t offset) {
+    MutexGuard lock{fs_mutex};
+    if(offset > fat_entry_->file_size) {
+      return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
+    }
+    const size_t saved_off = wr_off_;
+    _SeekWrite(offset);
+    const size_t written = _Write(buf, len);
+    _SeekWrite(saved_off);
+    return {written, MAKE_ERROR(Error::kSuccess)};
+  }
+
+  unsigned long FileDescriptor::_ClusterAt(size_t index) {
+    if(cluster_index_.empty()) {
+      const auto first_cluster = fat_entry_->FirstCluster();
+      if(first_cluster == 0) {
+        return kEndOfClusterchain;
+      }
+      cluster_index_.push_back(first_cluster);
+    }
+
+    // Write はチェーンを末尾にしか伸ばさず、途中で切られたときは Truncate が同じファイルを開いている
+    // すべての FileDescriptor の cluster_index_ を縮めるので、覚えている最後のクラスタから続きを辿ればよい
+    while(cluster_index_.size() <= index) {
+      const auto next = NextCluster(cluster_index_.back());
+      if(next == kEndOfClusterchain) {
+        return kEndOfClusterchain;
+      }
+      cluster_index_.push_back(next);
+    }
+    return cluster_index_[index];
+  }
+
+  size_t FileDescriptor::_ReadAt(void* buf, size_t len, size_t offset) {
+    if(offset >= fat_entry_->file_size) {
+      return 0;
+    }
+    uint8_t* buf8 = reinterpret_cast<uint8_t*>(buf);
+
+    size_t total = 0;
+    for(const auto& extent : GetExtents(offset, len)) {
+      // 連続しているクラスタは、キャッシュにない分をまとめて 1 回の要求で読む
+      if(auto err = buffer_cache->Read(ClusterLBA(extent.cluster), volume.cluster_sectors,
+                                       extent.offset, &buf8[total], extent.len)) {
+        Log(kError, "failed to read cluster %lu: %s\n", extent.cluster, err.Name());
+        break;
+      }
+      total += extent.len;
+      io_stat.clusters_read += (extent.offset + extent.len + bytes_per_cluster - 1) / bytes_per_cluster;
+    }
+    io_stat.bytes_read += total;
+    return total;
+  }
 
-    unsigned long cluster = fat_entry_.FirstCluster();
-    while(offset >= bytes_per_cluster) {
-      offset -= bytes_per_cluster;
-      cluster = NextCluster(cluster);
+  std::vector<Extent> FileDescriptor::GetExtents(size_t offset, size_t len) {
+    MutexGuard lock{fs_mutex};
+    std::vector<Extent> extents;
+    if(offset >= fat_entry_->file_size) {
+      return extents;
     }
+    len = std::min(len, fat_entry_->file_size - offset);
 
-    fd.rd_cluster_ = cluster;
-    fd.rd_cluster_off_ = offset;
-    return fd.Read(buf, len);
+    size_t index = offset / bytes_per_cluster;
+    size_t cluster_off = offset % bytes_per_cluster;
+    unsigned long prev_cluster = 0;
+    while(len > 0) {
+      const auto cluster = _ClusterAt(index);
+      if(cluster == kEndOfClusterchain) {
+        break; // file_size に対してクラスタが足りない
+      }
+      const size_t n = std::min(len, bytes_per_cluster - cluster_off);
+      if(!extents.empty() && cluster == prev_cluster + 1) {
+        // 番号が連続するクラスタはボリューム上でも隣り合っている
+        extents.back().len += n;
+      }
+      else {
+        extents.push_back({cluster, cluster_off, n});
+      }
+
+      prev_cluster = cluster;
+      len -= n;
+      ++index;
+      cluster_off = 0;
+    }
+    return extents;
+  }
+
+  const void* FileDescriptor::MapRange(size_t offset, size_t len) {
+    MutexGuard lock{fs_mutex};
+    // 範囲全体が 1 つの Extent に収まるときだけ返せる
+    const auto extents = GetExtents(offset, len);
+    if(extents.size() != 1 || extents[0].len != len) {
+      return nullptr;
+    }
+    const auto& extent = extents[0];
+
+    // メモリ上にそのまま置いてあるデバイスでなければ、Load で Extent ごとにキャッシュから読む
+    const auto lba = ClusterLBA(extent.cluster);
+    auto p = reinterpret_cast<const uint8_t*>(buffer_cache->Device().DirectMap(lba));
+    if(p == nullptr) {
+      return nullptr;
+    }
+    // キャッシュ上の変更をデバイス側に反映してから渡す
+    const size_t clusters = (extent.offset + extent.len + bytes_per_cluster - 1) / bytes_per_cluster;
+    if(buffer_cache->FlushRange(lba, clusters * volume.cluster_sectors)) {
+      return nullptr;
+    }
+    return p + extent.offset;
   }
 
 } // namespace fat
\ No newline at end of file
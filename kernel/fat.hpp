@@ -10,7 +10,10 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <string>
+#include <vector>
 
+#include "buffer_cache.hpp"
 #include "error.hpp"
 #include "file.hpp"
 namespace fat {
@@ -50,6 +53,17 @@ struct BPB {
   char fs_type[8];
 } __attribute__((packed));
 
+// FAT32 の FSInfo セクタ。空きクラスタ数と次に探し始める位置のヒントを持つ
+struct FSInfo {
+  uint32_t lead_signature;    // 0x41615252
+  uint8_t reserved1[480];
+  uint32_t struct_signature;  // 0x61417272
+  uint32_t free_count;        // 0xffffffff なら不明
+  uint32_t next_free;         // 0xffffffff なら不明
+  uint8_t reserved2[12];
+  uint32_t trail_signature;   // 0xaa550000
+} __attribute__((packed));
+
 enum class Attribute : uint8_t {
   kReadOnly  = 0x01,
   kHidden    = 0x02,
@@ -80,17 +94,90 @@ struct DirectoryEntry {
   }
 } __attribute__((packed));
 
+// VFAT の長い名前を格納するエントリ。対応する短い名前のエントリの直前に、
+// 名前の後ろの部分から順に並ぶ（最後の部分の ord には 0x40 が立つ）
+struct LongNameEntry {
+  uint8_t ord;
+  uint16_t name1[5];
+  Attribute attr;       // kLongName
+  uint8_t type;
+  uint8_t checksum;     // 短い名前から計算した値
+  uint16_t name2[6];
+  uint16_t first_cluster_low;
+  uint16_t name3[2];
+} __attribute__((packed));
+
+static const int kLongNameCharsPerEntry = 13;
+static const int kLongNameMax = 255; // UTF-16 の文字数
+
+// ディレクトリ内の 1 ファイル
+struct DirectoryItem {
+  DirectoryEntry* entry;
+  std::string name;  // 長い名前（UTF-8）。なければ 8.3 名
+  std::vector<DirectoryEntry*> long_name_entries; // 長い名前を格納しているエントリ（ディスク上の並び順）
+};
+
+// ボリュームの先頭セクタ（BPB）。バッファキャッシュに固定して置いてある
 extern BPB* boot_volume_image;
 extern unsigned long bytes_per_cluster;
-void Initialize(void* volume_image);
 
-/** @brief 指定されたクラスタの先頭セクタが置いてあるメモリアドレスを返す。
+/**
+ * @brief マウント時に BPB から求めておくボリュームの値。
+ * セクタ番号とセクタ数はすべてブロックデバイスのセクタ単位
+ */
+struct Volume {
+  unsigned long sector_scale; // ボリュームの 1 セクタがデバイスの何セクタにあたるか
+  uint64_t fat_lba;          // 先頭の FAT の位置
+  uint64_t fat_sectors;      // FAT 1 つ分の大きさ
+  // クラスタ c は cluster_lba_base + c * cluster_sectors にある（クラスタ 0 があるとした場合の位置）
+  uint64_t cluster_lba_base;
+  size_t cluster_sectors;
+  unsigned int fat_chunk_shift; // FAT の区切り（1 クラスタ分）1 つに入る要素数の log2
+  unsigned int num_fats;
+  unsigned long num_clusters;   // クラスタ番号の上限（有効なのは 2 ~ num_clusters - 1）
+  unsigned long root_cluster;
+  uint64_t fs_info_lba;         // FSInfo がなければ 0
+};
+extern Volume volume;
+
+/** @brief buffer_cache のデバイスをボリュームとして使い始める。
+ * BPB を検査して Volume を求め、空きクラスタのビットマップとルートディレクトリの索引を作る。
+ *
+ * @return BPB が FAT32 として正しくなければ kInvalidFormat
+ */
+Error Initialize();
+
+// CheckVolume の結果
+struct CheckResult {
+  unsigned long files, directories;
+  unsigned long used_clusters;  // FAT 上で使用中のクラスタ
+  unsigned long lost_chains;    // どのエントリからも辿れないチェーンの数
+  unsigned long lost_clusters;  // どのエントリからも辿れないクラスタの数
+  unsigned long cross_links;    // 2 か所以上から指されているクラスタの数
+  unsigned long bad_links;      // 範囲外や空きクラスタを指している FAT の要素の数
+  unsigned long size_mismatches; // ファイルサイズとチェーンの長さが合わないファイルの数
+};
+
+/** @brief ボリュームの整合性を調べる（修復はしない）。
+ * FAT の参照数の計算は区切りごとに独立しているので分割して実行できる。
+ */
+CheckResult CheckVolume();
+
+/** @brief 指定されたクラスタをバッファキャッシュに読み込み、そのメモリアドレスを返す。
+ * ディレクトリエントリへのポインタを持ち続けられるように、読み込んだクラスタは追い出されないよう固定する。
+ * そのためファイルの中身には使わず、ディレクトリにだけ使うこと。
  *
  * @param cluster  クラスタ番号（2 始まり）
  * @return クラスタの先頭セクタが置いてあるメモリ領域のアドレス
  */
 uintptr_t GetClusterAddr(unsigned long cluster);
 
+// GetClusterAddr で得たメモリ（ディレクトリエントリ等）を書き換えたら呼ぶ。Flush で書き戻される
+void MarkDirty(const void* p);
+
+// 変更をデバイスに書き戻す
+Error Flush();
+
 /** @brief 指定されたクラスタの先頭セクタが置いてあるメモリ領域を返す。
  *
  * @param cluster  クラスタ番号（2 始まり）
@@ -116,6 +203,10 @@ void FormatName(const DirectoryEntry& entry, char* dest);
 
 unsigned long NextCluster(unsigned long cluster);
 
+/** @brief パスに対応するディレクトリエントリを探す。
+ * 各ディレクトリの名前 → エントリの索引と、パス単位の結果を覚えておき、2 回目以降は走査しない。
+ * 索引はエントリの作成・削除・名前の変更に合わせてその場で更新される。
+ */
 std::pair<DirectoryEntry*, bool> FindFile(const char* path, unsigned long directory_cluster = 0);
 
 bool NameIsEqual(const DirectoryEntry& entry, const char* name);
@@ -124,13 +215,28 @@ size_t LoadFile(void* buf, size_t len, DirectoryEntry& entry);
 
 bool IsEndOfClusterchain(unsigned long cluster);
 
-uint32_t* GetFat();
+// FAT の cluster 番目の値（上位 4 ビットは除く）
+uint32_t GetFatEntry(unsigned long cluster);
+// FAT の cluster 番目の値を書き換える。FAT が複数あれば全部に書く
+void SetFatEntry(unsigned long cluster, uint32_t value);
 
-// クラスタを伸長する
+// クラスタを伸長し、新しい末尾のクラスタを返す。
+// eoc_cluster にはチェーンの末尾を渡すと辿り直さずに済む
 unsigned long ExtendCluster(unsigned long eoc_cluster, size_t n);
 
 // 指定されたクラスタの空きエントリを返す。満杯なら伸長する
+// （ディレクトリの索引は更新しないので、名前を付けるなら CreateFile 等を使うこと）
 DirectoryEntry* AllocateEntry(unsigned long dir_cluster);
+// 連続した n 個の空きエントリを返す（クラスタをまたぐこともある）。確保できなければ空
+std::vector<DirectoryEntry*> AllocateEntries(unsigned long dir_cluster, size_t n);
+
+// ディレクトリ内のファイルを並び順に返す。長い名前は復号済み（索引にキャッシュされる）。
+// 削除されたファイルの項目は entry が nullptr になっている。
+// 索引は他のタスクの操作で書き換わるので、写しを返す
+std::vector<DirectoryItem> ReadDirectory(unsigned long dir_cluster);
+
+// 短い名前から長い名前のエントリに入れるチェックサムを計算する
+uint8_t ShortNameChecksum(const unsigned char* name);
 
 // name には基本名と拡張子をドットで結合したものを渡す
 // 例： "hoge.foo" → "HOGE    FOO"　（11文字）
@@ -138,24 +244,129 @@ void SetFileName(DirectoryEntry& entry, const char* name);
 
 WithError<DirectoryEntry*> CreateFile(const char* path);
 
-// 指定された数のクラスタチェーンを構築する
+// ディレクトリを作り、"." と ".." を置く
+WithError<DirectoryEntry*> MakeDirectory(const char* path);
+
+// ファイルか空のディレクトリを削除し、クラスタを解放する。開いているファイルは消せない（kBusy）
+Error Remove(const char* path);
+
+// 名前を変える（別のディレクトリにも移せる）。移動先にファイルがあれば置き換える。
+// 同じディレクトリ内で名前のエントリ数が増えなければエントリはその場で書き換えるが、
+// そうでなければエントリの場所が変わるので、古いエントリへのポインタは使えなくなる
+// （開いている FileDescriptor は付け替える）。開いているファイルは置き換えない（kBusy）
+Error Rename(const char* old_path, const char* new_path);
+
+// cluster から始まるチェーンを解放する
+void FreeClusterChain(unsigned long cluster);
+
+// 指定された数のクラスタチェーンを構築する。空きがなければ 0 を返す
 unsigned long AllocateClusterChain(size_t n);
 
+// 空きクラスタの数
+unsigned long FreeClusterCount();
+
+// ファイルの読み書きの統計。全体の値（io_stat）と、タスクごとの値（Task::IOStats）がある
+struct IOStat {
+  uint64_t reads, writes;             // FileDescriptor::Read / Write の呼び出し回数
+  uint64_t bytes_read, bytes_written; // 呼び出し側のバッファとの間でコピーしたバイト数
+  uint64_t clusters_read, clusters_written;
+  uint64_t fat_lookups;               // GetFatEntry の回数（パスの検索などの分も含む）
+  uint64_t read_ns, write_ns;         // Read / Write にかかった時間
+
+  IOStat& operator+=(const IOStat& rhs) {
+    reads += rhs.reads;
+    writes += rhs.writes;
+    bytes_read += rhs.bytes_read;
+    bytes_written += rhs.bytes_written;
+    clusters_read += rhs.clusters_read;
+    clusters_written += rhs.clusters_written;
+    fat_lookups += rhs.fat_lookups;
+    read_ns += rhs.read_ns;
+    write_ns += rhs.write_ns;
+    return *this;
+  }
+
+  IOStat& operator-=(const IOStat& rhs) {
+    reads -= rhs.reads;
+    writes -= rhs.writes;
+    bytes_read -= rhs.bytes_read;
+    bytes_written -= rhs.bytes_written;
+    clusters_read -= rhs.clusters_read;
+    clusters_written -= rhs.clusters_written;
+    fat_lookups -= rhs.fat_lookups;
+    read_ns -= rhs.read_ns;
+    write_ns -= rhs.write_ns;
+    return *this;
+  }
+};
+extern IOStat io_stat;
+
+// ファイルのうち、ボリューム上で番号が連続しているクラスタに載っている範囲
+struct Extent {
+  unsigned long cluster; // 範囲の先頭を含むクラスタ
+  size_t offset;         // cluster の先頭からのバイト数
+  size_t len;
+};
+
 class FileDescriptor : public ::FileDescriptor {
   public:
     explicit FileDescriptor(DirectoryEntry& fat_entry);
+    ~FileDescriptor();
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
     size_t Read(void* buf, size_t len) override;
     size_t Write(const void* buf, size_t len) override;
-    size_t Size() const override { return fat_entry_.file_size; }
+    size_t Size() const override { return fat_entry_->file_size; }
     size_t Load(void* buf, size_t len, size_t offset) override;
+    // 末尾より後ろからは書けない（穴は作らない）
+    WithError<size_t> Store(const void* buf, size_t len, size_t offset) override;
+    const void* MapRange(size_t offset, size_t len) override;
+    Error Truncate(size_t len) override;
+    // ファイルの末尾より後ろには動かせない。読む位置と書く位置の両方が動く
+    WithError<size_t> Seek(long offset, int whence) override;
+
+    // [offset, offset + len) をファイル末尾で切り詰め、連続している範囲ごとに返す
+    std::vector<Extent> GetExtents(size_t offset, size_t len);
+
+    // entry を開いている FileDescriptor があるか。あればエントリを消したり置き換えたりできない
+    static bool IsOpen(const DirectoryEntry& entry);
+    // Rename でエントリが別の場所に移ったとき、開いている FileDescriptor を新しいエントリに付け替える
+    static void MoveEntry(const DirectoryEntry& entry, DirectoryEntry& new_entry);
+
   private:
-    DirectoryEntry& fat_entry_;
+    DirectoryEntry* fat_entry_;
     size_t rd_off_ = 0;
-    unsigned long rd_cluster_ = 0;
-    size_t rd_cluster_off_ = 0;
     size_t wr_off_ = 0;
+    // 最後に動いたのが書く位置なら true。Seek(SEEK_CUR) はこちらの位置を基準にする
+    bool wrote_last_ = false;
     unsigned long wr_cluster_ = 0;
     size_t wr_cluster_off_ = 0;
+
+    // ファイル先頭から i 番目のクラスタ番号。必要になった分だけ FAT を辿って埋める
+    std::vector<uint32_t> cluster_index_{};
+    unsigned long _ClusterAt(size_t index);
+    size_t _ReadAt(void* buf, size_t len, size_t offset);
+
+    // Read の先読み。連続して読まれている間は窓（クラスタ数）を倍々に広げ、
+    // 飛んだ位置を読まれたら先読みをやめる
+    size_t ra_next_off_ = 0; // 連続して読まれるなら次に来るオフセット
+    size_t ra_window_ = 0;   // 0 なら先読みしない
+    size_t ra_end_ = 0;      // このクラスタの手前までは要求済み
+    void _ReadAhead(size_t offset, size_t len);
+    // ファイルの [first, end) 番目のクラスタを、ボリューム上で連続している範囲ごとに 1 回の要求で読む
+    void _FetchClusters(size_t first, size_t end);
+
+    // Write の書き戻し。連続して書いたクラスタが溜まったら先にまとめて書き戻す
+    size_t wb_index_ = 0;    // このクラスタの手前までは書き戻しを要求済み
+    void _WriteBehind(size_t first, size_t end);
+
+    // 次の Write を offset から書くようにする
+    void _SeekWrite(size_t offset);
+    // wr_off_ から書く。Store や Truncate からも使うので wrote_last_ は変えない
+    size_t _Write(const void* buf, size_t len);
+    // 同じファイルを開いている別の FileDescriptor が len バイトに切り詰めたときに呼ぶ。
+    // 解放されたかもしれないクラスタを覚えているので捨てる
+    void _OnTruncated(size_t len);
 };
 
 } // namespace fat
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "file.hpp"
 
+#include <algorithm>
 #include <cstdio>
+#include <vector>
 
 size_t PrintToFD(FileDescriptor& fd, const char* format, ...) {
   va_list ap;
@@ -29,3 +31,22 @@ size_t ReadDelim(FileDescriptor& fd, char delim, char* buf, size_t len) {
   buf[i] = '\0';
   return i;
 }
+
+WithError<size_t> FileDescriptor::SpliceTo(FileDescriptor& dst, size_t len) {
+  const size_t kChunk = 16 * 1024;
+  std::vector<uint8_t> buf(std::min(len, kChunk));
+  size_t total = 0;
+  while(total < len) {
+    const size_t r = Read(buf.data(), std::min(buf.size(), len - total));
+    if(r == 0) {
+      break;
+    }
+    const size_t w = dst.Write(buf.data(), r);
+    total += w;
+    if(w < r) {
+      // 読んでしまった残りは戻せないので、黙って捨てずにエラーにする
+      return {total, MAKE_ERROR(Error::kNoEnoughMemory)};
+    }
+  }
+  return {total, MAKE_ERROR(Error::kSuccess)};
+}
@@ -11,6 +11,29 @@ class FileDescriptor {
     virtual size_t Size() const = 0;
 
     virtual size_t Load(void* buf, size_t len, size_t offset) = 0;
+    // offset から len バイトを書く。読み書きの位置は動かさない
+    virtual WithError<size_t> Store(const void* buf, size_t len, size_t offset) {
+      return {0, MAKE_ERROR(Error::kNotImplemented)};
+    }
+
+    // [offset, offset + len) がメモリ上で連続して読めるならその先頭を返す（コピーしない）。
+    // 読めなければ nullptr を返すので、呼び出し側は Load にフォールバックすること
+    virtual const void* MapRange(size_t offset, size_t len) { return nullptr; }
+
+    // ファイルの大きさを len にする。伸ばした部分は 0 で埋まる
+    virtual Error Truncate(size_t len) { return MAKE_ERROR(Error::kNotImplemented); }
+
+    // 読み書きの位置を動かし、新しい位置を返す。whence は SEEK_SET / SEEK_CUR / SEEK_END
+    virtual WithError<size_t> Seek(long offset, int whence) {
+      return {0, MAKE_ERROR(Error::kNotImplemented)};
+    }
+
+    // src から最大 len バイトを読んでこの記述子に書き、移したバイト数を返す（src の終わりで止まる）。
+    // 既定では src.SpliceTo に任せるので、どちらか一方がバッファを持っていればそこを直接使える
+    // 書き込み先が受け付けず、読んだ分を書き切れなかったらエラー（kNoEnoughMemory）も返す
+    virtual WithError<size_t> SpliceFrom(FileDescriptor& src, size_t len) { return src.SpliceTo(*this, len); }
+    // この記述子から最大 len バイトを読んで dst に書く。既定ではカーネル内のバッファを経由する
+    virtual WithError<size_t> SpliceTo(FileDescriptor& dst, size_t len);
 };
 
 size_t PrintToFD(FileDescriptor& fd, const char* format, ...);
@@ -0,0 +1,72 @@
+#include "fpu.hpp"
+
+#include <cstring>
+
+#include "asmfunc.h"
+#include "logger.hpp"
+
+namespace {
+  const uint64_t kCR4OSXSAVE = 1u << 18;
+
+  // XCR0 のビット
+  const uint64_t kXCR0X87 = 1u << 0;
+  const uint64_t kXCR0SSE = 1u << 1;
+  const uint64_t kXCR0AVX = 1u << 2;
+
+  size_t state_bytes = 512;
+}
+
+// 値は asmfunc.asm の IntHandlerNM と合わせること
+enum class FPUSaveMethod : uint32_t {
+  kFXSave = 0,
+  kXSave = 1,
+  kXSaveOpt = 2, // 前回の復帰から変更のない部分の書き込みを省く
+};
+
+extern "C" {
+  FPUSaveMethod fpu_save_method = FPUSaveMethod::kFXSave;
+  void* fpu_owner_state = nullptr;
+}
+
+void InitializeFPU() {
+  uint32_t eax, ebx, ecx, edx;
+  CPUID(0x1, 0, &eax, &ebx, &ecx, &edx);
+  const bool has_xsave = ecx & (1u << 26);
+  const bool has_avx = ecx & (1u << 28);
+
+  if(!has_xsave) {
+    Log(kWarn, "XSAVE is not supported. fall back to FXSAVE\n");
+    return;
+  }
+
+  SetCR4(GetCR4() | kCR4OSXSAVE);
+  uint64_t xcr0 = kXCR0X87 | kXCR0SSE;
+  if(has_avx) {
+    xcr0 |= kXCR0AVX;
+  }
+  XSetBV(0, xcr0);
+
+  // EBX は XCR0 で有効にした状態をすべて含むのに必要なサイズ
+  CPUID(0xd, 0, &eax, &ebx, &ecx, &edx);
+  state_bytes = ebx;
+
+  CPUID(0xd, 1, &eax, &ebx, &ecx, &edx);
+  fpu_save_method = (eax & 1u) ? FPUSaveMethod::kXSaveOpt : FPUSaveMethod::kXSave;
+
+  Log(kInfo, "FPU: xcr0 = %lx, state %lu bytes, xsaveopt %d\n",
+      xcr0, state_bytes, fpu_save_method == FPUSaveMethod::kXSaveOpt);
+}
+
+size_t FPUStateBytes() {
+  return state_bytes;
+}
+
+void InitFPUState(void* area) {
+  auto p = reinterpret_cast<uint8_t*>(area);
+  // XSAVE ヘッダ（512~575）が 0 なら、復帰時に各状態は初期値になる
+  memset(p, 0, state_bytes);
+  // FCW 0~1 : x87 の例外をすべてマスクする
+  *reinterpret_cast<uint16_t*>(&p[0]) = 0x037f;
+  // MXCSR 24~27 : SSE の例外をすべてマスクする（ビット12:7 を 1 にする）
+  *reinterpret_cast<uint32_t*>(&p[24]) = 0x1f80;
+}
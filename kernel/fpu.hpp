@@ -0,0 +1,25 @@
+/**
+ * @file fpu.hpp
+ *
+ * FPU/SSE/AVX 状態の保存と復帰。
+ * タスク切り替え時には保存せず、CR0.TS を立てておいて #NM で遅延して切り替える。
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CR0.TS : 立っていると FPU/SSE 命令の実行で #NM が発生する
+const uint64_t kCR0TaskSwitched = 1u << 3;
+
+void InitializeFPU();
+
+// 1 タスク分の状態保存領域のサイズ（64 バイト境界に置くこと）
+size_t FPUStateBytes();
+// 保存領域を初期状態（全例外マスク）にする
+void InitFPUState(void* area);
+
+// FPU レジスタに状態が載っているタスクの保存領域（いなければ nullptr）。
+// 持ち主の切り替えは #NM ハンドラ（IntHandlerNM）が行い、ここを書き換える
+extern "C" void* fpu_owner_state;
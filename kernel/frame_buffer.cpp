@@ -1,17 +1,17 @@
 #include "frame_buffer.hpp"
 
 
-namespace {
-  int BytesPerPixel(PixelFormat format){
-    switch(format) {
-      case kPixelRGBResv8BitPerColor:
-        return 4;
-      case kPixelBGRResv8BitPerColor:
-        return 4;
-    }
-    return -1;
+int BytesPerPixel(PixelFormat format){
+  switch(format) {
+    case kPixelRGBResv8BitPerColor:
+      return 4;
+    case kPixelBGRResv8BitPerColor:
+      return 4;
   }
+  return -1;
+}
 
+namespace {
   uint8_t* FrameAddrAt(Vector2D<int> pos, const FrameBufferConfig& config) {
     return config.frame_buffer + BytesPerPixel(config.pixel_format)
       * (config.pixels_per_scan_line * pos.y + pos.x);
@@ -114,3 +114,20 @@ void FrameBuffer::Move(Vector2D<int> dst_pos, const Rectangle<int>& src){
   }
 }
 
+void FrameBuffer::WriteRow(Vector2D<int> pos, const uint32_t* colors, int n){
+  // どちらの形式も 1 画素 4 バイトなので、単純なループにしてまとめて変換させる
+  auto dst = reinterpret_cast<uint32_t*>(FrameAddrAt(pos, config_));
+  switch(config_.pixel_format) {
+    case kPixelRGBResv8BitPerColor:
+      for(int i = 0; i < n; ++i){
+        const uint32_t c = colors[i];
+        dst[i] = (c >> 16 & 0xff) | (c & 0xff00) | (c & 0xff) << 16;
+      }
+      break;
+    case kPixelBGRResv8BitPerColor:
+      for(int i = 0; i < n; ++i){
+        dst[i] = colors[i] & 0xffffff;
+      }
+      break;
+  }
+}
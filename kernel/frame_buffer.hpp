@@ -16,9 +16,14 @@ class FrameBuffer {
     const FrameBufferConfig& Config() const { return config_; }
 
     void Move(Vector2D<int> dst_pos, const Rectangle<int>& src);
+    // pos から右へ n 画素に 0xRRGGBB の色を書く。範囲は呼び出し側で切り詰めておくこと
+    void WriteRow(Vector2D<int> pos, const uint32_t* colors, int n);
 
   private:
     FrameBufferConfig config_{};
     std::vector<uint8_t> buffer_{};
     std::unique_ptr<FrameBufferWriter> writer_{};
 };
+
+// 1 画素あたりのバイト数。未知の形式なら -1
+int BytesPerPixel(PixelFormat format);
@@ -0,0 +1,56 @@
+/**
+ * @file histogram.hpp
+ *
+ * TSC のサイクル数などの測定値をまとめて出力する。カーネルの schedbench と
+ * アプリの sysbench で同じ形式になるよう、両方からこのヘッダを使う
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct SampleStats {
+  size_t n;
+  uint64_t min, p50, p99, max;
+};
+
+// samples を昇順に並べ替えて統計値を返す（samples は空でないこと）
+inline SampleStats SortSamples(std::vector<uint64_t>& samples) {
+  std::sort(samples.begin(), samples.end());
+  const size_t n = samples.size();
+  return {n, samples.front(), samples[(n - 1) * 50 / 100],
+          samples[(n - 1) * 99 / 100], samples.back()};
+}
+
+/**
+ * @brief 統計値の行と log2 のヒストグラムを出力する。
+ * @param print  printf と同じ引数を取る関数
+ * @param sorted  SortSamples で並べ替えた測定値
+ */
+template <class Print>
+void PrintSampleHistogram(Print print, const std::vector<uint64_t>& sorted, const SampleStats& stats) {
+  print(" min %lu p50 %lu p99 %lu max %lu cyc\n", stats.min, stats.p50, stats.p99, stats.max);
+
+  // 2^i 以上 2^(i+1) 未満を i 番目に数える
+  std::array<size_t, 64> buckets{};
+  for(auto s : sorted) {
+    ++buckets[63 - __builtin_clzll(s | 1)];
+  }
+  const size_t max_count = *std::max_element(buckets.begin(), buckets.end());
+
+  const int kBarWidth = 30;
+  for(int i = 0; i < 64; ++i) {
+    if(buckets[i] == 0) {
+      continue;
+    }
+    char bar[kBarWidth + 1];
+    const int len = std::max<int>(1, buckets[i] * kBarWidth / max_count);
+    std::fill_n(bar, len, '#');
+    bar[len] = '\0';
+    print(" %10lu |%6lu %s\n", 1ul << i, buckets[i], bar);
+  }
+}
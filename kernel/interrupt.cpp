@@ -111,7 +111,6 @@ namespace {
   FaultHandlerNoError(OF)
   FaultHandlerNoError(BR)
   FaultHandlerNoError(UD)
-  FaultHandlerNoError(NM)
   FaultHandlerWithError(DF)
   FaultHandlerWithError(TS)
   FaultHandlerWithError(NP)
@@ -0,0 +1,87 @@
+/**
+ * io_ring.hpp
+ *
+ * アプリとカーネルで共有する要求キュー（SQ）と完了キュー（CQ）。
+ * アプリは SQ に要求を積んでから SyscallIoRingEnter を 1 回呼び、結果を CQ から取り出す
+*/
+
+#pragma once
+
+#ifdef __cplusplus
+#include <cstdint>
+
+extern "C" {
+#else
+#include <stdint.h>
+#endif
+
+enum IoOpcode {
+  kIoNop,       // 何もせずに完了する
+  kIoRead,      // fd から addr に最大 len バイト読む。result は読んだバイト数
+  kIoWrite,     // addr から fd に len バイト書く。result は書いたバイト数
+  kIoTimeout,   // offset ミリ秒後に完了する
+  kIoEventWait, // アプリのイベントが届くまで待ち、addr（AppEvent の配列）に最大 len 個書く。result は個数
+};
+
+// kIoRead, kIoWrite の offset にこれを指定すると、ファイルの読み書きの位置を使って進める
+#define IO_OFFSET_CURRENT (~0ull)
+
+struct IoSubmission {
+  uint32_t opcode; // enum IoOpcode
+  int fd;
+  void* addr;
+  uint64_t len;
+  uint64_t offset;
+  uint64_t user_data; // 完了にそのまま写す
+};
+
+struct IoCompletion {
+  uint64_t user_data;
+  int64_t result;
+  int error; // 0 でなければ errno の値
+  uint32_t reserved;
+};
+
+// 共有メモリの先頭。SQ と CQ の要素数は 2 のべき乗で、添字は要素数で割った余りを使う
+struct IoRingHeader {
+  uint32_t sq_head; // カーネルが進める
+  uint32_t sq_tail; // アプリが進める
+  uint32_t cq_head; // アプリが進める
+  uint32_t cq_tail; // カーネルが進める
+  uint32_t sq_entries, cq_entries;
+  uint32_t sq_offset, cq_offset; // ヘッダの先頭から各配列までのバイト数
+};
+
+static inline struct IoSubmission* IoRingSq(struct IoRingHeader* ring) {
+  return (struct IoSubmission*)((char*)ring + ring->sq_offset);
+}
+
+static inline struct IoCompletion* IoRingCq(struct IoRingHeader* ring) {
+  return (struct IoCompletion*)((char*)ring + ring->cq_offset);
+}
+
+// 空いている SQ の要素を返す。満杯なら 0
+static inline struct IoSubmission* IoRingGetSubmission(struct IoRingHeader* ring) {
+  if(ring->sq_tail - ring->sq_head >= ring->sq_entries) {
+    return 0;
+  }
+  struct IoSubmission* sqe = &IoRingSq(ring)[ring->sq_tail & (ring->sq_entries - 1)];
+  ++ring->sq_tail;
+  return sqe;
+}
+
+// 届いている完了を 1 つ返す。なければ 0。使い終わったら IoRingSeen を呼ぶ
+static inline struct IoCompletion* IoRingPeekCompletion(struct IoRingHeader* ring) {
+  if(ring->cq_head == ring->cq_tail) {
+    return 0;
+  }
+  return &IoRingCq(ring)[ring->cq_head & (ring->cq_entries - 1)];
+}
+
+static inline void IoRingSeen(struct IoRingHeader* ring) {
+  ++ring->cq_head;
+}
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
@@ -0,0 +1,22 @@
+/**
+ * io_vec.hpp
+ *
+ * SyscallReadV / SyscallWriteV に渡すバッファの並び（POSIX の struct iovec と同じ配置）
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct IoVec {
+  void* base;
+  size_t len;
+};
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
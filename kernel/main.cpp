@@ -30,8 +30,12 @@
 #include "acpi.hpp"
 #include "keyboard.hpp"
 #include "task.hpp"
+#include "fpu.hpp"
 #include "terminal.hpp"
 #include "fat.hpp"
+#include "block_device.hpp"
+#include "buffer_cache.hpp"
+#include "virtio_blk.hpp"
 #include "syscall.hpp"
 
 #include "usb/memory.hpp"
@@ -155,8 +159,33 @@ extern "C" void KernelMainNewStack(
   InitializeMemoryManager(memory_map);
   InitializeTSS();
   InitializeInterrupt();
-  fat::Initialize(volume_image);
   InitializePCI();
+
+  // virtio-blk のディスクがあればそこから、なければブートローダが読み込んだイメージから読む
+  auto new_ram_volume = [volume_image]() -> BlockDevice* {
+    auto bpb = reinterpret_cast<fat::BPB*>(volume_image);
+    return new RamBlockDevice{
+      volume_image, bpb->bytes_per_sector,
+      bpb->total_sectors_32 != 0 ? bpb->total_sectors_32 : bpb->total_sectors_16
+    };
+  };
+  BlockDevice* volume_dev = virtio::FindBlockDevice();
+  const bool is_virtio = volume_dev != nullptr;
+  if(!is_virtio) {
+    volume_dev = new_ram_volume();
+  }
+  InitializeBufferCache(*volume_dev);
+  auto err_mount = fat::Initialize();
+  if(err_mount && is_virtio) {
+    Log(kError, "failed to mount the virtio-blk disk: %s. use the boot volume image\n", err_mount.Name());
+    InitializeBufferCache(*new_ram_volume());
+    err_mount = fat::Initialize();
+  }
+  if(err_mount) {
+    // フォントもアプリも読めないので先へ進めない
+    printk("failed to mount the boot volume: %s\n", err_mount.Name());
+    while (1) __asm__("hlt");
+  }
   InitializeFont();
      
   InitializeLayer(frame_buffer_config_ref);
@@ -176,6 +205,7 @@ extern "C" void KernelMainNewStack(
   InitializeSyscall();
 
   // タスク
+  InitializeFPU();
   InitializeTask();
   Task& main_task = task_manager->CurrentTask();
 
@@ -196,7 +226,8 @@ extern "C" void KernelMainNewStack(
     const auto tick = timer_manager->CurrentTick();
     __asm__("sti");
 
-    sprintf(str, "%010lu", tick);
+    // 表示は以前の 1 tick = 10 ミリ秒の単位のままにする（CurrentTick() はマイクロ秒）
+    sprintf(str, "%010lu", tick / (kTimerFreq / 100));
     FillRectangle(*main_window->InnerWriter(), {20, 4}, {8 * 10, 16}, {0xc6, 0xc6, 0xc6});
     WriteString(*main_window->InnerWriter(), {20, 4}, str, {0,0,0});
     layer_manager->Draw(main_window_layer_id);
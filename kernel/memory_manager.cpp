@@ -142,3 +142,15 @@ void InitializeMemoryManager(const MemoryMap& memory_map){
     exit(1);
   }
 }
+
+WithError<std::shared_ptr<SharedFrames>> SharedFrames::Allocate(size_t num_frames) {
+  auto [frame, err] = memory_manager->Allocate(num_frames);
+  if(err) {
+    return {nullptr, err};
+  }
+  return {std::make_shared<SharedFrames>(frame, num_frames), MAKE_ERROR(Error::kSuccess)};
+}
+
+SharedFrames::~SharedFrames() {
+  memory_manager->Free(frame_, num_frames_);
+}
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <limits>
+#include <memory>
 
 #include "memory_map.hpp"
 #include "error.hpp"
@@ -90,3 +91,24 @@ Error InitializeHeap(BitmapMemoryManager& memory_managr);
 void InitializeMemoryManager(const MemoryMap& memory_map);
 
 extern BitmapMemoryManager* memory_manager;
+
+/**
+ * @brief 連続した物理フレーム。最後の参照がなくなったときに解放する。
+ * カーネルとアプリで共有するメモリ（ウィンドウの画素など）に使い、
+ * アプリが終了するまではタスクも参照を持っておく
+ */
+class SharedFrames {
+  public:
+    static WithError<std::shared_ptr<SharedFrames>> Allocate(size_t num_frames);
+    SharedFrames(FrameID frame, size_t num_frames) : frame_{frame}, num_frames_{num_frames} {}
+    ~SharedFrames();
+    SharedFrames(const SharedFrames&) = delete;
+    SharedFrames& operator=(const SharedFrames&) = delete;
+
+    uint8_t* Data() const { return reinterpret_cast<uint8_t*>(frame_.Frame()); }
+    size_t NumFrames() const { return num_frames_; }
+
+  private:
+    FrameID frame_;
+    size_t num_frames_;
+};
@@ -22,8 +22,8 @@ struct Message {
     kMouseMove,
     kMouseButton,
     kWindowActive,
-    kPipe,
-    kWindowClose
+    kWindowClose,
+    kBenchmark,
   } type;
 
   uint64_t src_task; //送信元タスクID
@@ -65,14 +65,14 @@ struct Message {
       int activate; // 1: activate, 0: deactivate
     } window_active;
 
-    struct {
-      char data[16];
-      uint8_t len;
-    } pipe;
-
     struct {
       unsigned int layer_id;
     } window_close;
 
+    struct {
+      int seq;
+      bool stop;
+    } benchmark;
+
   } arg;
 };
@@ -0,0 +1,44 @@
+#include "mutex.hpp"
+
+#include <algorithm>
+
+#include "task.hpp"
+
+void Mutex::Lock() {
+  if(task_manager == nullptr) {
+    return; // 起動中はタスクが 1 つしかない
+  }
+
+  __asm__("cli");
+  Task* self = &task_manager->CurrentTask();
+  while(owner_ != nullptr && owner_ != self) {
+    // メッセージでも起こされるので、並ぶのは 1 回だけにする
+    if(std::find(waiters_.begin(), waiters_.end(), self) == waiters_.end()) {
+      waiters_.push_back(self);
+    }
+    self->Sleep();
+    __asm__("cli");
+  }
+  if(auto it = std::find(waiters_.begin(), waiters_.end(), self); it != waiters_.end()) {
+    waiters_.erase(it);
+  }
+  owner_ = self;
+  ++depth_;
+  __asm__("sti");
+}
+
+void Mutex::Unlock() {
+  if(task_manager == nullptr) {
+    return;
+  }
+
+  __asm__("cli");
+  if(--depth_ == 0) {
+    owner_ = nullptr;
+    // 先頭を起こす。他のタスクに先を越されたら、また眠って次の Unlock を待つ
+    if(!waiters_.empty()) {
+      waiters_.front()->Wakeup();
+    }
+  }
+  __asm__("sti");
+}
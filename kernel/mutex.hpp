@@ -0,0 +1,35 @@
+/**
+ * @file mutex.hpp
+ *
+ * タスク間の排他。取れなければ取れるまで眠る。
+ * 持っているタスクが重ねて取るのは許す（ファイルシステムの関数は互いに呼び合うので）
+ */
+
+#pragma once
+
+#include <deque>
+
+class Task;
+
+class Mutex {
+  public:
+    void Lock();
+    void Unlock();
+
+  private:
+    Task* owner_{nullptr};
+    int depth_{0};
+    std::deque<Task*> waiters_{}; // 眠って待っているタスク。取れたら自分で抜ける
+};
+
+// 生きている間 Mutex を持つ
+class MutexGuard {
+  public:
+    explicit MutexGuard(Mutex& mutex) : mutex_{mutex} { mutex_.Lock(); }
+    ~MutexGuard() { mutex_.Unlock(); }
+    MutexGuard(const MutexGuard&) = delete;
+    MutexGuard& operator=(const MutexGuard&) = delete;
+
+  private:
+    Mutex& mutex_;
+};
@@ -3,6 +3,7 @@
 #include "memory_manager.hpp"
 #include "task.hpp"
 #include "logger.hpp"
+#include "clock_page.hpp"
 
 #include <array>
 #include <cstdint>
@@ -107,7 +108,7 @@ namespace {
         }
       }
 
-      if(entry.bits.writable) {
+      if(entry.bits.writable && !entry.bits.shared) {
         const auto entry_addr = reinterpret_cast<uintptr_t>(entry.Pointer());
         const FrameID map_frame{entry_addr / kBytesPerFrame};
         if(auto err = memory_manager->Free(map_frame, 1)){
@@ -131,11 +132,19 @@ namespace {
   Error PreparePageCache(FileDescriptor& fd, const FileMapping& m, uint64_t causal_vaddr) {
     LinearAddress4Level page_vaddr{causal_vaddr};
     page_vaddr.parts.offset = 0;
+    const long file_offset = page_vaddr.value - m.vaddr_begin;
+
+    // ファイルの内容がページ境界に揃って連続しているなら、コピーせずにそのまま読み込み専用で見せる。
+    // 書き込まれたら CopyOnPage で複製されるので、ファイル自体は書き換わらない
+    if(auto p = fd.MapRange(file_offset, 4096);
+       p && reinterpret_cast<uintptr_t>(p) % 4096 == 0) {
+      return MapSharedPage(page_vaddr, p);
+    }
+
     if(auto err = SetupPageMaps(page_vaddr, 1)) {
       return err;
     }
 
-    const long file_offset = page_vaddr.value - m.vaddr_begin;
     void* page_cache = reinterpret_cast<void*>(page_vaddr.value);
     fd.Load(page_cache, 4096, file_offset);
     return MAKE_ERROR(Error::kSuccess);
@@ -147,6 +156,8 @@ namespace {
       const auto i = addr.Part(part);
       table[i].SetPointer(content);
       table[i].bits.writable = 1;
+      // MapSharedPage で共有していたページでも、複製はこのアプリのものなので終了時に解放させる
+      table[i].bits.shared = 0;
       InvalidateTLB(addr.value);
       return MAKE_ERROR(Error::kSuccess);
     }
@@ -223,12 +234,58 @@ Error CopyPageMaps(PageMapEntry* dest, PageMapEntry* src, int part, int start){
   return MAKE_ERROR(Error::kSuccess);
 }
 
+Error MapSharedPage(LinearAddress4Level addr, const void* page, bool writable){
+  auto page_map = reinterpret_cast<PageMapEntry*>(GetCR3());
+  for(int level = 4; level > 1; --level) {
+    auto& entry = page_map[addr.Part(level)];
+    auto [child_map, err] = SetNewPageMapIfNotPresent(entry);
+    if(err) {
+      return err;
+    }
+    entry.bits.user = 1;
+    entry.bits.writable = 1;
+    page_map = child_map;
+  }
+
+  auto& entry = page_map[addr.Part(1)];
+  entry.data = 0;
+  entry.SetPointer(reinterpret_cast<PageMapEntry*>(const_cast<void*>(page)));
+  entry.bits.present = 1;
+  entry.bits.user = 1;
+  entry.bits.writable = writable;
+  entry.bits.shared = 1;
+  InvalidateTLB(addr.value);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+void UnmapSharedPages(LinearAddress4Level addr, size_t num_pages){
+  for(size_t n = 0; n < num_pages; ++n) {
+    auto page_map = reinterpret_cast<PageMapEntry*>(GetCR3());
+    for(int level = 4; level > 1 && page_map; --level) {
+      const auto& entry = page_map[addr.Part(level)];
+      page_map = entry.bits.present ? entry.Pointer() : nullptr;
+    }
+    if(page_map) {
+      auto& entry = page_map[addr.Part(1)];
+      if(entry.bits.present && entry.bits.shared) {
+        entry.data = 0;
+        InvalidateTLB(addr.value);
+      }
+    }
+    addr.value += 4096;
+  }
+}
+
 Error HandlePageFault(uint64_t error_code, uint64_t causal_addr){
   auto& task = task_manager->CurrentTask(); //例外中なので割り込みが起きない？というかこれが割り込みのはず
   const bool present  = (error_code >> 0) & 1;
   const bool rw       = (error_code >> 1) & 1;
   const bool user     = (error_code >> 2) & 1;
   if(present && rw && user) {
+    if((causal_addr & 0xffff'ffff'ffff'f000) == CLOCK_PAGE_ADDR) {
+      // 共有の時計ページはコピーせず書き込み違反とする
+      return MAKE_ERROR(Error::kAlreadyAllocated);
+    }
     return CopyOnPage(causal_addr);
   }
   else if(present) {
@@ -66,7 +66,8 @@ union PageMapEntry {
     uint64_t dirty : 1;
     uint64_t huge_page : 1;
     uint64_t global : 1;
-    uint64_t : 3;
+    uint64_t shared : 1; // OS が自由に使えるビット。1 ならカーネルの持つページなので CleanPageMaps で解放しない
+    uint64_t : 2;
 
     uint64_t addr : 40;
     uint64_t : 12;
@@ -86,5 +87,10 @@ Error FreePageMap(PageMapEntry* table);
 Error SetupPageMaps(LinearAddress4Level addr, size_t num_4kpages, bool writable = true);
 Error CleanPageMaps(LinearAddress4Level addr);
 Error CopyPageMaps(PageMapEntry* dest, PageMapEntry* src, int part, int start);
+// カーネルが持つ物理ページをアプリに見せる（CleanPageMaps では解放されない）。
+// 書き込み可能にしなければ、書き込まれたときにコピーされる
+Error MapSharedPage(LinearAddress4Level addr, const void* page, bool writable = false);
+// addr から num_pages ページのうち、MapSharedPage でマップしたものを外す
+void UnmapSharedPages(LinearAddress4Level addr, size_t num_pages);
 Error HandlePageFault(uint64_t error_code, uint64_t causal_addr);
 
@@ -0,0 +1,157 @@
+#include "pipe.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "task.hpp"
+
+PipeDescriptor::PipeDescriptor(size_t capacity) : buf_(capacity) {
+}
+
+size_t PipeDescriptor::Read(void* buf, size_t len) {
+  size_t pos, avail;
+  if(len == 0 || !_WaitData(pos, avail)) {
+    return 0;
+  }
+
+  // [pos, pos + n) は書き手が触らないので、割り込みを許したままコピーできる
+  const size_t n = std::min(avail, len);
+  const size_t first = std::min(n, buf_.size() - pos);
+  auto bufc = reinterpret_cast<uint8_t*>(buf);
+  memcpy(bufc, &buf_[pos], first);
+  memcpy(&bufc[first], &buf_[0], n - first);
+  _Consume(n);
+  return n;
+}
+
+size_t PipeDescriptor::Write(const void* buf, size_t len) {
+  auto bufc = reinterpret_cast<const uint8_t*>(buf);
+  size_t written = 0;
+  while(written < len) {
+    size_t pos, space;
+    if(!_WaitSpace(pos, space)) {
+      break;
+    }
+
+    const size_t n = std::min(space, len - written);
+    const size_t first = std::min(n, buf_.size() - pos);
+    memcpy(&buf_[pos], &bufc[written], first);
+    memcpy(&buf_[0], &bufc[written + first], n - first);
+    written += n;
+    _Produce(n);
+  }
+  return written;
+}
+
+WithError<size_t> PipeDescriptor::SpliceFrom(::FileDescriptor& src, size_t len) {
+  // リングバッファの空きへ src から直接読み込む
+  size_t total = 0;
+  while(total < len) {
+    size_t pos, space;
+    if(!_WaitSpace(pos, space)) {
+      break;
+    }
+    const size_t n = std::min({space, buf_.size() - pos, len - total});
+    const size_t r = src.Read(&buf_[pos], n);
+    if(r == 0) {
+      break;
+    }
+    total += r;
+    _Produce(r);
+  }
+  return {total, MAKE_ERROR(Error::kSuccess)};
+}
+
+WithError<size_t> PipeDescriptor::SpliceTo(::FileDescriptor& dst, size_t len) {
+  // リングバッファの中身をそのまま dst へ書く
+  size_t total = 0;
+  while(total < len) {
+    size_t pos, avail;
+    if(!_WaitData(pos, avail)) {
+      break;
+    }
+    const size_t n = std::min({avail, buf_.size() - pos, len - total});
+    const size_t w = dst.Write(&buf_[pos], n);
+    total += w;
+    _Consume(w);
+    if(w < n) {
+      return {total, MAKE_ERROR(Error::kNoEnoughMemory)};
+    }
+  }
+  return {total, MAKE_ERROR(Error::kSuccess)};
+}
+
+void PipeDescriptor::FinishWrite() {
+  __asm__("cli");
+  write_finished_ = true;
+  if(auto reader = waiting_reader_) {
+    waiting_reader_ = nullptr;
+    reader->Wakeup();
+  }
+  __asm__("sti");
+}
+
+void PipeDescriptor::FinishRead() {
+  __asm__("cli");
+  read_finished_ = true;
+  if(auto writer = waiting_writer_) {
+    waiting_writer_ = nullptr;
+    writer->Wakeup();
+  }
+  __asm__("sti");
+}
+
+bool PipeDescriptor::_WaitData(size_t& pos, size_t& avail) {
+  while(true) {
+    __asm__("cli");
+    pos = read_pos_;
+    avail = used_;
+    if(avail > 0 || write_finished_) {
+      break;
+    }
+    waiting_reader_ = &task_manager->CurrentTask();
+    waiting_reader_->Sleep();
+  }
+  __asm__("sti");
+  return avail > 0;
+}
+
+void PipeDescriptor::_Consume(size_t n) {
+  __asm__("cli");
+  read_pos_ = (read_pos_ + n) % buf_.size();
+  used_ -= n;
+  if(auto writer = waiting_writer_) {
+    waiting_writer_ = nullptr;
+    writer->Wakeup();
+  }
+  __asm__("sti");
+}
+
+bool PipeDescriptor::_WaitSpace(size_t& pos, size_t& space) {
+  while(true) {
+    __asm__("cli");
+    if(read_finished_) {
+      __asm__("sti");
+      return false;
+    }
+    pos = (read_pos_ + used_) % buf_.size();
+    space = buf_.size() - used_;
+    if(space > 0) {
+      break;
+    }
+    waiting_writer_ = &task_manager->CurrentTask();
+    waiting_writer_->Sleep();
+  }
+  __asm__("sti");
+  return true;
+}
+
+void PipeDescriptor::_Produce(size_t n) {
+  __asm__("cli");
+  used_ += n;
+  if(auto reader = waiting_reader_) {
+    waiting_reader_ = nullptr;
+    reader->Wakeup();
+  }
+  __asm__("sti");
+}
@@ -0,0 +1,55 @@
+/**
+ * @file pipe.hpp
+ *
+ * 書き手と読み手の 2 つのタスクで共有するリングバッファのパイプ
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "file.hpp"
+
+class Task;
+
+class PipeDescriptor : public FileDescriptor {
+  public:
+    static const size_t kDefaultCapacity = 16 * 1024;
+
+    explicit PipeDescriptor(size_t capacity = kDefaultCapacity);
+    // 空なら書かれるまで待つ。書き手が終わっていて空なら 0 を返す
+    size_t Read(void* buf, size_t len) override;
+    // いっぱいなら読まれるまで待つ。読み手が終わっていればそれまでに書けたバイト数を返す
+    size_t Write(const void* buf, size_t len) override;
+    size_t Size() const override { return 0; }
+    size_t Load(void* buf, size_t len, size_t offset) override { return 0; }
+    // リングバッファと src / dst の間で直接コピーする（コピーは 1 回）
+    WithError<size_t> SpliceFrom(::FileDescriptor& src, size_t len) override;
+    WithError<size_t> SpliceTo(::FileDescriptor& dst, size_t len) override;
+
+    // もう書かないことを読み手に知らせる
+    void FinishWrite();
+    // もう読まないことを書き手に知らせる（待っている書き手が止まったままにならないように）
+    void FinishRead();
+
+  private:
+    // 読み手と書き手はそれぞれ 1 つなので、位置と量の更新だけを割り込み禁止で行い、
+    // コピーは割り込みを許したまま行う
+    std::vector<uint8_t> buf_;
+    size_t read_pos_{0}, used_{0};
+    bool write_finished_{false}, read_finished_{false};
+    // 空・満杯で眠っているタスク。状態が変わったときだけ起こす
+    Task* waiting_reader_{nullptr};
+    Task* waiting_writer_{nullptr};
+
+    // 読める位置と量を返す。空なら書かれるまで待ち、書き手が終わっていれば false を返す
+    bool _WaitData(size_t& pos, size_t& avail);
+    // 読んだ分を空きに戻し、待っている書き手を起こす
+    void _Consume(size_t n);
+    // 書ける位置と量を返す。満杯なら読まれるまで待ち、読み手が終わっていれば false を返す
+    bool _WaitSpace(size_t& pos, size_t& space);
+    // 書いた分を読めるようにし、待っている読み手を起こす
+    void _Produce(size_t n);
+};
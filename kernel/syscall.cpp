@@ -11,12 +11,19 @@
 #include "timer.hpp"
 #include "app_event.hpp"
 #include "keyboard.hpp"
+#include "win_command.hpp"
+#include "paging.hpp"
+#include "io_vec.hpp"
+#include "uring.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cerrno>
-#include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <iterator>
+#include <vector>
 #include <fcntl.h>
 
 namespace syscall {
@@ -52,20 +59,17 @@ namespace syscall {
       return {0, E2BIG};
     }
 
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = ThisTask();
 
-    if(fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
       return {0, EBADF};
     }
-    return {task.Files()[fd]->Write(s, len), 0};
+    return {desc->Write(s, len), 0};
   }
 
   SYSCALL(Exit) {
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = ThisTask();
     return {task.OSStackPointer(), static_cast<int>(arg1)};
   }
 
@@ -85,7 +89,7 @@ namespace syscall {
     active_layer->Activate(layer_id);
 
     // アプリに紐づくレイヤーIDを保存しておく
-    const auto task_id = task_manager->CurrentTask().ID();
+    const auto task_id = ThisTask().ID();
     layer_task_map->insert(std::make_pair(layer_id, task_id));
     __asm__("sti");
 
@@ -165,136 +169,508 @@ namespace syscall {
     );
   }
 
-  SYSCALL(WinDrawLine) {
-  return DoWinFunc(
-      [](Window& win,
-         int x0, int y0, int x1, int y1, uint32_t color) {
-        auto sign = [](int x) {
-          return (x > 0) ? 1 : (x < 0) ? -1 : 0;
-        };
-        const int dx = x1 - x0 + sign(x1 - x0);
-        const int dy = y1 - y0 + sign(y1 - y0);
-
-        if (dx == 0 && dy == 0) {
-          win.Writer()->Write({x0, y0}, ToColor(color));
-          return Result{ 0, 0 };
-        }
+  namespace {
+    // pos から右へ n 画素を同じ色で塗る。範囲はウィンドウに収まっていること
+    void FillSpan(Window& win, Vector2D<int> pos, uint32_t color, int n) {
+      uint32_t colors[64];
+      std::fill(std::begin(colors), std::end(colors), color);
+      for(int i = 0; i < n; i += 64) {
+        win.WriteRow({pos.x + i, pos.y}, colors, std::min(64, n - i));
+      }
+    }
+
+    // 今の色に color を alpha / 256 の濃さで混ぜる
+    void BlendPixel(Window& win, Vector2D<int> pos, uint32_t color, int alpha) {
+      const auto old = win.At(pos);
+      const auto c = ToColor(color);
+      auto mix = [alpha](int a, int b) {
+        return static_cast<uint8_t>(a + (b - a) * alpha / 256);
+      };
+      win.Write(pos, {mix(old.r, c.r), mix(old.g, c.g), mix(old.b, c.b)});
+    }
+
+    // 切り上げの除算（b > 0）
+    int64_t CeilDiv(int64_t a, int64_t b) {
+      return a >= 0 ? (a + b - 1) / b : -(-a / b);
+    }
+
+    // 切り捨ての除算（b > 0）。負の数を右シフトせずに済ませる
+    int64_t FloorDiv(int64_t a, int64_t b) {
+      return a >= 0 ? a / b : -CeilDiv(-a, b);
+    }
 
-        const auto floord = static_cast<double(*)(double)>(floor);
-        const auto ceild = static_cast<double(*)(double)>(ceil);
+    /**
+     * @brief 主軸方向に 1 画素ずつ進む Bresenham の線分。
+     * i 歩目の副軸方向のずれは Offset(i) で、i について単調に増える。
+     * 途中の i から始められるので、ウィンドウに収まる範囲を先に求めてから描ける
+     */
+    struct LineSteps {
+      int64_t dmaj, dmin; // 0 <= dmin <= dmaj かつ 0 < dmaj
 
-        if (abs(dx) >= abs(dy)) {
-          if (dx < 0) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
+      int64_t Offset(int64_t i) const {
+        return (2 * i * dmin + dmaj) / (2 * dmaj);
+      }
+      // Offset(i) >= a となる最初の i
+      int64_t FirstAtLeast(int64_t a) const {
+        if(dmin == 0) {
+          return a <= 0 ? 0 : dmaj + 1;
+        }
+        return CeilDiv(2 * dmaj * a - dmaj, 2 * dmin);
+      }
+      // Offset(i) <= b となる最後の i
+      int64_t LastAtMost(int64_t b) const {
+        if(dmin == 0) {
+          return b >= 0 ? dmaj : -1;
+        }
+        return CeilDiv(2 * dmaj * (b + 1) - dmaj, 2 * dmin) - 1;
+      }
+    };
+
+    /**
+     * @brief (x0, y0) から (x1, y1) まで線を引き、描いた範囲（ウィンドウ内）を返す。
+     * 整数演算の Bresenham で、同じ行・列に並ぶ画素はまとめて書く。
+     * antialias なら Wu の方法で隣り合う 2 画素に濃さを分けて混ぜる
+     */
+    Rectangle<int> DrawLine(Window& win, Vector2D<int> p0, Vector2D<int> p1, uint32_t color, bool antialias) {
+      const Rectangle<int> win_area{{0, 0}, win.Size()};
+      if(p0.x == p1.x && p0.y == p1.y) {
+        const auto area = Rectangle<int>{p0, {1, 1}} & win_area;
+        if(area.size.x > 0 && area.size.y > 0) {
+          win.Write(p0, ToColor(color));
+        }
+        return area;
+      }
+
+      // 傾きが 1 より急なら x と y を入れ替え、x を主軸として考える
+      const bool steep = std::abs(p1.y - p0.y) > std::abs(p1.x - p0.x);
+      auto swap_xy = [steep](Vector2D<int> p) {
+        return steep ? Vector2D<int>{p.y, p.x} : p;
+      };
+      auto a = swap_xy(p0), b = swap_xy(p1);
+      if(a.x > b.x) {
+        std::swap(a, b);
+      }
+      const int maj_size = steep ? win.Height() : win.Width();
+      const int min_size = steep ? win.Width() : win.Height();
+      const int sm = b.y >= a.y ? 1 : -1;
+      const LineSteps steps{b.x - a.x, std::abs(b.y - a.y)};
+
+      // 主軸方向にはみ出す部分を削る
+      int64_t i_begin = std::max<int64_t>(0, -a.x);
+      int64_t i_end = std::min<int64_t>(steps.dmaj, maj_size - 1 - a.x);
+
+      if(antialias) {
+        if(i_begin > i_end) {
+          return {{0, 0}, {0, 0}};
+        }
+        // 副軸の座標を 16.16 の固定小数点で進める。副軸のはみ出しは 1 画素ずつ調べる。
+        // 値は負にもなるので、シフトではなく乗除算で書く
+        const int64_t kOne = 65536;
+        const int64_t grad = static_cast<int64_t>(sm * steps.dmin) * kOne / steps.dmaj;
+        const int64_t y0f = static_cast<int64_t>(a.y) * kOne;
+        for(int64_t i = i_begin; i <= i_end; ++i) {
+          const int64_t yf = y0f + grad * i;
+          const int y = FloorDiv(yf, kOne);
+          const int frac = (yf - y * kOne) / 256;
+          const int x = a.x + i;
+          if(0 <= y && y < min_size) {
+            BlendPixel(win, swap_xy({x, y}), color, 256 - frac);
           }
-          const auto roundish = y1 >= y0 ? floord : ceild;
-          const double m = static_cast<double>(dy) / dx;
-          for (int x = x0; x <= x1; ++x) {
-            const int y = roundish(m * (x - x0) + y0);
-            win.Writer()->Write({x, y}, ToColor(color));
+          if(frac > 0 && 0 <= y + 1 && y + 1 < min_size) {
+            BlendPixel(win, swap_xy({x, y + 1}), color, frac);
+          }
+        }
+        const int y_begin = FloorDiv(y0f + grad * i_begin, kOne);
+        const int y_end = FloorDiv(y0f + grad * i_end, kOne);
+        const Vector2D<int> lo = swap_xy({static_cast<int>(a.x + i_begin), std::min(y_begin, y_end)});
+        const Vector2D<int> hi = swap_xy({static_cast<int>(a.x + i_end), std::max(y_begin, y_end) + 1});
+        return Rectangle<int>{lo, hi - lo + Vector2D<int>{1, 1}} & win_area;
+      }
+
+      // 副軸方向にはみ出す部分も削る。Offset は単調なので範囲の両端を求めればよい
+      if(sm > 0) {
+        i_begin = std::max(i_begin, steps.FirstAtLeast(-a.y));
+        i_end = std::min(i_end, steps.LastAtMost(min_size - 1 - a.y));
+      }
+      else {
+        i_begin = std::max(i_begin, steps.FirstAtLeast(a.y - (min_size - 1)));
+        i_end = std::min(i_end, steps.LastAtMost(a.y));
+      }
+      if(i_begin > i_end) {
+        return {{0, 0}, {0, 0}};
+      }
+
+      // 副軸の座標が同じ画素の並びを 1 回で書く（steep でなければ横、steep なら縦の並び）
+      auto put_run = [&](int64_t begin, int64_t end, int64_t offset) {
+        const int y = a.y + sm * offset;
+        if(!steep) {
+          FillSpan(win, {static_cast<int>(a.x + begin), y}, color, end - begin);
+          return;
+        }
+        const auto c = ToColor(color);
+        for(int64_t i = begin; i < end; ++i) {
+          win.Write({y, static_cast<int>(a.x + i)}, c);
+        }
+      };
+
+      const int64_t two_dmaj = 2 * steps.dmaj;
+      int64_t num = 2 * i_begin * steps.dmin + steps.dmaj;
+      int64_t offset = num / two_dmaj, rem = num % two_dmaj;
+      const int64_t first_offset = offset;
+      int64_t run_begin = i_begin;
+      for(int64_t i = i_begin; i <= i_end; ++i) {
+        rem += 2 * steps.dmin;
+        if(rem >= two_dmaj) {
+          rem -= two_dmaj;
+          put_run(run_begin, i + 1, offset);
+          run_begin = i + 1;
+          ++offset;
+        }
+      }
+      if(run_begin <= i_end) {
+        put_run(run_begin, i_end + 1, offset);
+      }
+      else {
+        --offset; // 最後の画素で副軸が進んだ直後に終わった
+      }
+
+      const auto first = swap_xy({static_cast<int>(a.x + i_begin), static_cast<int>(a.y + sm * first_offset)});
+      const auto last = swap_xy({static_cast<int>(a.x + i_end), static_cast<int>(a.y + sm * offset)});
+      const auto lo = ElementMin(first, last);
+      return {lo, ElementMax(first, last) - lo + Vector2D<int>{1, 1}};
+    }
+
+    // ウィンドウの範囲内の画素だけを書き、書いた範囲を覚えておく
+    class ClippedWriter : public PixelWriter {
+      public:
+        ClippedWriter(Window& win) : win_{win} {}
+        virtual void Write(Vector2D<int> pos, const PixelColor& c) override {
+          if(0 <= pos.x && pos.x < win_.Width() && 0 <= pos.y && pos.y < win_.Height()) {
+            win_.Write(pos, c);
+            AddDamage({pos, {1, 1}});
           }
-        } else {
-          if (dy < 0) {
-            std::swap(x0, x1);
-            std::swap(y0, y1);
+        }
+        virtual int Width() const override { return win_.Width(); }
+        virtual int Height() const override { return win_.Height(); }
+
+        // area はウィンドウの範囲に収まっていること
+        void AddDamage(const Rectangle<int>& area) {
+          if(area.size.x <= 0 || area.size.y <= 0) {
+            return;
           }
-          const auto roundish = x1 >= x0 ? floord : ceild;
-          const double m = static_cast<double>(dx) / dy;
-          for (int y = y0; y <= y1; ++y) {
-            const int x = roundish(m * (y - y0) + x0);
-            win.Writer()->Write({x, y}, ToColor(color));
+          if(damage_.size.x == 0) {
+            damage_ = area;
+            return;
           }
+          const auto pos = ElementMin(damage_.pos, area.pos);
+          const auto end = ElementMax(damage_.pos + damage_.size, area.pos + area.size);
+          damage_ = {pos, end - pos};
         }
-        return Result{ 0, 0 };
-      }, arg1, arg2, arg3, arg4, arg5, arg6);
-  }
+        const Rectangle<int>& Damage() const { return damage_; }
 
-  SYSCALL(ReadEvent) {
-    // 使っているのは仮想アドレス空間の後半部分のはず
-    if(arg1 < 0x8000'0000'0000'0000) {
-      return {0, EFAULT};
-    }
-    const auto app_events = reinterpret_cast<AppEvent*>(arg1);
-    const size_t len = arg2;
+      private:
+        Window& win_;
+        Rectangle<int> damage_{{0, 0}, {0, 0}};
+    };
 
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
-    size_t i = 0;
+    // f(Window&) で描き、f が返した範囲だけを画面に反映する（LAYER_NO_REDRAW なら反映しない）
+    template <class Func>
+    Result DoWinDraw(uint64_t layer_id_flags, Func f) {
+      const uint32_t layer_flags = layer_id_flags >> 32;
+      const unsigned int layer_id = layer_id_flags & 0xffffffff;
 
-    while(i < len) {
       __asm__("cli");
-      auto msg = task.ReceiveMessage();
-      if(!msg && i == 0) {
-        task.Sleep();
-        continue;
-      }
+      auto layer = layer_manager->FindLayer(layer_id);
       __asm__("sti");
+      if(layer == nullptr) {
+        return {0, EBADF};
+      }
 
-      if(!msg){
-        break;
+      const Rectangle<int> area = f(*layer->GetWindow());
+      if((layer_flags & 1) == 0 && area.size.x > 0 && area.size.y > 0) {
+        __asm__("cli");
+        layer_manager->Draw(layer_id, area);
+        __asm__("sti");
       }
+      return {0, 0};
+    }
 
-      switch(msg->type) {
-        case Message::kKeyPush:
-          if(msg->arg.keyboard.keycode == 20 /* Q key */ &&
-            msg->arg.keyboard.modifier & (kLControlBitMask | kRControlBitMask))
-          {
-            app_events[i].type = AppEvent::kQuit;
-            ++i;
+    bool IsUserRange(const void* p, size_t len) {
+      const auto addr = reinterpret_cast<uint64_t>(p);
+      return addr >= 0x8000'0000'0000'0000 && addr + len >= addr;
+    }
+
+    int BytesPerWinPixel(WinPixelFormat format) {
+      switch(format) {
+        case kWinPixelRGB:  return 3;
+        case kWinPixelRGBA: return 4;
+        case kWinPixelBGRX: return 4;
+      }
+      return -1;
+    }
+
+    // 1 行分の画素を 0xRRGGBB に変換する。単純なループにしてコンパイラにベクトル化させる
+    void ConvertRow(uint32_t* dst, const uint8_t* src, int n, WinPixelFormat format) {
+      switch(format) {
+        case kWinPixelRGB:
+          for(int i = 0; i < n; ++i) {
+            dst[i] = src[3 * i] << 16 | src[3 * i + 1] << 8 | src[3 * i + 2];
           }
-          else {
-            app_events[i].type = AppEvent::kKeyPush;
-            app_events[i].arg.keypush.modifier = msg->arg.keyboard.modifier;
-            app_events[i].arg.keypush.keycode = msg->arg.keyboard.keycode;
-            app_events[i].arg.keypush.ascii = msg->arg.keyboard.ascii;
-            app_events[i].arg.keypush.press = msg->arg.keyboard.press;
-            ++i;
+          break;
+        case kWinPixelRGBA:
+          for(int i = 0; i < n; ++i) {
+            dst[i] = src[4 * i] << 16 | src[4 * i + 1] << 8 | src[4 * i + 2];
           }
           break;
-
-        case Message::kMouseMove:
-          app_events[i].type = AppEvent::kMouseMove;
-          app_events[i].arg.mouse_move.x = msg->arg.mouse_move.x;
-          app_events[i].arg.mouse_move.y = msg->arg.mouse_move.y;
-          app_events[i].arg.mouse_move.dx = msg->arg.mouse_move.dx;
-          app_events[i].arg.mouse_move.dy = msg->arg.mouse_move.dy;
-          app_events[i].arg.mouse_move.buttons = msg->arg.mouse_move.buttons;
-          ++i;
+        case kWinPixelBGRX:
+          memcpy(dst, src, 4 * n); // アプリの配列は 4 バイト境界に揃っているとは限らない
+          for(int i = 0; i < n; ++i) {
+            dst[i] &= 0xffffff;
+          }
           break;
+      }
+    }
 
-        case Message::kMouseButton:
-          app_events[i].type = AppEvent::kMouseButton;
-          app_events[i].arg.mouse_button.x = msg->arg.mouse_button.x;
-          app_events[i].arg.mouse_button.y = msg->arg.mouse_button.y;
-          app_events[i].arg.mouse_button.press = msg->arg.mouse_button.press;
-          app_events[i].arg.mouse_button.button = msg->arg.mouse_button.button;
-          ++i;
-          break;
+    /**
+     * @brief 画素の配列をウィンドウの pos に描き、ウィンドウの範囲に切り詰めた描画範囲を返す
+     * @param color_key nullptr でなければ、この色（0xRRGGBB）の画素は書かない
+     */
+    Rectangle<int> Blit(Window& win, Rectangle<int> dest, const uint8_t* pixels, size_t stride,
+                        WinPixelFormat format, const uint32_t* color_key) {
+      const auto area = dest & Rectangle<int>{{0, 0}, win.Size()};
+      if(area.size.x <= 0 || area.size.y <= 0) {
+        return {{0, 0}, {0, 0}};
+      }
+
+      const int bpp = BytesPerWinPixel(format);
+      std::vector<uint32_t> row(area.size.x);
+      for(int y = area.pos.y; y < area.pos.y + area.size.y; ++y) {
+        const uint8_t* src = pixels + static_cast<size_t>(y - dest.pos.y) * stride
+                                    + static_cast<size_t>(area.pos.x - dest.pos.x) * bpp;
+        ConvertRow(row.data(), src, area.size.x, format);
+        if(color_key == nullptr) {
+          win.WriteRow({area.pos.x, y}, row.data(), area.size.x);
+          continue;
+        }
 
-        case Message::kTimerTimeout:
-          if(msg->arg.timer.value < 0) {
-            app_events[i].type = AppEvent::kTimerTimeout;
-            app_events[i].arg.timer.timeout = msg->arg.timer.timeout;
-            app_events[i].arg.timer.value = -msg->arg.timer.value; //アプリ用タイマーは負の値を使う
-            memcpy(app_events[i].arg.timer.description, msg->arg.timer.description, TIMER_DESC_LENGTH);
-            app_events[i].arg.timer.description[TIMER_DESC_LENGTH-1] = '\0';
+        // 透過色でない画素の並びごとにまとめて書く
+        int i = 0;
+        while(i < area.size.x) {
+          if(row[i] == *color_key) {
             ++i;
+            continue;
           }
+          int j = i + 1;
+          while(j < area.size.x && row[j] != *color_key) {
+            ++j;
+          }
+          win.WriteRow({area.pos.x + i, y}, &row[i], j - i);
+          i = j;
+        }
+      }
+      return area;
+    }
+
+    // コマンドの引数を検査する。描き始めてから失敗しないように、実行前に全部調べる
+    int ValidateWinCommand(const WinCommand& cmd) {
+      switch(cmd.type) {
+        case WinCommand::kFill:
+        case WinCommand::kLine:
+          return 0;
+        case WinCommand::kText:
+          return IsUserRange(cmd.arg.text.s, 1) ? 0 : EFAULT;
+        case WinCommand::kBlit: {
+          const auto& b = cmd.arg.blit;
+          if(b.w < 0 || b.h < 0 || b.stride < b.w) {
+            return EINVAL;
+          }
+          if(b.w == 0 || b.h == 0) {
+            return 0;
+          }
+          const size_t num_pixels = static_cast<size_t>(b.h - 1) * b.stride + b.w;
+          return IsUserRange(b.pixels, num_pixels * sizeof(uint32_t)) ? 0 : EFAULT;
+        }
+        default:
+          return EINVAL;
+      }
+    }
+
+    void ExecuteWinCommand(Window& win, ClippedWriter& writer, const WinCommand& cmd) {
+      const Rectangle<int> win_area{{0, 0}, win.Size()};
+      switch(cmd.type) {
+        case WinCommand::kFill: {
+          const auto area = Rectangle<int>{{cmd.x, cmd.y}, {cmd.arg.fill.w, cmd.arg.fill.h}} & win_area;
+          for(int y = area.pos.y; y < area.pos.y + area.size.y; ++y) {
+            FillSpan(win, {area.pos.x, y}, cmd.color, area.size.x);
+          }
+          writer.AddDamage(area);
+          break;
+        }
+        case WinCommand::kLine:
+          writer.AddDamage(DrawLine(win, {cmd.x, cmd.y}, {cmd.arg.line.x1, cmd.arg.line.y1}, cmd.color, false));
           break;
+        case WinCommand::kText:
+          WriteString(writer, {cmd.x, cmd.y}, cmd.arg.text.s, ToColor(cmd.color));
+          break;
+        case WinCommand::kBlit: {
+          const auto& b = cmd.arg.blit;
+          // 0xRRGGBB の uint32_t はバイト列として見れば B, G, R, X の順
+          writer.AddDamage(Blit(win, {{cmd.x, cmd.y}, {b.w, b.h}},
+                                reinterpret_cast<const uint8_t*>(b.pixels), b.stride * sizeof(uint32_t),
+                                kWinPixelBGRX, nullptr));
+          break;
+        }
+      }
+    }
+  } // namespace
 
-        case Message::kWindowClose:
-          app_events[i].type = AppEvent::kQuit;
-          ++i;
+  SYSCALL(WinDrawLine) {
+    const bool antialias = (arg1 >> 32) & 2;
+    const int x0 = arg2, y0 = arg3, x1 = arg4, y1 = arg5;
+    const uint32_t color = arg6;
+    return DoWinDraw(arg1, [=](Window& win) {
+      return DrawLine(win, {x0, y0}, {x1, y1}, color, antialias);
+    });
+  }
+
+  SYSCALL(WinDrawPolyline) {
+    const bool antialias = (arg1 >> 32) & 2;
+    const auto points = reinterpret_cast<const WinPoint*>(arg2);
+    const size_t num_points = arg3;
+    const uint32_t color = arg4;
+    if(num_points > SIZE_MAX / sizeof(WinPoint) || !IsUserRange(points, num_points * sizeof(WinPoint))) {
+      return {0, EFAULT};
+    }
+
+    return DoWinDraw(arg1, [=](Window& win) {
+      ClippedWriter damage{win};
+      if(num_points == 1) {
+        damage.AddDamage(DrawLine(win, {points[0].x, points[0].y}, {points[0].x, points[0].y}, color, antialias));
+      }
+      for(size_t i = 1; i < num_points; ++i) {
+        damage.AddDamage(DrawLine(win, {points[i - 1].x, points[i - 1].y}, {points[i].x, points[i].y},
+                                  color, antialias));
+      }
+      return damage.Damage();
+    });
+  }
+
+  SYSCALL(WinSubmit) {
+    const uint32_t layer_flags = arg1 >> 32;
+    const unsigned int layer_id = arg1 & 0xffffffff;
+    const auto cmds = reinterpret_cast<const WinCommand*>(arg2);
+    const size_t num_cmds = arg3;
+
+    if(num_cmds > SIZE_MAX / sizeof(WinCommand) || !IsUserRange(cmds, num_cmds * sizeof(WinCommand))) {
+      return {0, EFAULT};
+    }
+    for(size_t i = 0; i < num_cmds; ++i) {
+      if(const int err = ValidateWinCommand(cmds[i])) {
+        return {i, err};
+      }
+    }
+
+    __asm__("cli");
+    auto layer = layer_manager->FindLayer(layer_id);
+    __asm__("sti");
+    if(layer == nullptr) {
+      return {0, EBADF};
+    }
+
+    auto& win = *layer->GetWindow();
+    ClippedWriter writer{win};
+    for(size_t i = 0; i < num_cmds; ++i) {
+      ExecuteWinCommand(win, writer, cmds[i]);
+    }
+
+    // 描いた範囲だけを 1 回で画面に反映する
+    if((layer_flags & 1) == 0 && writer.Damage().size.x > 0) {
+      __asm__("cli");
+      layer_manager->Draw(layer_id, writer.Damage());
+      __asm__("sti");
+    }
+    return {num_cmds, 0};
+  }
+
+  SYSCALL(WinBlit) {
+    const int x = arg2, y = arg3, w = arg4, h = arg5;
+    const auto src = reinterpret_cast<const WinBlitSource*>(arg6);
+
+    if(!IsUserRange(src, sizeof(WinBlitSource))) {
+      return {0, EFAULT};
+    }
+    const int bpp = BytesPerWinPixel(src->format);
+    if(bpp < 0 || w < 0 || h < 0 || src->stride < static_cast<int64_t>(w) * bpp) {
+      return {0, EINVAL};
+    }
+    if(w == 0 || h == 0) {
+      return {0, 0};
+    }
+    const size_t num_bytes = static_cast<size_t>(h - 1) * src->stride + static_cast<size_t>(w) * bpp;
+    if(!IsUserRange(src->pixels, num_bytes)) {
+      return {0, EFAULT};
+    }
+
+    return DoWinDraw(arg1, [=](Window& win) {
+      return Blit(win, {{x, y}, {w, h}}, reinterpret_cast<const uint8_t*>(src->pixels), src->stride,
+                  src->format, src->use_color_key ? &src->color_key : nullptr);
+    });
+  }
+
+  namespace {
+    // 溜まっているイベントを最大 len 個まで取り出す。1 つもなければ最初の 1 つまで待つ。
+    // timeout_ms が負なら届くまで待ち、0 なら待たない
+    Result ReadEvents(uint64_t events_arg, size_t len, long timeout_ms) {
+      // 使っているのは仮想アドレス空間の後半部分のはず
+      if(events_arg < 0x8000'0000'0000'0000) {
+        return {0, EFAULT};
+      }
+      const auto app_events = reinterpret_cast<AppEvent*>(events_arg);
+
+      auto& task = ThisTask();
+
+      unsigned long deadline = 0;
+      if(timeout_ms > 0) {
+        deadline = timer_manager->CurrentTick() + timeout_ms * (kTimerFreq / 1000);
+        __asm__("cli");
+        timer_manager->AddTimer(Timer{deadline, kWakeupTimerValue, task.ID(), "ReadEvent"});
+        __asm__("sti");
+      }
+
+      size_t i = 0;
+      while(i < len) {
+        __asm__("cli");
+        auto msg = task.ReceiveMessage();
+        if(!msg && i == 0 &&
+           (timeout_ms < 0 || (timeout_ms > 0 && timer_manager->CurrentTick() < deadline))) {
+          task.Sleep();
+          continue;
+        }
+        __asm__("sti");
+
+        if(!msg){
           break;
+        }
 
-        default:
+        // マウスの移動は Task::SendMessage でまとめられている
+        if(ToAppEvent(*msg, app_events[i])) {
+          ++i;
+        }
+        else if(msg->type != Message::kTimerTimeout) {
           Log(kInfo, "uncaught event type: %u\n", msg->type);
+        }
       }
+
+      return {i, 0};
     }
+  } // namespace
+
+  SYSCALL(ReadEvent) {
+    return ReadEvents(arg1, arg2, -1);
+  }
 
-    return {i, 0};
+  SYSCALL(ReadEventTimeout) {
+    return ReadEvents(arg1, arg2, static_cast<long>(arg3));
   }
 
   SYSCALL(CreateTimer) {
@@ -304,11 +680,11 @@ namespace syscall {
       return {0, EINVAL};
     }
 
-    __asm__("cli");
-    const uint64_t task_id = task_manager->CurrentTask().ID();
-    __asm__("sti");
+    const uint64_t task_id = ThisTask().ID();
 
-    unsigned long timeout = arg3 * kTimerFreq / 1000;
+    // mode の bit1 が立っていればマイクロ秒単位、そうでなければミリ秒単位
+    const unsigned long unit_per_sec = (mode & 2) ? 1000000 : 1000;
+    unsigned long timeout = arg3 * (kTimerFreq / unit_per_sec);
     if(mode & 1) { // relative
       timeout += timer_manager->CurrentTick();
     }
@@ -316,7 +692,7 @@ namespace syscall {
     __asm__("cli");
     timer_manager->AddTimer(Timer{timeout, -timer_value, task_id, "Syscall"});
     __asm__("sti");
-    return {timeout * 1000 / kTimerFreq, 0};
+    return {timeout / (kTimerFreq / unit_per_sec), 0};
   }
 
   namespace {
@@ -332,13 +708,28 @@ namespace syscall {
       return num_files;
     }
 
+    int ErrnoFromError(const Error& err) {
+      switch(err.Cause()){
+        case Error::kSuccess: return 0;
+        case Error::kIsDirectory: return EISDIR;
+        case Error::kNoSuchEntry: return ENOENT;
+        case Error::kNoEnoughMemory: return ENOSPC;
+        case Error::kAlreadyExists: return EEXIST;
+        case Error::kNotEmpty: return ENOTEMPTY;
+        case Error::kBusy: return EBUSY;
+        default: return EINVAL;
+      }
+    }
+
     std::pair<fat::DirectoryEntry*, int> CreateFile(const char* path) {
       auto [file, err] = fat::CreateFile(path);
-      switch(err.Cause()){
-        case Error::kIsDirectory: return {file, EISDIR};
-        case Error::kNoSuchEntry: return {file, ENOENT};
-        case Error::kNoEnoughMemory: return {file, ENOSPC};
-        default: return {file, 0};
+      return {file, ErrnoFromError(err)};
+    }
+
+    // 読み込み済みのアプリの情報はエントリのアドレスで引いているので、消す・動かす前に忘れさせる
+    void ForgetAppLoad(const char* path) {
+      if(auto [entry, post_slash] = fat::FindFile(path); entry) {
+        app_loads->erase(entry);
       }
     }
 
@@ -347,9 +738,7 @@ namespace syscall {
   SYSCALL(OpenFile) {
     const char* path = reinterpret_cast<const char*>(arg1);
     const int flags = arg2;
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = ThisTask();
 
     if(strcmp(path, "@stdin") == 0) {
       return {0,0};
@@ -373,6 +762,10 @@ namespace syscall {
 
     size_t fd = AllocateFD(task);
     task.Files()[fd] = std::make_unique<fat::FileDescriptor>(*file);
+    if((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY &&
+       file->attr != fat::Attribute::kDirectory) {
+      task.Files()[fd]->Truncate(0);
+    }
     return {fd, 0};
   }
 
@@ -380,22 +773,134 @@ namespace syscall {
     const int fd = arg1;
     void* buf = reinterpret_cast<void*>(arg2);
     size_t count = arg3;
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = ThisTask();
+
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
+      return {0, EBADF};
+    }
+    return {desc->Read(buf, count), 0};
+  }
+
+  SYSCALL(WriteFile) {
+    const int fd = arg1;
+    const void* buf = reinterpret_cast<const void*>(arg2);
+    const size_t count = arg3;
+    if(!IsUserRange(buf, count)) {
+      return {0, EFAULT};
+    }
+    auto& task = ThisTask();
+
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
+      return {0, EBADF};
+    }
+    return {desc->Write(buf, count), 0};
+  }
+
+  namespace {
+    // ReadV / WriteV の共通部分。バッファを順に処理し、足りなかったところで止める
+    template <class Func>
+    Result DoVectoredIO(uint64_t fd_arg, uint64_t iov_arg, uint64_t iovcnt, Func f) {
+      const int fd = fd_arg;
+      const auto iov = reinterpret_cast<const IoVec*>(iov_arg);
+      if(iovcnt > SIZE_MAX / sizeof(IoVec) || !IsUserRange(iov, iovcnt * sizeof(IoVec))) {
+        return {0, EFAULT};
+      }
+      for(size_t i = 0; i < iovcnt; ++i) {
+        if(!IsUserRange(iov[i].base, iov[i].len)) {
+          return {0, EFAULT};
+        }
+      }
+      auto& task = ThisTask();
+
+      auto desc = task.LookupFD(fd);
+      if(desc == nullptr) {
+        return {0, EBADF};
+      }
+      auto& file = *desc;
+      size_t total = 0;
+      for(size_t i = 0; i < iovcnt; ++i) {
+        const size_t n = f(file, iov[i]);
+        total += n;
+        if(n < iov[i].len) {
+          break;
+        }
+      }
+      return {total, 0};
+    }
+  } // namespace
+
+  SYSCALL(ReadV) {
+    return DoVectoredIO(arg1, arg2, arg3, [](::FileDescriptor& file, const IoVec& v) {
+      return file.Read(v.base, v.len);
+    });
+  }
+
+  SYSCALL(WriteV) {
+    return DoVectoredIO(arg1, arg2, arg3, [](::FileDescriptor& file, const IoVec& v) {
+      return file.Write(v.base, v.len);
+    });
+  }
+
+  SYSCALL(PRead) {
+    const int fd = arg1;
+    void* buf = reinterpret_cast<void*>(arg2);
+    const size_t count = arg3;
+    const size_t offset = arg4;
+    if(!IsUserRange(buf, count)) {
+      return {0, EFAULT};
+    }
+    auto& task = ThisTask();
 
-    if(fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
       return {0, EBADF};
     }
-    return {task.Files()[fd]->Read(buf, count), 0};
+    // 位置を持たない記述子（パイプ、端末）では 0 になる
+    return {desc->Load(buf, count, offset), 0};
+  }
+
+  SYSCALL(PWrite) {
+    const int fd = arg1;
+    const void* buf = reinterpret_cast<const void*>(arg2);
+    const size_t count = arg3;
+    const size_t offset = arg4;
+    if(!IsUserRange(buf, count)) {
+      return {0, EFAULT};
+    }
+    auto& task = ThisTask();
+
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
+      return {0, EBADF};
+    }
+    auto [written, err] = desc->Store(buf, count, offset);
+    if(err.Cause() == Error::kNotImplemented) {
+      return {0, ESPIPE};
+    }
+    return {written, err ? ErrnoFromError(err) : 0};
+  }
+
+  SYSCALL(Splice) {
+    const int fd_in = arg1, fd_out = arg2;
+    const size_t len = arg3;
+    auto& task = ThisTask();
+
+    auto in = task.LookupFD(fd_in);
+    auto out = task.LookupFD(fd_out);
+    if(in == nullptr || out == nullptr) {
+      return {0, EBADF};
+    }
+    // アプリのバッファを経由せずにカーネル内で移す
+    auto [n, err] = out->SpliceFrom(*in, len);
+    return {n, err ? ErrnoFromError(err) : 0};
   }
 
   SYSCALL(DemandPages) {
     const size_t num_pages = arg1;
     // const int flags = arg2;
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = ThisTask();
 
     //実際にメモリを確保するとかはせず範囲だけ拡張する
     //物理フレームはページフォルト発生時に割り当てられる
@@ -408,15 +913,14 @@ namespace syscall {
     const int fd = arg1;
     size_t* file_size = reinterpret_cast<size_t*>(arg2);
     // const int flags = arg3;
-    __asm__("cli");
-    auto& task = task_manager->CurrentTask();
-    __asm__("sti");
+    auto& task = ThisTask();
 
-    if(fd < 0 || task.Files().size() <= fd || !task.Files()[fd]) {
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
       return {0, EBADF};
     }
 
-    *file_size = task.Files()[fd]->Size();
+    *file_size = desc->Size();
     const uint64_t vaddr_end = task.FileMapEnd();
     const uint64_t vaddr_begin = (vaddr_end - *file_size) & 0xffff'ffff'ffff'f000;
     task.SetFileMapEnd(vaddr_begin);
@@ -424,12 +928,197 @@ namespace syscall {
     return {vaddr_begin, 0};
   }
 
+  SYSCALL(MakeDirectory) {
+    const char* path = reinterpret_cast<const char*>(arg1);
+    // const int mode = arg2;
+    auto [dir, err] = fat::MakeDirectory(path);
+    return {0, ErrnoFromError(err)};
+  }
+
+  SYSCALL(Unlink) {
+    const char* path = reinterpret_cast<const char*>(arg1);
+    ForgetAppLoad(path);
+    return {0, ErrnoFromError(fat::Remove(path))};
+  }
+
+  SYSCALL(Rename) {
+    const char* old_path = reinterpret_cast<const char*>(arg1);
+    const char* new_path = reinterpret_cast<const char*>(arg2);
+    ForgetAppLoad(old_path);
+    ForgetAppLoad(new_path);
+    return {0, ErrnoFromError(fat::Rename(old_path, new_path))};
+  }
+
+  SYSCALL(TruncateFile) {
+    const int fd = arg1;
+    const size_t length = arg2;
+    auto& task = ThisTask();
+
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
+      return {0, EBADF};
+    }
+    return {0, ErrnoFromError(desc->Truncate(length))};
+  }
+
+  SYSCALL(SeekFile) {
+    const int fd = arg1;
+    const long offset = arg2;
+    const int whence = arg3;
+    auto& task = ThisTask();
+
+    auto desc = task.LookupFD(fd);
+    if(desc == nullptr) {
+      return {0, EBADF};
+    }
+    auto [pos, err] = desc->Seek(offset, whence);
+    return {pos, ErrnoFromError(err)};
+  }
+
+  SYSCALL(CloseFile) {
+    const int fd = arg1;
+    auto& task = ThisTask();
+
+    if(task.LookupFD(fd) == nullptr) {
+      return {0, EBADF};
+    }
+    // マップしているファイルはページフォルトのたびに読むので、アプリの終了まで残しておく
+    for(const auto& m : task.FileMaps()) {
+      if(m.fd == fd) {
+        return {0, 0};
+      }
+    }
+    task.Files()[fd].reset();
+    return {0, 0};
+  }
+
+  namespace {
+    // frames をアプリの仮想アドレス空間の末尾側にマップし、先頭のアドレスを返す。
+    // 途中で失敗したら、それまでにマップしたページも外す（frames の参照が残らないので）
+    WithError<uint64_t> MapSharedFrames(Task& task, const SharedFrames& frames) {
+      const uint64_t vaddr_begin = task.FileMapEnd() - frames.NumFrames() * kBytesPerFrame;
+      for(size_t i = 0; i < frames.NumFrames(); ++i) {
+        const LinearAddress4Level addr{vaddr_begin + i * kBytesPerFrame};
+        if(auto err = MapSharedPage(addr, frames.Data() + i * kBytesPerFrame, true)) {
+          UnmapSharedPages(LinearAddress4Level{vaddr_begin}, i);
+          return {0, err};
+        }
+      }
+      task.SetFileMapEnd(vaddr_begin);
+      return {vaddr_begin, MAKE_ERROR(Error::kSuccess)};
+    }
+  } // namespace
+
+  SYSCALL(WinMapSurface) {
+    const unsigned int layer_id = arg1 & 0xffffffff;
+    const auto surface = reinterpret_cast<WinSurface*>(arg2);
+    if(!IsUserRange(surface, sizeof(WinSurface))) {
+      return {0, EFAULT};
+    }
+
+    auto& task = ThisTask();
+    __asm__("cli");
+    auto layer = layer_manager->FindLayer(layer_id);
+    __asm__("sti");
+    if(layer == nullptr) {
+      return {0, EBADF};
+    }
+
+    auto& win = *layer->GetWindow();
+    auto [frames, err] = win.ShareShadowBuffer();
+    if(err) {
+      return {0, ErrnoFromError(err)};
+    }
+
+    // ファイルのマップと同じく、仮想アドレス空間の末尾側から場所を取る
+    auto [vaddr_begin, err_map] = MapSharedFrames(task, *frames);
+    if(err_map) {
+      return {0, ErrnoFromError(err_map)};
+    }
+    // ウィンドウが先に閉じられても、アプリが終わるまではフレームを解放しない
+    task.SharedMemories().push_back(frames);
+
+    const auto& config = win.ShadowConfig();
+    surface->pixels = reinterpret_cast<uint32_t*>(vaddr_begin);
+    surface->width = win.Width();
+    surface->height = win.Height();
+    surface->stride = config.pixels_per_scan_line;
+    surface->format = config.pixel_format;
+    return {vaddr_begin, 0};
+  }
+
+  SYSCALL(WinPresent) {
+    const unsigned int layer_id = arg1 & 0xffffffff;
+    const int x = arg2, y = arg3, w = arg4, h = arg5;
+    if(w < 0 || h < 0) {
+      return {0, EINVAL};
+    }
+
+    __asm__("cli");
+    auto layer = layer_manager->FindLayer(layer_id);
+    __asm__("sti");
+    if(layer == nullptr) {
+      return {0, EBADF};
+    }
+
+    // 画素はもう書かれているので、指定された範囲を画面に反映するだけ
+    const Rectangle<int> win_area{{0, 0}, layer->GetWindow()->Size()};
+    const auto area = Rectangle<int>{{x, y}, {w, h}} & win_area;
+    if(area.size.x > 0 && area.size.y > 0) {
+      __asm__("cli");
+      layer_manager->Draw(layer_id, area);
+      __asm__("sti");
+    }
+    return {0, 0};
+  }
+
+  SYSCALL(IoRingSetup) {
+    const uint32_t entries = arg1;
+    if(entries == 0 || entries > IoRing::kMaxEntries) {
+      return {0, EINVAL};
+    }
+    auto& task = ThisTask();
+    if(task.IoRingState()) {
+      return {0, EBUSY};
+    }
+
+    auto [ring, err] = IoRing::Create(entries);
+    if(err) {
+      return {0, ErrnoFromError(err)};
+    }
+    const auto& frames = ring->Frames();
+    auto [vaddr_begin, err_map] = MapSharedFrames(task, *frames);
+    if(err_map) {
+      return {0, ErrnoFromError(err_map)};
+    }
+    task.SharedMemories().push_back(frames);
+    task.IoRingState() = ring;
+    return {vaddr_begin, 0};
+  }
+
+  SYSCALL(IoRingEnter) {
+    const size_t min_complete = arg1;
+    auto& task = ThisTask();
+    // アプリが終わるまで SQ / CQ は残るが、念のため待っている間も参照を持っておく
+    const auto ring = task.IoRingState();
+    if(!ring) {
+      return {0, EBADF};
+    }
+
+    auto [submitted, err] = ring->Submit(task);
+    if(err) {
+      return {0, EINVAL};
+    }
+    ring->Wait(task, min_complete);
+    return {submitted, 0};
+  }
+
   #undef SYSCALL
 
 } //namespace syscall
 
 using SyscallFuncType = syscall::Result (uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-extern "C" std::array<SyscallFuncType*, 0x10> syscall_table{
+extern "C" std::array<SyscallFuncType*, 0x24> syscall_table{
   /* 0x00 */ syscall::LogString,
   /* 0x01 */ syscall::PutString,
   /* 0x02 */ syscall::Exit,
@@ -446,7 +1135,105 @@ extern "C" std::array<SyscallFuncType*, 0x10> syscall_table{
   /* 0x0d */ syscall::ReadFile,
   /* 0x0e */ syscall::DemandPages,
   /* 0x0f */ syscall::MapFile,
+  /* 0x10 */ syscall::MakeDirectory,
+  /* 0x11 */ syscall::Unlink,
+  /* 0x12 */ syscall::Rename,
+  /* 0x13 */ syscall::TruncateFile,
+  /* 0x14 */ syscall::SeekFile,
+  /* 0x15 */ syscall::CloseFile,
+  /* 0x16 */ syscall::WinSubmit,
+  /* 0x17 */ syscall::WinMapSurface,
+  /* 0x18 */ syscall::WinPresent,
+  /* 0x19 */ syscall::WinBlit,
+  /* 0x1a */ syscall::WinDrawPolyline,
+  /* 0x1b */ syscall::WriteFile,
+  /* 0x1c */ syscall::ReadV,
+  /* 0x1d */ syscall::WriteV,
+  /* 0x1e */ syscall::PRead,
+  /* 0x1f */ syscall::PWrite,
+  /* 0x20 */ syscall::Splice,
+  /* 0x21 */ syscall::IoRingSetup,
+  /* 0x22 */ syscall::IoRingEnter,
+  /* 0x23 */ syscall::ReadEventTimeout,
 };
+// SyscallEntry はこれ以上の番号を表から引かない。表を伸ばせば自動的に増える
+extern "C" const uint32_t syscall_table_size = syscall_table.size();
+
+namespace {
+  const std::array<const char*, syscall_table.size()> syscall_names{
+    /* 0x00 */ "LogString",
+    /* 0x01 */ "PutString",
+    /* 0x02 */ "Exit",
+    /* 0x03 */ "OpenWindow",
+    /* 0x04 */ "WinWriteString",
+    /* 0x05 */ "WinFillRectangle",
+    /* 0x06 */ "GetCurrentTick",
+    /* 0x07 */ "WinRedraw",
+    /* 0x08 */ "WinDrawLine",
+    /* 0x09 */ "CloseWindow",
+    /* 0x0a */ "ReadEvent",
+    /* 0x0b */ "CreateTimer",
+    /* 0x0c */ "OpenFile",
+    /* 0x0d */ "ReadFile",
+    /* 0x0e */ "DemandPages",
+    /* 0x0f */ "MapFile",
+    /* 0x10 */ "MakeDirectory",
+    /* 0x11 */ "Unlink",
+    /* 0x12 */ "Rename",
+    /* 0x13 */ "TruncateFile",
+    /* 0x14 */ "SeekFile",
+    /* 0x15 */ "CloseFile",
+    /* 0x16 */ "WinSubmit",
+    /* 0x17 */ "WinMapSurface",
+    /* 0x18 */ "WinPresent",
+    /* 0x19 */ "WinBlit",
+    /* 0x1a */ "WinDrawPolyline",
+    /* 0x1b */ "WriteFile",
+    /* 0x1c */ "ReadV",
+    /* 0x1d */ "WriteV",
+    /* 0x1e */ "PRead",
+    /* 0x1f */ "PWrite",
+    /* 0x20 */ "Splice",
+    /* 0x21 */ "IoRingSetup",
+    /* 0x22 */ "IoRingEnter",
+    /* 0x23 */ "ReadEventTimeout",
+  };
+
+  struct Counter {
+    uint64_t count, cycles;
+  };
+  std::array<Counter, syscall_table.size()> syscall_counters{};
+}
+
+// SyscallEntry から、システムコールが戻るたびに呼ばれる
+extern "C" void SyscallAccount(uint64_t num, uint64_t start_tsc) {
+  // 割り込まれても数え損なわないよう、読んで足して書くのを 1 命令で行う
+  __atomic_fetch_add(&syscall_counters[num].count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&syscall_counters[num].cycles, ReadTSC() - start_tsc, __ATOMIC_RELAXED);
+}
+
+// SyscallEntry から、表にない番号で呼ばれる
+extern "C" syscall::Result SyscallNotFound() {
+  return {0, ENOSYS};
+}
+
+std::vector<SyscallStat> SyscallStats() {
+  std::vector<SyscallStat> stats;
+  for(size_t i = 0; i < syscall_table.size(); ++i) {
+    const auto& c = syscall_counters[i];
+    if(c.count > 0) {
+      stats.push_back({syscall_names[i], c.count, c.cycles});
+    }
+  }
+  return stats;
+}
+
+void ResetSyscallStats() {
+  for(auto& c : syscall_counters) {
+    __atomic_store_n(&c.count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c.cycles, 0, __ATOMIC_RELAXED);
+  }
+}
 
 void InitializeSyscall(){
   WriteMSR(kIA32_EFER, 0x0501u);
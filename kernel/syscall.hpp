@@ -4,4 +4,17 @@
 
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
+// システムコールごとの呼び出し回数と、かかった TSC のサイクル数（眠って待っていた間も含む）
+struct SyscallStat {
+  const char* name;
+  uint64_t count;
+  uint64_t cycles;
+};
+
 void InitializeSyscall();
+// 1 回以上呼ばれたものだけを番号順に返す
+std::vector<SyscallStat> SyscallStats();
+void ResetSyscallStats();
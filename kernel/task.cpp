@@ -2,22 +2,23 @@
 #include "timer.hpp"
 #include "asmfunc.h"
 #include "segment.hpp"
+#include "fpu.hpp"
+
+#include <cstddef>
 
 
 TaskManager* task_manager;
+CPULocal cpu_local;
 
 void InitializeTask(){
+  // タイムスライス用タイマは実行可能なタスクが同じレベルに複数あるときだけ動かす
   task_manager = new TaskManager;
-
-  __asm__("cli");
-  timer_manager->AddTimer(Timer{timer_manager->CurrentTick() + kTaskTimerPeriod, kTaskTimerValue, 1, kTaskDescription});
-  __asm__("sti");
 }
 
 // この attribute の説明は　p534 を参照
 __attribute__((no_caller_saved_registers))
 extern "C" uint64_t GetCurrentTaskOSStackPointer() {
-  return task_manager->CurrentTask().OSStackPointer();
+  return ThisTask().OSStackPointer();
 }
 
 
@@ -25,8 +26,10 @@ extern "C" uint64_t GetCurrentTaskOSStackPointer() {
  * Task
  */
 Task::Task(uint64_t id)
-  : id_{id}
+  : id_{id}, fpu_buf_(FPUStateBytes() + 63)
 {
+  fpu_state_ = reinterpret_cast<uint8_t*>(
+    (reinterpret_cast<uintptr_t>(fpu_buf_.data()) + 63) & ~static_cast<uintptr_t>(63));
 }
 
 Task& Task::InitContext(TaskFunc* f, int64_t data){
@@ -45,10 +48,8 @@ Task& Task::InitContext(TaskFunc* f, int64_t data){
   context_.ss = kKernelSS;
   context_.rsp = (stack_end & ~0xflu) - 8; //スタック（8だけずらす意味は p321 を参照）
 
-  // MXCSR のすべての例外をマスクする
-  // fxsave_area 24~27 は MXCSR レジスタに対応する。
-  // ビット12:7が全て1になっていないとなので、0b1111110000000（0x1f80）に設定する。
-  *reinterpret_cast<uint32_t*>(&context_.fxsave_area[24]) = 0x1f80;
+  // FPU の状態は初めて FPU を使ったとき（#NM）に読み込まれる
+  InitFPUState(fpu_state_);
 
   return *this;
 }
@@ -76,6 +77,19 @@ Task& Task::Wakeup(){
 }
 
 void Task::SendMessage(const Message& msg){
+  // まだ読まれていないマウスの移動の後ろにさらに移動が来たら、移動量を足して位置を新しくする。
+  // 間にほかのメッセージやボタンの変化があればまとめない
+  if(msg.type == Message::kMouseMove && !msgs_.empty()) {
+    auto& last = msgs_.back();
+    if(last.type == Message::kMouseMove &&
+       last.arg.mouse_move.buttons == msg.arg.mouse_move.buttons) {
+      last.arg.mouse_move.x = msg.arg.mouse_move.x;
+      last.arg.mouse_move.y = msg.arg.mouse_move.y;
+      last.arg.mouse_move.dx += msg.arg.mouse_move.dx;
+      last.arg.mouse_move.dy += msg.arg.mouse_move.dy;
+      return; // 先に積んだときに起こしてある
+    }
+  }
   msgs_.push_back(msg);
   Wakeup();
 }
@@ -94,6 +108,13 @@ std::vector<std::shared_ptr<::FileDescriptor>>& Task::Files(){
   return files_;
 }
 
+::FileDescriptor* Task::LookupFD(int64_t fd){
+  if(fd < 0 || files_.size() <= static_cast<uint64_t>(fd)) {
+    return nullptr;
+  }
+  return files_[fd].get();
+}
+
 uint64_t Task::DPagingBegin() const {
   return dpaging_begin_;
 }
@@ -144,7 +165,11 @@ TaskManager::TaskManager(){
   Task& task = NewTask()
     .SetLevel(current_level_)
     .SetRunning(true);
+  task.exec_start_ = CurrentNanoseconds();
   running_[current_level_].push_back(&task);
+  // ここまでのカーネルの実行で FPU レジスタはメインタスクのものになっている
+  fpu_owner_state = task.fpu_state_;
+  _UpdateCPULocal();
 
   // アイドルタスク登録
   Task& idle = NewTask()
@@ -161,9 +186,12 @@ Task& TaskManager::NewTask(){
 
 void TaskManager::SwitchTask(const TaskContext& current_ctx){
   TaskContext& task_ctx = task_manager->CurrentTask().Context();
-  memcpy(&task_ctx, &current_ctx, sizeof(TaskContext));
+  memcpy(&task_ctx, &current_ctx, offsetof(TaskContext, fxsave_area));
   Task* current_task = _RotateCurrentRunQueue(false);
   if(&CurrentTask() != current_task) {
+    // 割り込み処理で壊した FPU レジスタを戻しておけば、持ち主はそのままでよい
+    RestoreInterruptedFPU(current_ctx.fxsave_area.data());
+    _UpdateCPULocal();
     RestoreContext(&CurrentTask().Context());
   }
 }
@@ -178,12 +206,21 @@ void TaskManager::Sleep(Task* task){
   //現在実行中のタスクならタスクを切り替える
   if(task == running_[current_level_].front()){
     Task* current_task = _RotateCurrentRunQueue(true);
+    _UpdateCPULocal();
     SwitchContext(&CurrentTask().Context(), &current_task->Context());
     return;
   }
 
   Erase(running_[task->Level()], task);
 }
+void TaskManager::Yield(){
+  Task* current_task = _RotateCurrentRunQueue(false);
+  if(&CurrentTask() != current_task) {
+    _UpdateCPULocal();
+    SwitchContext(&CurrentTask().Context(), &current_task->Context());
+  }
+}
+
 Error TaskManager::Sleep(uint64_t id){
   auto it = std::find_if(tasks_.begin(), tasks_.end(), [id](const auto& t){ return t->ID() == id; });
   if(it == tasks_.end()){
@@ -209,9 +246,40 @@ void TaskManager::Wakeup(Task* task, int level){
   task->SetLevel(level);
   task->SetRunning(true);
 
-  running_[level].push_back(task);
+  auto& level_queue = running_[level];
+  const bool is_current_level = level == current_level_;
+  Task* current_task = is_current_level ? level_queue.front() : nullptr;
+
+  if(task->IsFair() && !level_queue.empty()) {
+    // 眠っていた間の vruntime を丸ごと持ち越すと他を独占するので、
+    // レベル内の最小値から latency の半分までの貸しに留める（対話的なタスクほど早く動ける）
+    uint64_t min_vruntime = std::numeric_limits<uint64_t>::max();
+    for(auto t : level_queue) {
+      min_vruntime = std::min(min_vruntime, t->vruntime_);
+    }
+    const uint64_t credit = fair_latency_ / 2;
+    if(min_vruntime > credit) {
+      task->vruntime_ = std::max(task->vruntime_, min_vruntime - credit);
+    }
+  }
+
+  _Enqueue(task, is_current_level);
   if(level > current_level_){
     is_level_changed_ = true;
+    _RequestTaskSwitch();
+  }
+  else if(is_current_level) {
+    if(task->IsFair() && current_task->IsFair()) {
+      _AccountRuntime(current_task, CurrentNanoseconds());
+      if(task->vruntime_ + kFairMinGranularity < current_task->vruntime_) {
+        // 起こしたタスクの方が十分に遅れているので横取りさせる
+        _RequestTaskSwitch();
+        return;
+      }
+    }
+    if(!timer_manager->IsTaskTimerActive()) {
+      timer_manager->SetTaskTimer(timer_manager->CurrentTick() + _TimeSlice(current_task) / 1000);
+    }
   }
   return;
 }
@@ -247,6 +315,10 @@ void TaskManager::Finish(int exit_code) {
     tasks_.begin(), tasks_.end(),
     [current_task](const auto& t) {return t.get() == current_task;}
   );
+  if(fpu_owner_state == current_task->fpu_state_) {
+    fpu_owner_state = nullptr;
+    _UpdateFPUTrap();
+  }
   tasks_.erase(it);
 
   finish_tasks_[task_id] = exit_code;
@@ -256,6 +328,7 @@ void TaskManager::Finish(int exit_code) {
     Wakeup(waiter);
   }
 
+  _UpdateCPULocal();
   RestoreContext(&CurrentTask().Context());
 }
 
@@ -282,11 +355,12 @@ void TaskManager::_ChangeLevelRunning(Task* task, int level){
   // 別のタスクのレベルを変更する
   if(task != running_[current_level_].front()) {
     Erase(running_[task->Level()], task);
-    running_[level].push_back(task);
     task->SetLevel(level);
+    _Enqueue(task, level == current_level_);
     if(level > current_level_) {
       // 現在のレベルより高いので見直しが必要
       is_level_changed_ = true;
+      _RequestTaskSwitch();
     }
     return;
   }
@@ -301,15 +375,23 @@ void TaskManager::_ChangeLevelRunning(Task* task, int level){
   else {
     current_level_ = level;
     is_level_changed_ = true; //実行レベルが下がったのでより優先度の高いタスクに切り替える
+    _RequestTaskSwitch();
   }
 }
 
+void TaskManager::_RequestTaskSwitch() {
+  // 直ちにタイマ割り込みを発生させ、割り込みハンドラでタスクを切り替える
+  timer_manager->SetTaskTimer(timer_manager->CurrentTick());
+}
+
 Task* TaskManager::_RotateCurrentRunQueue(bool current_sleep) {
+  const uint64_t now = CurrentNanoseconds();
   auto& level_queue = running_[current_level_];
   Task* current_task = level_queue.front();
+  _AccountRuntime(current_task, now);
   level_queue.pop_front();
   if (!current_sleep) {
-    level_queue.push_back(current_task);
+    _Enqueue(current_task, false);
   }
   if (level_queue.empty()) {
     is_level_changed_ = true;
@@ -325,5 +407,105 @@ Task* TaskManager::_RotateCurrentRunQueue(bool current_sleep) {
     }
   }
 
+  Task* next_task = running_[current_level_].front();
+  next_task->exec_start_ = now;
+  _UpdateFPUTrap();
+
+  // 同じレベルに切り替え先が居るときだけタイムスライスを計る（居なければ割り込みを止める）
+  if(running_[current_level_].size() > 1) {
+    timer_manager->SetTaskTimer(timer_manager->CurrentTick() + _TimeSlice(next_task) / 1000);
+  }
+  else {
+    timer_manager->SetTaskTimer(0);
+  }
+
   return current_task;
 }
+
+void TaskManager::_UpdateFPUTrap() {
+  // 次に動くタスクが FPU の持ち主でなければ、FPU を使った時点で #NM を起こさせる
+  const uint64_t cr0 = GetCR0();
+  if(running_[current_level_].front()->fpu_state_ == fpu_owner_state) {
+    SetCR0(cr0 & ~kCR0TaskSwitched);
+  }
+  else {
+    SetCR0(cr0 | kCR0TaskSwitched);
+  }
+}
+
+void TaskManager::_UpdateCPULocal() {
+  Task& task = CurrentTask();
+  cpu_local.current_task = &task;
+  cpu_local.fpu_state = task.fpu_state_;
+}
+
+void TaskManager::_Enqueue(Task* task, bool front_is_running) {
+  auto& level_queue = running_[task->Level()];
+  if(!task->IsFair()) {
+    level_queue.push_back(task);
+    return;
+  }
+
+  // vruntime の昇順に並ぶよう挿入する（同じ値なら後ろへ）。実行中の先頭タスクは動かさない
+  auto begin = level_queue.begin();
+  if(front_is_running && begin != level_queue.end()) {
+    ++begin;
+  }
+  auto pos = std::find_if(begin, level_queue.end(),
+    [task](const Task* t) { return t->vruntime_ > task->vruntime_; });
+  level_queue.insert(pos, task);
+}
+
+void TaskManager::_AccountRuntime(Task* task, uint64_t now) {
+  const uint64_t delta = now - task->exec_start_;
+  task->cpu_time_ += delta;
+  task->vruntime_ += delta;
+  task->exec_start_ = now;
+}
+
+uint64_t TaskManager::_TimeSlice(const Task* task) const {
+  if(!task->IsFair()) {
+    return static_cast<uint64_t>(kTaskTimerPeriod) * (1'000'000'000 / kTimerFreq);
+  }
+  const uint64_t num_tasks = running_[task->Level()].size();
+  return std::max(fair_latency_ / num_tasks, kFairMinGranularity);
+}
+
+Error TaskManager::SetSchedClass(uint64_t id, Task::SchedClass sched_class) {
+  auto it = std::find_if(tasks_.begin(), tasks_.end(), [id](const auto& t){ return t->ID() == id; });
+  if(it == tasks_.end()){
+    return MAKE_ERROR(Error::kNoSuchTask);
+  }
+
+  Task* task = it->get();
+  if(task->sched_class_ == sched_class) {
+    return MAKE_ERROR(Error::kSuccess);
+  }
+  task->sched_class_ = sched_class;
+
+  if(task->IsRunning() && task != running_[current_level_].front()) {
+    // 並び順の規則が変わるので入れ直す
+    Erase(running_[task->Level()], task);
+    _Enqueue(task, task->Level() == current_level_);
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+std::vector<TaskStat> TaskManager::Stat() {
+  const uint64_t now = CurrentNanoseconds();
+  const Task* current_task = running_[current_level_].front();
+
+  std::vector<TaskStat> stats;
+  for(const auto& t : tasks_) {
+    TaskStat stat{
+      t->ID(), t->Level(), t->IsRunning(), t->sched_class_, t->cpu_time_, t->vruntime_, t->io_stat_
+    };
+    if(t.get() == current_task) {
+      // 実行中のタスクはまだ精算していない分を足す
+      stat.cpu_time += now - t->exec_start_;
+      stat.vruntime += now - t->exec_start_;
+    }
+    stats.push_back(stat);
+  }
+  return stats;
+}
@@ -8,12 +8,15 @@
 #include "error.hpp"
 #include "message.hpp"
 #include "fat.hpp"
+#include "memory_manager.hpp"
 
+#include <cstddef>
 #include <cstdint>
 #include <array>
 #include <vector>
 #include <memory>
 #include <deque>
+#include <algorithm>
 #include <map>
 #include <optional>
 
@@ -24,13 +27,16 @@ struct TaskContext {
   uint64_t cs, ss, fs, gs;              //offset 0x20
   uint64_t rax, rbx, rcx, rdx, rdi, rsi, rsp, rbp;  //offset 0x40
   uint64_t r8, r9, r10, r11, r12, r13, r14, r15;     //offset 0x80
-  std::array<uint8_t, 512> fxsave_area; //offset 0xc0
+  // offset 0xc0 : タイマ割り込み時の FPU 状態の一時退避領域。
+  // タスク自身の FPU 状態は遅延して Task::fpu_state_ に保存するので、ここには入らない
+  std::array<uint8_t, 512> fxsave_area;
 } __attribute__((packed));
 
 void InitializeTask();
 
 using TaskFunc = void(uint64_t, int64_t);
 class TaskManager; //前方宣言
+class IoRing;
 
 struct FileMapping {
   int fd;
@@ -45,6 +51,14 @@ class Task {
   public:
     static const int kDefaultLevel = 1;
     static const size_t kDefaultStackBytes = 8 * 4096;
+
+    // スケジューリングクラス
+    //  kRoundRobin: レベル内で固定のタイムスライスで順番に回す
+    //  kFair      : レベル内で仮想実行時間（vruntime）の小さい順に実行する
+    enum class SchedClass {
+      kRoundRobin,
+      kFair,
+    };
     
     Task(uint64_t id);
     Task& InitContext(TaskFunc* f, int64_t data);
@@ -57,7 +71,20 @@ class Task {
     Task& Wakeup();
     void SendMessage(const Message& msg);
     std::optional<Message> ReceiveMessage();
+    // pred を満たす最初のメッセージを取り出す。ほかのメッセージは順番を保ったまま残す
+    template <class Pred>
+    std::optional<Message> ReceiveMessageIf(Pred pred) {
+      auto it = std::find_if(msgs_.begin(), msgs_.end(), pred);
+      if(it == msgs_.end()) {
+        return std::nullopt;
+      }
+      auto m = *it;
+      msgs_.erase(it);
+      return m;
+    }
     std::vector<std::shared_ptr<::FileDescriptor>>& Files();
+    // 記述子 fd を返す。開いていなければ nullptr
+    ::FileDescriptor* LookupFD(int64_t fd);
     uint64_t DPagingBegin() const;
     void SetDPagingBegin(uint64_t v);
     uint64_t DPagingEnd() const;
@@ -65,12 +92,18 @@ class Task {
     uint64_t FileMapEnd() const;
     void SetFileMapEnd(uint64_t v);
     std::vector<FileMapping>& FileMaps();
+    // アプリに書き込み可能で見せているカーネルのメモリ。アプリが終わるまで解放しない
+    std::vector<std::shared_ptr<SharedFrames>>& SharedMemories() { return shared_memories_; }
+    fat::IOStat& IOStats() { return io_stat_; }
+    // SyscallIoRingSetup で作った SQ / CQ。アプリが終わるときに手放す
+    std::shared_ptr<IoRing>& IoRingState() { return io_ring_; }
   
   private:
     Task& SetLevel(int level) { level_ = level; return *this; }
     Task& SetRunning(bool running) { is_running_ = running; return *this; }
     int Level() const { return level_; }
     bool IsRunning() const { return is_running_; }
+    bool IsFair() const { return sched_class_ == SchedClass::kFair; }
 
   private:
     uint64_t id_;
@@ -79,16 +112,39 @@ class Task {
     uint64_t os_stack_ptr_;
     std::deque<Message> msgs_;
 
+    // FPU/SSE/AVX の保存領域。XSAVE の要求する 64 バイト境界に揃えて fpu_buf_ 内に置く
+    std::vector<uint8_t> fpu_buf_;
+    uint8_t* fpu_state_;
+
     unsigned int level_{kDefaultLevel};
     bool is_running_{false};
 
+    SchedClass sched_class_{SchedClass::kRoundRobin};
+    uint64_t cpu_time_{0};    // 累積 CPU 時間 [ns]
+    uint64_t vruntime_{0};    // 仮想実行時間 [ns]
+    uint64_t exec_start_{0};  // 最後に CPU を割り当てられた時刻 [ns]
+
     std::vector<std::shared_ptr<::FileDescriptor>> files_{};
     uint64_t dpaging_begin_{0}, dpaging_end_{0};
     uint64_t file_map_end_{0};
     std::vector<FileMapping> file_maps_{};
+    std::vector<std::shared_ptr<SharedFrames>> shared_memories_{};
+    std::shared_ptr<IoRing> io_ring_{};
+    fat::IOStat io_stat_{};
 };
 
 
+// ps コマンド向けのタスク情報
+struct TaskStat {
+  uint64_t id;
+  int level;
+  bool running;
+  Task::SchedClass sched_class;
+  uint64_t cpu_time;  // [ns]
+  uint64_t vruntime;  // [ns]
+  fat::IOStat io;
+};
+
 /**
  * TaskManager
  */
@@ -97,6 +153,10 @@ class TaskManager {
     // level: 0 = lowest, kMaxLevel = highest
     static const int kMaxLevel = 3;
 
+    // kFair のタスクが 1 周するまでの目標時間と、1 回に与える最小の時間 [ns]
+    static const uint64_t kDefaultFairLatency = 24'000'000;
+    static const uint64_t kFairMinGranularity = 3'000'000;
+
     TaskManager();
     Task& NewTask();
     void SwitchTask(const TaskContext& current_ctx);
@@ -106,6 +166,8 @@ class TaskManager {
     Error Sleep(uint64_t id);
     void Wakeup(Task* task, int level = -1);
     Error Wakeup(uint64_t id, int level = -1);
+    // 同じレベルの次のタスクに CPU を譲る（割り込み禁止状態で呼ぶこと）
+    void Yield();
   
   public:
     Task& CurrentTask();
@@ -113,9 +175,21 @@ class TaskManager {
     void Finish(int exit_code);
     WithError<int> WaitFinish(uint64_t task_id);
 
+  public:
+    Error SetSchedClass(uint64_t id, Task::SchedClass sched_class);
+    uint64_t FairLatency() const { return fair_latency_; }
+    void SetFairLatency(uint64_t latency) { fair_latency_ = latency; }
+    std::vector<TaskStat> Stat();
+
   private:
     void _ChangeLevelRunning(Task* task, int level);
     Task* _RotateCurrentRunQueue(bool current_sleep);
+    void _RequestTaskSwitch();
+    void _Enqueue(Task* task, bool front_is_running);
+    void _AccountRuntime(Task* task, uint64_t now);
+    uint64_t _TimeSlice(const Task* task) const;
+    void _UpdateFPUTrap();
+    void _UpdateCPULocal();
 
   private:
     std::vector<std::unique_ptr<Task>> tasks_{};
@@ -125,6 +199,24 @@ class TaskManager {
     bool is_level_changed_{false};
     std::map<uint64_t, int> finish_tasks_{}; //key: ID of a finished task
     std::map<uint64_t, Task*> finish_waiter_{}; //key: ID of a finished task
+    uint64_t fair_latency_{kDefaultFairLatency};
 };
 
 extern TaskManager* task_manager;
+
+// CPU ごとの状態（CPU は 1 つなので cpu_local だけ）
+struct CPULocal {
+  // この CPU で実行中のタスク。タスクを切り替える直前に書き換えるので、
+  // 実行中のタスクが読めば必ず自分自身になる
+  Task* current_task;
+  // current_task の FPU 状態の保存領域。#NM ハンドラ（IntHandlerNM）が読む
+  uint8_t* fpu_state;
+};
+static_assert(offsetof(CPULocal, fpu_state) == 8); // asmfunc.asm の IntHandlerNM と合わせる
+// IntHandlerNM から参照するので C の名前にする
+extern "C" CPULocal cpu_local;
+
+// task_manager->CurrentTask() と同じだが、割り込みを禁止せずに呼べる
+inline Task& ThisTask() {
+  return *cpu_local.current_task;
+}
@@ -11,9 +11,13 @@
 #include "fat.hpp"
 #include "timer.hpp"
 #include "keyboard.hpp"
+#include "benchmark.hpp"
+#include "syscall.hpp"
 
+#include <algorithm>
 #include <vector>
 #include <cstring>
+#include <cstdlib>
 
 namespace {
 
@@ -70,14 +74,20 @@ namespace {
     return {argc, MAKE_ERROR(Error::kSuccess)};
   }
 
-  Elf64_Phdr* GetProgramHeader(Elf64_Ehdr* ehdr) {
-    return reinterpret_cast<Elf64_Phdr*>(
-      reinterpret_cast<uintptr_t>(ehdr) + ehdr->e_phoff
-    );
+  // ファイルの一部を参照する。ボリューム上で連続していればコピーせずにそのまま返し、
+  // そうでなければ buf に読み込んで返す（Load は連続している範囲ごとにまとめて読む）。読めなければ nullptr
+  const void* MapOrLoad(FileDescriptor& fd, std::vector<uint8_t>& buf, size_t len, size_t offset) {
+    if(auto p = fd.MapRange(offset, len)) {
+      return p;
+    }
+    buf.resize(len);
+    if(fd.Load(buf.data(), len, offset) != len) {
+      return nullptr;
+    }
+    return buf.data();
   }
 
-  uintptr_t GetFirstLoadAddress(Elf64_Ehdr* ehdr) {
-    auto phdr = GetProgramHeader(ehdr);
+  uintptr_t GetFirstLoadAddress(const Elf64_Ehdr* ehdr, const Elf64_Phdr* phdr) {
     for(int i = 0; i < ehdr->e_phnum; ++i) {
       if(phdr[i].p_type != PT_LOAD) continue;
       return phdr[i].p_vaddr;
@@ -87,8 +97,7 @@ namespace {
 
   static_assert(kBytesPerFrame >= 4096);
 
-  WithError<uint64_t> CopyLoadSegments(Elf64_Ehdr* ehdr) {
-    auto phdr = GetProgramHeader(ehdr);
+  WithError<uint64_t> CopyLoadSegments(const Elf64_Ehdr* ehdr, const Elf64_Phdr* phdr, FileDescriptor& fd) {
     uint64_t last_addr = 0;
     for(int i = 0; i < ehdr->e_phnum; ++i) {
       if(phdr[i].p_type != PT_LOAD) continue;
@@ -103,27 +112,36 @@ namespace {
         return {last_addr, err};
       }
 
-      const auto src = reinterpret_cast<uint8_t*>(ehdr) + phdr[i].p_offset;
+      // ボリューム上のデータから直接コピーする（ファイル全体を一旦バッファに読み込まない）
       const auto dst = reinterpret_cast<uint8_t*>(phdr[i].p_vaddr);
-      memcpy(dst, src, phdr[i].p_filesz);
+      if(fd.Load(dst, phdr[i].p_filesz, phdr[i].p_offset) != phdr[i].p_filesz) {
+        return {last_addr, MAKE_ERROR(Error::kInvalidFormat)};
+      }
       memset(dst + phdr[i].p_filesz, 0, phdr[i].p_memsz - phdr[i].p_filesz);
     }
 
     return {last_addr, MAKE_ERROR(Error::kSuccess)};
   }
 
-  WithError<uint64_t> LoadElf(Elf64_Ehdr* ehdr){
+  WithError<uint64_t> LoadElf(const Elf64_Ehdr* ehdr, FileDescriptor& fd){
     if(ehdr->e_type != ET_EXEC) {
       //実行可能ファイルでない
       return {0, MAKE_ERROR(Error::kInvalidFormat)};
     }
 
-    const auto addr_first = GetFirstLoadAddress(ehdr);
+    std::vector<uint8_t> phdr_buf;
+    auto phdr = reinterpret_cast<const Elf64_Phdr*>(
+      MapOrLoad(fd, phdr_buf, sizeof(Elf64_Phdr) * ehdr->e_phnum, ehdr->e_phoff));
+    if(phdr == nullptr) {
+      return {0, MAKE_ERROR(Error::kInvalidFormat)};
+    }
+
+    const auto addr_first = GetFirstLoadAddress(ehdr, phdr);
     if(addr_first < 0xffff'8000'0000'0000) {
       return {0, MAKE_ERROR(Error::kInvalidFormat)};
     }
 
-    return CopyLoadSegments(ehdr);
+    return CopyLoadSegments(ehdr, phdr, fd);
   }
 
   WithError<PageMapEntry*> SetupPML4(Task& current_task) {
@@ -151,28 +169,12 @@ namespace {
   }
 
   void ListAllEntries(FileDescriptor& fd, uint32_t dir_cluster) {
-    const auto kEntriesPerCluster = fat::bytes_per_cluster / sizeof(fat::DirectoryEntry);
-
-    while(dir_cluster != fat::kEndOfClusterchain) {
-      auto dir = fat::GetSectorByCluster<fat::DirectoryEntry>(dir_cluster);
-
-      for(int i = 0; i < kEntriesPerCluster; ++i) {
-        if(dir[i].name[0] == 0x00) {
-          return;
-        }
-        else if(static_cast<uint8_t>(dir[i].name[0]) == 0xe5) {
-          continue;
-        }
-        else if(dir[i].attr == fat::Attribute::kLongName) {
-          continue;
-        }
-
-        char name[13];
-        fat::FormatName(dir[i], name);
-        PrintToFD(fd, "%s\n", name);
+    // 長い名前があればそちらを表示する
+    for(const auto& item : fat::ReadDirectory(dir_cluster)) {
+      if(item.entry == nullptr) {
+        continue; // 削除済み
       }
-
-      dir_cluster = fat::NextCluster(dir_cluster);
+      PrintToFD(fd, "%s\n", item.name.c_str());
     }
   }
 
@@ -192,15 +194,15 @@ namespace {
       return {app_load, err};
     }
 
-    std::vector<uint8_t> file_buf(file_entry.file_size);
-    fat::LoadFile(&file_buf[0], file_buf.size(), file_entry);
-
-    auto elf_header = reinterpret_cast<Elf64_Ehdr*>(&file_buf[0]);
-    if(memcmp(elf_header->e_ident, "\x7f" "ELF", 4) != 0) {
+    fat::FileDescriptor fd{file_entry};
+    std::vector<uint8_t> ehdr_buf;
+    auto elf_header = reinterpret_cast<const Elf64_Ehdr*>(
+      MapOrLoad(fd, ehdr_buf, sizeof(Elf64_Ehdr), 0));
+    if(elf_header == nullptr || memcmp(elf_header->e_ident, "\x7f" "ELF", 4) != 0) {
       return {{},MAKE_ERROR(Error::kInvalidFile)};
     }
 
-    auto [last_addr, err_load] = LoadElf(elf_header);
+    auto [last_addr, err_load] = LoadElf(elf_header, fd);
     if(err_load) {
       return {{}, err_load};
     }
@@ -453,10 +455,16 @@ void Terminal::_ScrollOne(){
 }
 
 void Terminal::_ExecuteLine(){
+  // パイプで区切られた 2 段目以降は、それぞれ別のタスクで同時に実行する
+  std::vector<char*> stages;
+  for(char* p = strchr(&linebuf_[0], '|'); p; p = strchr(&p[1], '|')) {
+    *p = 0;
+    stages.push_back(&p[1]);
+  }
+
   char* command = &linebuf_[0];
   char* first_arg = strchr(&linebuf_[0], ' ');//スペースで区切る
   char* redir_char = strchr(&linebuf_[0], '>');
-  char* pipe_char = strchr(&linebuf_[0], '|');
 
   if(first_arg) {
     *first_arg = 0;
@@ -490,32 +498,39 @@ void Terminal::_ExecuteLine(){
       PrintToFD(*files_[2], "cannot redirect to directory\n");
       return;
     }
-    files_[1] = std::make_shared<fat::FileDescriptor>(*file);
+    auto redir_fd = std::make_shared<fat::FileDescriptor>(*file);
+    redir_fd->Truncate(0); // 上書きなので前の内容は捨てる
+    files_[1] = redir_fd;
   }
 
+  // 後ろの段から作り、各段の標準出力を次の段の標準入力へつなぐ。
+  // パイプが満杯なら書く側が、空なら読む側が待つので、速さの違う段が並んでも溢れない
   std::shared_ptr<PipeDescriptor> pipe_fd;
-  uint64_t subtask_id = 0;
-
-  if(pipe_char) {
-    *pipe_char = 0;
-    char* subcommand = &pipe_char[1];
+  std::vector<uint64_t> subtask_ids; // 後ろの段から順
+  for(int i = static_cast<int>(stages.size()) - 1; i >= 0; --i) {
+    char* subcommand = stages[i];
     while(isspace(*subcommand)) {
       ++subcommand;
     }
 
     auto& subtask = task_manager->NewTask();
-    pipe_fd = std::make_shared<PipeDescriptor>(subtask);
+    auto in_pipe = std::make_shared<PipeDescriptor>();
     auto term_desc = new TerminalDescriptor{
       subcommand, true, false,
-      { pipe_fd, files_[1], files_[2] }
+      { in_pipe, files_[1], files_[2] },
+      in_pipe, pipe_fd
     };
-    files_[1] = pipe_fd;
+    files_[1] = in_pipe;
+    pipe_fd = in_pipe;
 
-    subtask_id = subtask
+    subtask_ids.push_back(subtask
       .InitContext(TaskTerminal, reinterpret_cast<int64_t>(term_desc))
       .Wakeup()
-      .ID();
-    (*layer_task_map)[layer_id_] = subtask_id;
+      .ID());
+  }
+  if(!subtask_ids.empty() && show_window_) {
+    // キー入力などは最後の段へ送る
+    (*layer_task_map)[layer_id_] = subtask_ids.front();
   }
 
   if(strcmp(command, "echo") == 0) {
@@ -630,6 +645,201 @@ void Terminal::_ExecuteLine(){
       p_stat.total_frames * kBytesPerFrame / 1024 / 1024
     );
   }
+  else if(strcmp(command, "ps") == 0) {
+    __asm__("cli");
+    const auto stats = task_manager->Stat();
+    __asm__("sti");
+
+    PrintToFD(*files_[1], "  ID LV CLS  STAT     CPU(ms)    VRUN(ms)\n");
+    for(const auto& stat : stats) {
+      PrintToFD(*files_[1], "%4lu %2d %-4s %-5s %10lu %11lu\n",
+        stat.id, stat.level,
+        stat.sched_class == Task::SchedClass::kFair ? "fair" : "rr",
+        stat.running ? "run" : "sleep",
+        stat.cpu_time / 1000000, stat.vruntime / 1000000
+      );
+    }
+  }
+  else if(strcmp(command, "sched") == 0) {
+    // sched                  : fair クラスのレイテンシを表示
+    // sched latency <ms>     : fair クラスのレイテンシを設定
+    // sched <id> fair|rr     : タスクのスケジューリングクラスを変更
+    char* arg1 = first_arg;
+    char* arg2 = nullptr;
+    if(arg1) {
+      arg2 = strchr(arg1, ' ');
+      if(arg2) {
+        *arg2 = 0;
+        ++arg2;
+      }
+    }
+
+    if(!arg1 || arg1[0] == 0) {
+      PrintToFD(*files_[1], "fair latency: %lu ms\n", task_manager->FairLatency() / 1000000);
+    }
+    else if(!arg2) {
+      PrintToFD(*files_[2], "usage: sched [latency <ms> | <id> fair|rr]\n");
+      exit_code = 1;
+    }
+    else if(strcmp(arg1, "latency") == 0) {
+      const uint64_t ms = strtoul(arg2, nullptr, 0);
+      if(ms == 0) {
+        PrintToFD(*files_[2], "invalid latency: %s\n", arg2);
+        exit_code = 1;
+      }
+      else {
+        __asm__("cli");
+        task_manager->SetFairLatency(ms * 1000000);
+        __asm__("sti");
+      }
+    }
+    else {
+      const uint64_t id = strtoul(arg1, nullptr, 0);
+      Error err = MAKE_ERROR(Error::kSuccess);
+      if(strcmp(arg2, "fair") == 0) {
+        __asm__("cli");
+        err = task_manager->SetSchedClass(id, Task::SchedClass::kFair);
+        __asm__("sti");
+      }
+      else if(strcmp(arg2, "rr") == 0) {
+        __asm__("cli");
+        err = task_manager->SetSchedClass(id, Task::SchedClass::kRoundRobin);
+        __asm__("sti");
+      }
+      else {
+        PrintToFD(*files_[2], "unknown class: %s\n", arg2);
+        exit_code = 1;
+      }
+      if(err) {
+        PrintToFD(*files_[2], "failed to change class: %s\n", err.Name());
+        exit_code = 1;
+      }
+    }
+  }
+  else if(strcmp(command, "sync") == 0) {
+    if(auto err = fat::Flush()) {
+      PrintToFD(*files_[2], "failed to sync: %s\n", err.Name());
+      exit_code = 1;
+    }
+    const auto& stat = buffer_cache->GetStat();
+    PrintToFD(*files_[1], "cache: %lu KiB used, hit %lu, miss %lu, read-ahead %lu sectors\n",
+      buffer_cache->UsedBytes() / 1024, stat.hits, stat.misses, stat.readahead_sectors);
+    PrintToFD(*files_[1], "device: %lu reads, %lu writes (%lu sectors written)\n",
+      stat.device_reads, stat.device_writes, stat.written_sectors);
+  }
+  else if(strcmp(command, "iostat") == 0) {
+    const auto& io = fat::io_stat;
+    PrintToFD(*files_[1], "read : %lu calls, %lu KiB, %lu clusters, %lu ms\n",
+      io.reads, io.bytes_read / 1024, io.clusters_read, io.read_ns / 1000000);
+    PrintToFD(*files_[1], "write: %lu calls, %lu KiB, %lu clusters, %lu ms\n",
+      io.writes, io.bytes_written / 1024, io.clusters_written, io.write_ns / 1000000);
+    PrintToFD(*files_[1], "FAT lookups: %lu\n", io.fat_lookups);
+
+    __asm__("cli");
+    const auto stats = task_manager->Stat();
+    __asm__("sti");
+
+    PrintToFD(*files_[1], "  ID   READ(KiB)  WRITE(KiB)  CLUS(R)  CLUS(W)      FAT  TIME(ms)\n");
+    for(const auto& stat : stats) {
+      if(stat.io.reads == 0 && stat.io.writes == 0) {
+        continue;
+      }
+      PrintToFD(*files_[1], "%4lu %11lu %11lu %8lu %8lu %8lu %9lu\n",
+        stat.id, stat.io.bytes_read / 1024, stat.io.bytes_written / 1024,
+        stat.io.clusters_read, stat.io.clusters_written, stat.io.fat_lookups,
+        (stat.io.read_ns + stat.io.write_ns) / 1000000
+      );
+    }
+  }
+  else if(strcmp(command, "syscalls") == 0) {
+    // syscalls       : システムコールごとの回数と時間を、時間の長い順に表示
+    // syscalls reset : 数え直す
+    if(first_arg && strcmp(first_arg, "reset") == 0) {
+      ResetSyscallStats();
+    }
+    else {
+      auto stats = SyscallStats();
+      std::sort(stats.begin(), stats.end(),
+                [](const auto& a, const auto& b) { return a.cycles > b.cycles; });
+      PrintToFD(*files_[1], "NAME                   CALLS   TOTAL(us)  AVG(cycles)\n");
+      for(const auto& stat : stats) {
+        PrintToFD(*files_[1], "%-18s %9lu %11lu %12lu\n",
+          stat.name, stat.count, stat.cycles / (tsc_freq / 1000000), stat.cycles / stat.count);
+      }
+    }
+  }
+  else if(strcmp(command, "fsck") == 0) {
+    const auto r = fat::CheckVolume();
+    PrintToFD(*files_[1], "%lu files, %lu directories, %lu clusters used\n",
+      r.files, r.directories, r.used_clusters);
+    PrintToFD(*files_[1], "lost: %lu chains (%lu clusters), cross-linked: %lu, bad links: %lu, size mismatches: %lu\n",
+      r.lost_chains, r.lost_clusters, r.cross_links, r.bad_links, r.size_mismatches);
+    if(r.lost_clusters || r.cross_links || r.bad_links || r.size_mismatches) {
+      exit_code = 1;
+    }
+  }
+  else if(strcmp(command, "mkdir") == 0) {
+    if(!first_arg || first_arg[0] == 0) {
+      PrintToFD(*files_[2], "usage: mkdir <dir>\n");
+      exit_code = 1;
+    }
+    else if(auto [dir, err] = fat::MakeDirectory(first_arg); err) {
+      PrintToFD(*files_[2], "failed to make directory %s: %s\n", first_arg, err.Name());
+      exit_code = 1;
+    }
+  }
+  else if(strcmp(command, "rm") == 0) {
+    if(!first_arg || first_arg[0] == 0) {
+      PrintToFD(*files_[2], "usage: rm <file|empty dir>\n");
+      exit_code = 1;
+    }
+    else {
+      // 読み込み済みのアプリの情報はエントリのアドレスで引いているので忘れさせる
+      if(auto [entry, post_slash] = fat::FindFile(first_arg); entry) {
+        app_loads->erase(entry);
+      }
+      if(auto err = fat::Remove(first_arg)) {
+        PrintToFD(*files_[2], "failed to remove %s: %s\n", first_arg, err.Name());
+        exit_code = 1;
+      }
+    }
+  }
+  else if(strcmp(command, "mv") == 0) {
+    char* dest = first_arg ? strchr(first_arg, ' ') : nullptr;
+    if(dest) {
+      *dest = 0;
+      do {
+        ++dest;
+      } while(isspace(*dest));
+    }
+
+    if(!dest || dest[0] == 0) {
+      PrintToFD(*files_[2], "usage: mv <src> <dest>\n");
+      exit_code = 1;
+    }
+    else {
+      for(const char* path : {static_cast<const char*>(first_arg), static_cast<const char*>(dest)}) {
+        if(auto [entry, post_slash] = fat::FindFile(path); entry) {
+          app_loads->erase(entry);
+        }
+      }
+      if(auto err = fat::Rename(first_arg, dest)) {
+        PrintToFD(*files_[2], "failed to move %s to %s: %s\n", first_arg, dest, err.Name());
+        exit_code = 1;
+      }
+    }
+  }
+  else if(strcmp(command, "schedbench") == 0) {
+    RunSchedBenchmark(*files_[1]);
+
+    // アプリからのシステムコールの往復はアプリ側で測る
+    char sysbench[] = "sysbench";
+    if(auto file_entry = FindCommand(sysbench)) {
+      if(auto [ec, err] = _ExecuteFile(*file_entry, sysbench, nullptr); err) {
+        PrintToFD(*files_[2], "failed to exec sysbench: %s\n", err.Name());
+      }
+    }
+  }
   else if(command[0] != 0){
     auto file_entry = FindCommand(command);
     if(!file_entry) {
@@ -650,18 +860,31 @@ void Terminal::_ExecuteLine(){
 
   if(pipe_fd) {
     pipe_fd->FinishWrite();
-    __asm__("cli");
-    auto [ec, err] = task_manager->WaitFinish(subtask_id);
-    (*layer_task_map)[layer_id_] = task_.ID();
-    __asm__("sti");
-    if(err) {
-      Log(kWarn, "failed to wait finish: %s\n", err.Name());
+    // 終了コードは最後の段のものにする
+    for(auto it = subtask_ids.rbegin(); it != subtask_ids.rend(); ++it) {
+      __asm__("cli");
+      auto [ec, err] = task_manager->WaitFinish(*it);
+      __asm__("sti");
+      if(err) {
+        Log(kWarn, "failed to wait finish: %s\n", err.Name());
+      }
+      exit_code = ec;
+    }
+    if(show_window_) {
+      __asm__("cli");
+      (*layer_task_map)[layer_id_] = task_.ID();
+      __asm__("sti");
     }
-    exit_code = ec;
   }
 
   last_exit_code_ = exit_code;
   files_[1] = original_stdout; //出力先を元に戻す
+  if(redir_char) {
+    // リダイレクト先のファイルはここで書き戻しておく
+    if(auto err = fat::Flush()) {
+      PrintToFD(*files_[2], "failed to write back: %s\n", err.Name());
+    }
+  }
 }
 
 WithError<int> Terminal::_ExecuteFile(fat::DirectoryEntry& file_entry, char* command, char* first_arg){
@@ -692,6 +915,12 @@ WithError<int> Terminal::_ExecuteFile(fat::DirectoryEntry& file_entry, char* com
   if(auto err = SetupPageMaps(stack_frame_addr, stack_size / 4096)) {
     return {0, err};
   }
+
+  // 時計ページ（システムコールなしで時刻を読むため）
+  static_assert(CLOCK_PAGE_ADDR == 0xffff'ffff'ffff'f000 - stack_size - 4096);
+  if(auto err = MapSharedPage(LinearAddress4Level{CLOCK_PAGE_ADDR}, GetClockPage())) {
+    return {0, err};
+  }
   
   // 先頭3つを標準入出力とする
   for(int i = 0; i < 3; ++i) {
@@ -701,16 +930,23 @@ WithError<int> Terminal::_ExecuteFile(fat::DirectoryEntry& file_entry, char* com
   const uint64_t elf_next_page = (app_load.vaddr_end + 4095) & 0xffff'ffff'ffff'f000;
   task.SetDPagingBegin(elf_next_page);
   task.SetDPagingEnd(elf_next_page); //1ページだからBeginと同じなのかな
-  task.SetFileMapEnd(stack_frame_addr.value); //仮想アドレスのほぼ末尾
+  task.SetFileMapEnd(CLOCK_PAGE_ADDR); //仮想アドレスのほぼ末尾
 
   int ret = CallApp(argc.value, argv, 3<<3|3, app_load.entry, stack_frame_addr.value + stack_size - 8, &task.OSStackPointer());
 
   task.Files().clear();
   task.FileMaps().clear();
+  // アプリが書いたファイルは終了時に書き戻す
+  if(auto err = fat::Flush()) {
+    Log(kError, "failed to write back: %s\n", err.Name());
+  }
 
   if(auto err = CleanPageMaps(LinearAddress4Level{0xffff'8000'0000'0000})) {
     return {ret, err};
   }
+  // マップを外してから共有メモリの参照を手放す
+  task.SharedMemories().clear();
+  task.IoRingState().reset();
 
   return {ret, FreePML4(task)};
 }
@@ -756,6 +992,8 @@ void TaskTerminal(uint64_t task_id, int64_t data){
 
   __asm__("cli"); //グローバル変数をたくさん使うので念のため割り込みを無効化
   Task& task = task_manager->CurrentTask();
+  // 端末は短い処理と待ちを繰り返すので、vruntime で公平に扱って応答性を保つ
+  task_manager->SetSchedClass(task_id, Task::SchedClass::kFair);
   Terminal* terminal = new Terminal(task, term_desc);
   if(show_window) {
     layer_manager->Move(terminal->LayerID(), {100, 200});
@@ -772,6 +1010,12 @@ void TaskTerminal(uint64_t task_id, int64_t data){
   }
 
   if(term_desc && term_desc->exit_after_command) {
+    if(term_desc->input_pipe) {
+      term_desc->input_pipe->FinishRead();
+    }
+    if(term_desc->output_pipe) {
+      term_desc->output_pipe->FinishWrite();
+    }
     delete term_desc;
     __asm__("cli");
     task_manager->Finish(terminal->LastExitCode());
@@ -779,7 +1023,9 @@ void TaskTerminal(uint64_t task_id, int64_t data){
   }
 
   auto add_blink_timer = [task_id](unsigned long t) {
+    __asm__("cli");
     timer_manager->AddTimer(Timer{t + static_cast<int>(kTimerFreq* 0.5), 1, task_id, "BlinkTime"});
+    __asm__("sti");
   };
   add_blink_timer(timer_manager->CurrentTick());
   
@@ -797,6 +1043,9 @@ void TaskTerminal(uint64_t task_id, int64_t data){
 
     switch(msg->type) {
       case Message::kTimerTimeout:
+        if(msg->arg.timer.value == kWakeupTimerValue) {
+          break; // アプリが待つために使った残り
+        }
         add_blink_timer(msg->arg.timer.timeout);
         if(show_window && is_window_active) {
           const auto area = terminal->BlinkCursor();
@@ -883,68 +1132,3 @@ size_t TerminalFileDescriptor::Write(const void* buf, size_t len) {
 size_t TerminalFileDescriptor::Load(void* buf, size_t len, size_t offset) {
   return 0;
 }
-
-PipeDescriptor::PipeDescriptor(Task& task) : task_{task} {
-}
-
-size_t PipeDescriptor::Read(void* buf, size_t len) {
-  if(len_ > 0 ) {
-    const size_t copy_bytes = std::min(len_, len);
-    memcpy(buf, data_, copy_bytes);
-    len_ -= copy_bytes;
-    memmove(data_, &data_[copy_bytes], len_);
-    return copy_bytes;
-  }
-
-  if(closed_) {
-    return 0;
-  }
-
-  while(true) {
-    __asm__("cli");
-    auto msg = task_.ReceiveMessage();
-    if(!msg) {
-      task_.Sleep();
-      continue;
-    }
-    __asm__("sti");
-
-    if(msg->type != Message::kPipe) {
-      continue;
-    }
-
-    if(msg->arg.pipe.len == 0) {
-      closed_ = true;
-      return 0;
-    }
-
-    const size_t copy_bytes = std::min<size_t>(msg->arg.pipe.len, len);
-    memcpy(buf, msg->arg.pipe.data, copy_bytes);
-    len_ = msg->arg.pipe.len - copy_bytes;
-    memcpy(data_, &msg->arg.pipe.data[copy_bytes], len_);
-    return copy_bytes;
-  }
-}
-
-size_t PipeDescriptor::Write(const void* buf, size_t len) {
-  auto bufc = reinterpret_cast<const char*>(buf);
-  Message msg{Message::kPipe};
-  size_t sent_bytes = 0;
-  while(sent_bytes < len) {
-    msg.arg.pipe.len = std::min(len - sent_bytes, sizeof(msg.arg.pipe.data));
-    memcpy(msg.arg.pipe.data, &bufc[sent_bytes], msg.arg.pipe.len);
-    sent_bytes += msg.arg.pipe.len;
-    __asm__("cli");
-    task_.SendMessage(msg);
-    __asm__("sti");
-  }  
-  return len;
-}
-
-void PipeDescriptor::FinishWrite() {
-  Message msg{Message::kPipe};
-  msg.arg.pipe.len = 0;
-  __asm__("cli");
-  task_.SendMessage(msg);
-  __asm__("sti");
-}
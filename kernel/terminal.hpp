@@ -9,6 +9,7 @@
 #include "fat.hpp"
 #include "task.hpp"
 #include "paging.hpp"
+#include "pipe.hpp"
 
 #include <memory>
 #include <array>
@@ -28,6 +29,9 @@ struct TerminalDescriptor {
   bool exit_after_command;
   bool show_window;
   std::array<std::shared_ptr<FileDescriptor>, 3> files;
+  // files[0], files[1] がパイプならそれ。コマンドが終わったら読み書きをやめたと知らせる
+  std::shared_ptr<PipeDescriptor> input_pipe;
+  std::shared_ptr<PipeDescriptor> output_pipe;
 };
 
 class Terminal {
@@ -91,19 +95,3 @@ class TerminalFileDescriptor : public FileDescriptor {
     Terminal& term_;
 };
 
-class PipeDescriptor : public FileDescriptor {
-  public:
-    explicit PipeDescriptor(Task& task);
-    size_t Read(void* buf, size_t len) override;
-    size_t Write(const void* buf, size_t len) override;
-    size_t Size() const override { return 0; }
-    size_t Load(void* buf, size_t len, size_t offset) override { return 0; }
-
-    void FinishWrite();
-
-  private:
-    Task& task_;
-    char data_[16];
-    size_t len_{0};
-    bool closed_{false};
-};
@@ -3,6 +3,10 @@
 #include "logger.hpp"
 #include "acpi.hpp"
 #include "task.hpp"
+#include "asmfunc.h"
+#include "msr.hpp"
+
+#include <algorithm>
 
 namespace {
   const uint32_t kCountMax = 0xffffffffu;
@@ -10,6 +14,41 @@ namespace {
   volatile uint32_t& initial_count = *reinterpret_cast<uint32_t*>(0xfee00380);
   volatile uint32_t& current_count = *reinterpret_cast<uint32_t*>(0xfee00390);
   volatile uint32_t& divide_config = *reinterpret_cast<uint32_t*>(0xfee003e0);
+
+  // LVT タイマのモード（ビット 18:17）
+  const uint32_t kLVTOneShot     = 0b00 << 17;
+  const uint32_t kLVTTSCDeadline = 0b10 << 17;
+
+  // TSC → ナノ秒 の変換係数を置くページ。アプリにもそのまま見せるので 1 ページ占有する
+  struct alignas(4096) ClockPageFrame {
+    ClockPage page;
+  };
+  ClockPageFrame clock_page_frame;
+  static_assert(sizeof(ClockPageFrame) == 4096);
+
+  bool use_tsc_deadline = false;
+
+  uint64_t NanosecondsToTSC(uint64_t ns) {
+    return clock_page_frame.page.tsc_base + static_cast<uint64_t>(
+      static_cast<unsigned __int128>(ns) * tsc_freq / 1'000'000'000
+    );
+  }
+
+  bool SupportsTSCDeadline() {
+    uint32_t a, b, c, d;
+    CPUID(0x01, 0, &a, &b, &c, &d);
+    return (c >> 24) & 1;
+  }
+
+  bool HasInvariantTSC() {
+    uint32_t a, b, c, d;
+    CPUID(0x80000000, 0, &a, &b, &c, &d);
+    if(a < 0x80000007) {
+      return false;
+    }
+    CPUID(0x80000007, 0, &a, &b, &c, &d);
+    return (d >> 8) & 1;
+  }
 }
 
 void InitializeLAPICTimer(){
@@ -18,17 +57,43 @@ void InitializeLAPICTimer(){
   divide_config = 0b1011; //分周比1
   lvt_timer = 0b001 << 16;
 
+  // LAPIC タイマと TSC を同時に ACPI PM タイマで較正する
+  const uint32_t pm_start = acpi::ReadPMTimer();
+  const uint64_t tsc_start = ReadTSC();
   StartLAPICTimer();
   acpi::WaitMilliseconds(100); //100ミリ測る
   const auto elapsed = LAPICTimerElapsed();
+  const uint64_t tsc_end = ReadTSC();
+  const uint32_t pm_end = acpi::ReadPMTimer();
   StopLAPICTimer();
 
   // 100 msec * 10 で1秒の計算
   lapic_timer_freq = static_cast<unsigned long>(elapsed) * 10;
 
+  // TSC は待ち時間の誤差を含めないよう、実際に進んだ PM タイマのカウント数で割る
+  const uint32_t pm_elapsed = acpi::PMTimerElapsed(pm_start, pm_end);
+  tsc_freq = static_cast<unsigned long>(
+    static_cast<unsigned __int128>(tsc_end - tsc_start) * acpi::kPMTimerFreq / pm_elapsed
+  );
+
+  auto& clock = clock_page_frame.page;
+  clock.tsc_base = tsc_start;
+  clock.tsc_mult = (static_cast<unsigned __int128>(1'000'000'000) << 32) / tsc_freq;
+  clock.tsc_freq = tsc_freq;
+
+  if(!HasInvariantTSC()) {
+    Log(kWarn, "invariant TSC is not supported. clock may drift\n");
+  }
+
+  // 周期モードは使わない。満了時刻ごとにワンショットで設定し直す
+  use_tsc_deadline = SupportsTSCDeadline();
   divide_config = 0b1011; //分周比1
-  lvt_timer = (0b010 << 16) | InterruptVector::kLAPICTimer;
-  initial_count = lapic_timer_freq / kTimerFreq; //1秒にkTimerFreq回の割り込みが発生するように
+  if(use_tsc_deadline) {
+    lvt_timer = kLVTTSCDeadline | InterruptVector::kLAPICTimer;
+  }
+  else {
+    lvt_timer = kLVTOneShot | InterruptVector::kLAPICTimer;
+  }
 }
 
 void StartLAPICTimer(){
@@ -43,6 +108,14 @@ void StopLAPICTimer(){
   initial_count = 0;
 }
 
+uint64_t CurrentNanoseconds() {
+  return ClockPageNanoseconds(&clock_page_frame.page, ReadTSC());
+}
+
+const ClockPage* GetClockPage() {
+  return &clock_page_frame.page;
+}
+
 Timer::Timer(unsigned long timeout, int value, uint64_t task_id, const char* description)
   : timeout_{timeout}
   , value_{value}
@@ -58,27 +131,26 @@ TimerManager::TimerManager()
 }
 
 void TimerManager::AddTimer(const Timer& timer){
+  const bool earliest = timer.Timeout() < timers_.top().Timeout();
   timers_.push(timer);
+  if(earliest) {
+    _ProgramDeadline();
+  }
+}
+
+unsigned long TimerManager::CurrentTick() const {
+  return CurrentNanoseconds() / (1'000'000'000 / kTimerFreq);
 }
 
 bool TimerManager::Tick(){
-  ++tick_;
+  const auto now = CurrentTick();
 
-  bool task_timer_timeout = false;
   while(true){
     const auto& t = timers_.top();
-    if(t.Timeout() > tick_){
+    if(t.Timeout() > now){
       break;
     }
 
-    // タスク切り替え用タイマは特別な処理をする
-    if(t.Value() == kTaskTimerValue) {
-      task_timer_timeout = true;
-      timers_.pop();
-      timers_.push(Timer{tick_ + kTaskTimerPeriod, kTaskTimerValue, 1, kTaskDescription});
-      continue;
-    }
-
     Message m{Message::kTimerTimeout};
     m.arg.timer.timeout = t.Timeout();
     m.arg.timer.value = t.Value();
@@ -91,11 +163,60 @@ bool TimerManager::Tick(){
     timers_.pop();
   }
 
+  // メッセージ送信によるタスクの起床でタイマが設定し直されることがあるので最後に見る
+  bool task_timer_timeout = false;
+  if(task_timeout_ != 0 && task_timeout_ <= CurrentTick()) {
+    task_timer_timeout = true;
+    task_timeout_ = 0;
+  }
+
+  _ProgramDeadline();
   return task_timer_timeout;
 }
 
+void TimerManager::SetTaskTimer(unsigned long timeout) {
+  task_timeout_ = timeout;
+  _ProgramDeadline();
+}
+
+void TimerManager::_ProgramDeadline() {
+  unsigned long deadline = timers_.top().Timeout();
+  if(task_timeout_ != 0) {
+    deadline = std::min(deadline, task_timeout_);
+  }
+
+  if(deadline == std::numeric_limits<unsigned long>::max()) {
+    // 待つべきタイマがないので割り込みを止める
+    if(use_tsc_deadline) {
+      WriteMSR(kIA32_TSC_DEADLINE, 0);
+    }
+    else {
+      StopLAPICTimer();
+    }
+    return;
+  }
+
+  const uint64_t deadline_ns = static_cast<uint64_t>(deadline) * (1'000'000'000 / kTimerFreq);
+  if(use_tsc_deadline) {
+    // 過去の時刻を書き込んだ場合は直ちに割り込みが発生する
+    WriteMSR(kIA32_TSC_DEADLINE, NanosecondsToTSC(deadline_ns));
+    return;
+  }
+
+  const uint64_t now_ns = CurrentNanoseconds();
+  uint64_t count = 1;
+  if(deadline_ns > now_ns) {
+    count = static_cast<uint64_t>(
+      static_cast<unsigned __int128>(deadline_ns - now_ns) * lapic_timer_freq / 1'000'000'000
+    );
+  }
+  // 32 ビットに収まらない場合は早めに割り込ませて再設定する
+  initial_count = std::clamp<uint64_t>(count, 1, kCountMax);
+}
+
 TimerManager* timer_manager;
 unsigned long lapic_timer_freq;
+unsigned long tsc_freq;
 
 extern "C" void LAPICTimerOnInterrupt(const TaskContext& ctx_stack){
   const bool task_timer_timeout = timer_manager->Tick();
@@ -4,14 +4,21 @@
 #include <queue>
 #include <deque>
 #include <vector>
+#include <limits>
 
 #include "message.hpp"
+#include "clock_page.hpp"
 
 void InitializeLAPICTimer();
 void StartLAPICTimer();
 uint32_t LAPICTimerElapsed();
 void StopLAPICTimer();
 
+// 較正済み TSC から求めた起動時からの経過時間（ナノ秒、単調増加）
+uint64_t CurrentNanoseconds();
+// アプリに共有する時計ページ（ページ境界に配置されている）
+const ClockPage* GetClockPage();
+
 class Timer {
   public:
     Timer(unsigned long timeout, int value, uint64_t task_id, const char* description = TIMER_DESC_NOTHING_STR);
@@ -31,23 +38,40 @@ inline bool operator<(const Timer& lhs, const Timer& rhs) {
   return lhs.Timeout() > rhs.Timeout();
 }
 
+/**
+ * TimerManager
+ * 周期割り込みは使わず（tickless）、次に満了するタイマに合わせて
+ * LAPIC タイマをワンショット（または TSC-deadline）で設定し直す。
+ * 割り込み禁止状態で呼び出すこと。
+ */
 class TimerManager {
   public:
     TimerManager();
     void AddTimer(const Timer& timer);
     bool Tick();
-    unsigned long CurrentTick() const {return tick_;}
-    
+    unsigned long CurrentTick() const;
+
+    // タスク切り替え用タイマの満了時刻を設定する（0 なら停止）
+    void SetTaskTimer(unsigned long timeout);
+    bool IsTaskTimerActive() const { return task_timeout_ != 0; }
+
   private:
-    volatile unsigned long tick_{0}; //割り込み処理の中でしか更新されないので volatile 
+    void _ProgramDeadline();
+
     std::priority_queue<Timer> timers_{};
+    unsigned long task_timeout_{0};
 };
 
 extern TimerManager* timer_manager;
 extern unsigned long lapic_timer_freq;
-const int kTimerFreq = 100;
+extern unsigned long tsc_freq;
+
+// CurrentTick() の単位。1 tick = 1 マイクロ秒
+const int kTimerFreq = 1000000;
+
+// 眠っているタスクを起こすだけのタイマーの値（アプリのタイマーは負、端末のカーソルは 1）。
+// 取り消せないので、受け取った側は期限を CurrentTick() で確かめ、メッセージ自体は捨てる
+const int kWakeupTimerValue = 0;
 
-// タスク用タイマ設定
+// タスク用タイマ設定（タイムスライス）
 const int kTaskTimerPeriod = static_cast<int>(kTimerFreq * 0.02);
-const int kTaskTimerValue = std::numeric_limits<int>::max();
-constexpr const char* kTaskDescription = "TaskTimer";
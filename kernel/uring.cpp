@@ -0,0 +1,288 @@
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "keyboard.hpp"
+#include "logger.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+  bool IsUserRange(const void* p, size_t len) {
+    const auto addr = reinterpret_cast<uint64_t>(p);
+    return addr >= 0x8000'0000'0000'0000 && addr + len >= addr;
+  }
+}
+
+bool ToAppEvent(const Message& msg, AppEvent& ev) {
+  switch(msg.type) {
+    case Message::kKeyPush:
+      if(msg.arg.keyboard.keycode == 20 /* Q key */ &&
+        msg.arg.keyboard.modifier & (kLControlBitMask | kRControlBitMask))
+      {
+        ev.type = AppEvent::kQuit;
+      }
+      else {
+        ev.type = AppEvent::kKeyPush;
+        ev.arg.keypush.modifier = msg.arg.keyboard.modifier;
+        ev.arg.keypush.keycode = msg.arg.keyboard.keycode;
+        ev.arg.keypush.ascii = msg.arg.keyboard.ascii;
+        ev.arg.keypush.press = msg.arg.keyboard.press;
+      }
+      return true;
+
+    case Message::kMouseMove:
+      ev.type = AppEvent::kMouseMove;
+      ev.arg.mouse_move.x = msg.arg.mouse_move.x;
+      ev.arg.mouse_move.y = msg.arg.mouse_move.y;
+      ev.arg.mouse_move.dx = msg.arg.mouse_move.dx;
+      ev.arg.mouse_move.dy = msg.arg.mouse_move.dy;
+      ev.arg.mouse_move.buttons = msg.arg.mouse_move.buttons;
+      return true;
+
+    case Message::kMouseButton:
+      ev.type = AppEvent::kMouseButton;
+      ev.arg.mouse_button.x = msg.arg.mouse_button.x;
+      ev.arg.mouse_button.y = msg.arg.mouse_button.y;
+      ev.arg.mouse_button.press = msg.arg.mouse_button.press;
+      ev.arg.mouse_button.button = msg.arg.mouse_button.button;
+      return true;
+
+    case Message::kTimerTimeout:
+      if(msg.arg.timer.value >= 0) {
+        return false;
+      }
+      ev.type = AppEvent::kTimerTimeout;
+      ev.arg.timer.timeout = msg.arg.timer.timeout;
+      ev.arg.timer.value = -msg.arg.timer.value; //アプリ用タイマーは負の値を使う
+      memcpy(ev.arg.timer.description, msg.arg.timer.description, TIMER_DESC_LENGTH);
+      ev.arg.timer.description[TIMER_DESC_LENGTH-1] = '\0';
+      return true;
+
+    case Message::kWindowClose:
+      ev.type = AppEvent::kQuit;
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+WithError<std::shared_ptr<IoRing>> IoRing::Create(uint32_t entries) {
+  if(entries == 0 || entries > kMaxEntries) {
+    return {nullptr, MAKE_ERROR(Error::kIndexOutOfRange)};
+  }
+  uint32_t sq_entries = 1;
+  while(sq_entries < entries) {
+    sq_entries <<= 1;
+  }
+  const uint32_t cq_entries = 2 * sq_entries;
+
+  const size_t sq_offset = sizeof(IoRingHeader);
+  const size_t cq_offset = sq_offset + sq_entries * sizeof(IoSubmission);
+  const size_t bytes = cq_offset + cq_entries * sizeof(IoCompletion);
+  auto [frames, err] = SharedFrames::Allocate((bytes + kBytesPerFrame - 1) / kBytesPerFrame);
+  if(err) {
+    return {nullptr, err};
+  }
+  memset(frames->Data(), 0, frames->NumFrames() * kBytesPerFrame);
+
+  auto& header = *reinterpret_cast<IoRingHeader*>(frames->Data());
+  header.sq_entries = sq_entries;
+  header.cq_entries = cq_entries;
+  header.sq_offset = sq_offset;
+  header.cq_offset = cq_offset;
+  return {std::shared_ptr<IoRing>(new IoRing{frames, sq_entries, cq_entries}),
+          MAKE_ERROR(Error::kSuccess)};
+}
+
+IoRing::IoRing(std::shared_ptr<SharedFrames> frames, uint32_t sq_entries, uint32_t cq_entries)
+  : frames_{frames},
+    sq_{IoRingSq(&_Header())}, cq_{IoRingCq(&_Header())},
+    sq_entries_{sq_entries}, cq_entries_{cq_entries}
+{
+}
+
+size_t IoRing::_CqUsed() const {
+  // cq_head はアプリが書くので、おかしな値でも満杯として扱うだけにする
+  return std::min<size_t>(cq_tail_ - _Header().cq_head, cq_entries_);
+}
+
+void IoRing::_Complete(uint64_t user_data, int64_t result, int error) {
+  if(_CqUsed() >= cq_entries_) {
+    // 取り出す数は CQ の空きで抑えているので、アプリが cq_head を壊したときだけ起きる
+    Log(kWarn, "io ring: completion queue overflow\n");
+    return;
+  }
+  cq_[cq_tail_ & (cq_entries_ - 1)] = IoCompletion{user_data, result, error, 0};
+  ++cq_tail_;
+  _Header().cq_tail = cq_tail_;
+}
+
+void IoRing::_Execute(Task& task, const IoSubmission& sqe) {
+  switch(sqe.opcode) {
+    case kIoNop:
+      _Complete(sqe.user_data, 0, 0);
+      return;
+
+    case kIoRead:
+    case kIoWrite: {
+      auto desc = task.LookupFD(sqe.fd);
+      if(desc == nullptr) {
+        _Complete(sqe.user_data, 0, EBADF);
+        return;
+      }
+      if(!IsUserRange(sqe.addr, sqe.len)) {
+        _Complete(sqe.user_data, 0, EFAULT);
+        return;
+      }
+      auto& fd = *desc;
+      if(sqe.opcode == kIoRead) {
+        const size_t n = sqe.offset == IO_OFFSET_CURRENT ?
+          fd.Read(sqe.addr, sqe.len) : fd.Load(sqe.addr, sqe.len, sqe.offset);
+        _Complete(sqe.user_data, n, 0);
+      }
+      else if(sqe.offset == IO_OFFSET_CURRENT) {
+        _Complete(sqe.user_data, fd.Write(sqe.addr, sqe.len), 0);
+      }
+      else {
+        auto [n, err] = fd.Store(sqe.addr, sqe.len, sqe.offset);
+        if(err.Cause() == Error::kNotImplemented) {
+          _Complete(sqe.user_data, 0, ESPIPE);
+        }
+        else {
+          _Complete(sqe.user_data, n, err ? EIO : 0);
+        }
+      }
+      return;
+    }
+
+    case kIoTimeout: {
+      const unsigned long deadline =
+        timer_manager->CurrentTick() + sqe.offset * (kTimerFreq / 1000);
+      timeouts_.push_back({sqe.user_data, deadline});
+      __asm__("cli");
+      timer_manager->AddTimer(Timer{deadline, kWakeupTimerValue, task.ID(), "IoRing"});
+      __asm__("sti");
+      return;
+    }
+
+    case kIoEventWait: {
+      auto events = reinterpret_cast<AppEvent*>(sqe.addr);
+      if(sqe.len == 0 || sqe.len > SIZE_MAX / sizeof(AppEvent) ||
+         !IsUserRange(events, sqe.len * sizeof(AppEvent))) {
+        _Complete(sqe.user_data, 0, EFAULT);
+        return;
+      }
+      event_waits_.push_back({sqe.user_data, events, sqe.len, 0});
+      return;
+    }
+
+    default:
+      _Complete(sqe.user_data, 0, EINVAL);
+  }
+}
+
+WithError<size_t> IoRing::Submit(Task& task) {
+  auto& header = _Header();
+  const uint32_t tail = header.sq_tail;
+  if(tail - sq_head_ > sq_entries_) {
+    return {0, MAKE_ERROR(Error::kIndexOutOfRange)};
+  }
+
+  size_t submitted = 0;
+  // 取り出した要求の完了が必ず CQ に書けるように、未完了のものと合わせて CQ の要素数までにする
+  while(sq_head_ != tail && _CqUsed() + _NumPending() < cq_entries_) {
+    // アプリが書き換えても影響しないように写してから使う
+    const IoSubmission sqe = sq_[sq_head_ & (sq_entries_ - 1)];
+    ++sq_head_;
+    header.sq_head = sq_head_;
+    _Execute(task, sqe);
+    ++submitted;
+  }
+  return {submitted, MAKE_ERROR(Error::kSuccess)};
+}
+
+bool IoRing::_Wants(const Message& msg) const {
+  if(msg.type == Message::kTimerTimeout && msg.arg.timer.value == kWakeupTimerValue) {
+    return true;
+  }
+  // イベントを待つ要求がなければ、アプリのイベントは ReadEvent のために残しておく
+  AppEvent ev;
+  return !event_waits_.empty() && ToAppEvent(msg, ev);
+}
+
+void IoRing::_ExpireTimeouts() {
+  // 起こすためのタイマーは ReadEvent に捨てられることもあるので、時刻を見て完了させる
+  const unsigned long now = timer_manager->CurrentTick();
+  auto it = timeouts_.begin();
+  while(it != timeouts_.end()) {
+    if(it->deadline <= now) {
+      _Complete(it->user_data, 0, 0);
+      it = timeouts_.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void IoRing::_Deliver(const Message& msg) {
+  if(msg.type == Message::kTimerTimeout && msg.arg.timer.value == kWakeupTimerValue) {
+    return; // 起こされただけ。期限は _ExpireTimeouts で確かめる
+  }
+
+  if(event_waits_.empty()) {
+    return;
+  }
+  auto& wait = event_waits_.front();
+  if(!ToAppEvent(msg, wait.events[wait.count])) {
+    return;
+  }
+  if(++wait.count == wait.len) {
+    _Complete(wait.user_data, wait.count, 0);
+    event_waits_.pop_front();
+  }
+}
+
+void IoRing::_FlushEventWaits() {
+  // 受け取れるイベントを配り終えたので、1 つでも受け取った要求は完了させる
+  while(!event_waits_.empty() && event_waits_.front().count > 0) {
+    _Complete(event_waits_.front().user_data, event_waits_.front().count, 0);
+    event_waits_.pop_front();
+  }
+}
+
+void IoRing::Wait(Task& task, size_t min_complete) {
+  min_complete = std::min<size_t>(min_complete, cq_entries_);
+  auto wants = [this](const Message& msg) { return _Wants(msg); };
+
+  while(true) {
+    // 届いているメッセージを配り終えてから、完了の数を確かめる
+    while(true) {
+      __asm__("cli");
+      auto msg = task.ReceiveMessageIf(wants);
+      __asm__("sti");
+      if(!msg) {
+        break;
+      }
+      _Deliver(*msg);
+    }
+    _FlushEventWaits();
+    _ExpireTimeouts();
+    if(_CqUsed() >= min_complete || _NumPending() == 0) {
+      return;
+    }
+
+    __asm__("cli");
+    if(auto msg = task.ReceiveMessageIf(wants)) {
+      __asm__("sti");
+      _Deliver(*msg);
+      continue;
+    }
+    task.Sleep();
+    __asm__("sti");
+  }
+}
@@ -0,0 +1,74 @@
+/**
+ * @file uring.hpp
+ *
+ * アプリと共有する SQ / CQ（io_ring.hpp）のカーネル側
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "app_event.hpp"
+#include "error.hpp"
+#include "io_ring.hpp"
+#include "memory_manager.hpp"
+#include "message.hpp"
+
+class Task;
+
+// アプリ向けのイベントに変換できるメッセージなら ev に書いて true を返す（ReadEvent と共用）
+bool ToAppEvent(const Message& msg, AppEvent& ev);
+
+class IoRing {
+  public:
+    static const uint32_t kMaxEntries = 4096;
+
+    // SQ の要素数は entries を 2 のべき乗に切り上げたもの。CQ はその 2 倍
+    static WithError<std::shared_ptr<IoRing>> Create(uint32_t entries);
+
+    // アプリにマップするフレーム。先頭が IoRingHeader
+    const std::shared_ptr<SharedFrames>& Frames() const { return frames_; }
+
+    // SQ に積まれた要求を取り出して処理し、取り出した数を返す。読み書きはその場で行う。
+    // 完了を書く場所がなくなりそうなら、残りの要求は SQ に置いたままにする
+    WithError<size_t> Submit(Task& task);
+    // CQ に min_complete 個以上たまるか、未完了の要求がなくなるまで待つ
+    void Wait(Task& task, size_t min_complete);
+
+  private:
+    struct PendingTimeout {
+      uint64_t user_data;
+      unsigned long deadline; // tick
+    };
+    struct PendingEventWait {
+      uint64_t user_data;
+      AppEvent* events;
+      size_t len, count;
+    };
+
+    IoRing(std::shared_ptr<SharedFrames> frames, uint32_t sq_entries, uint32_t cq_entries);
+
+    IoRingHeader& _Header() const { return *reinterpret_cast<IoRingHeader*>(frames_->Data()); }
+    size_t _CqUsed() const;
+    size_t _NumPending() const { return timeouts_.size() + event_waits_.size(); }
+    void _Complete(uint64_t user_data, int64_t result, int error);
+    void _Execute(Task& task, const IoSubmission& sqe);
+    bool _Wants(const Message& msg) const;
+    void _Deliver(const Message& msg);
+    void _FlushEventWaits();
+    void _ExpireTimeouts();
+
+    std::shared_ptr<SharedFrames> frames_;
+    IoSubmission* sq_;
+    IoCompletion* cq_;
+    const uint32_t sq_entries_, cq_entries_;
+    // カーネルが進める位置。共有メモリ上の値はアプリに書き換えられるので控えを使う
+    uint32_t sq_head_{0}, cq_tail_{0};
+
+    std::vector<PendingTimeout> timeouts_{};
+    std::deque<PendingEventWait> event_waits_{}; // 先頭から順にイベントを渡す
+};
@@ -0,0 +1,163 @@
+#include "virtio_blk.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "asmfunc.h"
+#include "logger.hpp"
+#include "memory_manager.hpp"
+
+namespace {
+  // レガシーインターフェースの I/O レジスタ（BAR0 からのオフセット）
+  const uint16_t kDeviceFeatures = 0x00;
+  const uint16_t kGuestFeatures  = 0x04;
+  const uint16_t kQueueAddress   = 0x08;
+  const uint16_t kQueueSize      = 0x0c;
+  const uint16_t kQueueSelect    = 0x0e;
+  const uint16_t kQueueNotify    = 0x10;
+  const uint16_t kDeviceStatus   = 0x12;
+  const uint16_t kDeviceConfig   = 0x14; // virtio-blk では先頭 8 バイトが容量（512 バイト単位）
+
+  const uint8_t kStatusAcknowledge = 1;
+  const uint8_t kStatusDriver      = 2;
+  const uint8_t kStatusDriverOK    = 4;
+  const uint8_t kStatusFailed      = 128;
+
+  const uint16_t kDescNext  = 1;
+  const uint16_t kDescWrite = 2; // デバイスが書き込む
+
+  const uint32_t kRequestIn  = 0;
+  const uint32_t kRequestOut = 1;
+
+  // 1 回の要求で転送する最大のセクタ数
+  const size_t kMaxSectorsPerRequest = 128;
+
+  size_t AlignUp(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+  }
+}
+
+namespace virtio {
+
+BlockDevice::BlockDevice(const pci::Device& dev, uint16_t io_base)
+  : dev_{dev}, io_base_{io_base}
+{
+}
+
+Error BlockDevice::Initialize() {
+  // I/O 空間とバスマスタを有効にする
+  const auto command = pci::ReadConfReg(dev_, 0x04);
+  pci::WriteConfReg(dev_, 0x04, command | 0x05);
+
+  IoOut8(io_base_ + kDeviceStatus, 0); // リセット
+  IoOut8(io_base_ + kDeviceStatus, kStatusAcknowledge);
+  IoOut8(io_base_ + kDeviceStatus, kStatusAcknowledge | kStatusDriver);
+  IoIn32(io_base_ + kDeviceFeatures);
+  IoOut32(io_base_ + kGuestFeatures, 0); // 追加機能は使わない
+
+  IoOut16(io_base_ + kQueueSelect, 0);
+  queue_size_ = IoIn16(io_base_ + kQueueSize);
+  if(queue_size_ < 3) {
+    IoOut8(io_base_ + kDeviceStatus, kStatusFailed);
+    return MAKE_ERROR(Error::kUnknownDevice);
+  }
+
+  // ディスクリプタ表と avail リング、ページ境界から used リングを置く
+  const size_t avail_off = sizeof(QueueDesc) * queue_size_;
+  const size_t used_off = AlignUp(avail_off + 2 * (3 + queue_size_), kBytesPerFrame);
+  const size_t queue_bytes = used_off + AlignUp(2 * 3 + 8 * queue_size_, kBytesPerFrame);
+  const auto frame = memory_manager->Allocate(queue_bytes / kBytesPerFrame);
+  if(frame.error) {
+    IoOut8(io_base_ + kDeviceStatus, kStatusFailed);
+    return frame.error;
+  }
+  auto queue = reinterpret_cast<uint8_t*>(frame.value.Frame());
+  memset(queue, 0, queue_bytes);
+  desc_ = reinterpret_cast<QueueDesc*>(queue);
+  avail_ = reinterpret_cast<volatile uint16_t*>(queue + avail_off);
+  used_ = reinterpret_cast<volatile uint16_t*>(queue + used_off);
+  IoOut32(io_base_ + kQueueAddress, reinterpret_cast<uintptr_t>(queue) / kBytesPerFrame);
+
+  capacity_ = IoIn32(io_base_ + kDeviceConfig) |
+    (static_cast<uint64_t>(IoIn32(io_base_ + kDeviceConfig + 4)) << 32);
+
+  IoOut8(io_base_ + kDeviceStatus,
+         kStatusAcknowledge | kStatusDriver | kStatusDriverOK);
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error BlockDevice::_Request(uint32_t type, uint64_t lba, void* buf, size_t count) {
+  if(lba + count > capacity_) {
+    return MAKE_ERROR(Error::kIndexOutOfRange);
+  }
+
+  auto buf8 = reinterpret_cast<uint8_t*>(buf);
+  while(count > 0) {
+    const size_t n = std::min(count, kMaxSectorsPerRequest);
+    header_ = {type, 0, lba};
+    status_ = 0xff;
+
+    // ヘッダ、データ、状態の 3 つを 1 つの要求として繋ぐ（カーネルはストレートマップなので仮想=物理）
+    desc_[0] = {reinterpret_cast<uintptr_t>(&header_), sizeof(header_), kDescNext, 1};
+    desc_[1] = {reinterpret_cast<uintptr_t>(buf8), static_cast<uint32_t>(n * 512),
+                static_cast<uint16_t>(kDescNext | (type == kRequestIn ? kDescWrite : 0)), 2};
+    desc_[2] = {reinterpret_cast<uintptr_t>(&status_), 1, kDescWrite, 0};
+
+    const uint16_t avail_idx = avail_[1];
+    avail_[2 + avail_idx % queue_size_] = 0;
+    __asm__ volatile("" ::: "memory");
+    avail_[1] = avail_idx + 1;
+    __asm__ volatile("" ::: "memory");
+    IoOut16(io_base_ + kQueueNotify, 0);
+
+    while(used_[1] == last_used_idx_) {
+      __asm__("pause");
+    }
+    ++last_used_idx_;
+    if(status_ != 0) {
+      return MAKE_ERROR(Error::kTransferFailed);
+    }
+
+    lba += n;
+    buf8 += n * 512;
+    count -= n;
+  }
+  return MAKE_ERROR(Error::kSuccess);
+}
+
+Error BlockDevice::Read(uint64_t lba, void* buf, size_t count) {
+  return _Request(kRequestIn, lba, buf, count);
+}
+
+Error BlockDevice::Write(uint64_t lba, const void* buf, size_t count) {
+  return _Request(kRequestOut, lba, const_cast<void*>(buf), count);
+}
+
+BlockDevice* FindBlockDevice() {
+  for(int i = 0; i < pci::num_device; ++i) {
+    auto& dev = pci::devices[i];
+    // 0x1001 は移行期のデバイス ID で、レガシーインターフェースが使える
+    if(pci::ReadVendorId(dev) != 0x1af4 || pci::ReadDeviceId(dev.bus, dev.device, dev.function) != 0x1001) {
+      continue;
+    }
+
+    const auto bar = pci::ReadBar(dev, 0);
+    if(bar.error || (bar.value & 1) == 0) {
+      continue; // BAR0 が I/O 空間でない
+    }
+
+    auto blk = new BlockDevice{dev, static_cast<uint16_t>(bar.value & ~0x3u)};
+    if(auto err = blk->Initialize()) {
+      Log(kError, "failed to initialize virtio-blk %d.%d.%d: %s\n",
+          dev.bus, dev.device, dev.function, err.Name());
+      delete blk;
+      continue;
+    }
+    Log(kInfo, "virtio-blk %d.%d.%d: %lu sectors\n",
+        dev.bus, dev.device, dev.function, blk->SectorCount());
+    return blk;
+  }
+  return nullptr;
+}
+
+} // namespace virtio
@@ -0,0 +1,63 @@
+/**
+ * @file virtio_blk.hpp
+ *
+ * virtio-blk（レガシーインターフェース）のドライバ。
+ * QEMU では -drive if=virtio,format=raw,file=disk.img で接続したディスクが見える
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "block_device.hpp"
+#include "error.hpp"
+#include "pci.hpp"
+
+namespace virtio {
+
+// 要求は 1 つずつ出して、完了するまでポーリングで待つ
+class BlockDevice : public ::BlockDevice {
+  public:
+    BlockDevice(const pci::Device& dev, uint16_t io_base);
+    Error Initialize();
+
+    size_t SectorSize() const override { return 512; }
+    uint64_t SectorCount() const override { return capacity_; }
+    Error Read(uint64_t lba, void* buf, size_t count) override;
+    Error Write(uint64_t lba, const void* buf, size_t count) override;
+
+  private:
+    struct QueueDesc {
+      uint64_t addr;
+      uint32_t len;
+      uint16_t flags;
+      uint16_t next;
+    } __attribute__((packed));
+
+    struct RequestHeader {
+      uint32_t type;
+      uint32_t reserved;
+      uint64_t sector;
+    } __attribute__((packed));
+
+    const pci::Device dev_;
+    const uint16_t io_base_;
+    uint64_t capacity_ = 0;
+
+    uint16_t queue_size_ = 0;
+    QueueDesc* desc_ = nullptr;
+    volatile uint16_t* avail_ = nullptr; // flags, idx, ring[queue_size_]
+    volatile uint16_t* used_ = nullptr;  // flags, idx, ring[queue_size_]（要素は 8 バイト）
+    uint16_t last_used_idx_ = 0;
+
+    RequestHeader header_;
+    volatile uint8_t status_;
+
+    Error _Request(uint32_t type, uint64_t lba, void* buf, size_t count);
+};
+
+// virtio-blk デバイスを探して初期化する。見つからなければ nullptr
+BlockDevice* FindBlockDevice();
+
+} // namespace virtio
@@ -0,0 +1,80 @@
+/**
+ * win_command.hpp
+ *
+ * SyscallWinSubmit でまとめて実行する描画コマンドと、
+ * SyscallWinMapSurface でアプリに見せるウィンドウの画素の情報
+*/
+
+#pragma once
+
+#include "frame_buffer_config.hpp"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct WinCommand {
+  enum Type {
+    kFill,  // 矩形を塗りつぶす
+    kLine,  // (x, y) から (x1, y1) まで線を引く
+    kText,  // (x, y) に文字列を書く
+    kBlit,  // 0xRRGGBB の画素の配列を (x, y) に描く
+  } type;
+
+  // 座標はウィンドウの左上（タイトルバーを含む）が原点
+  int x, y;
+  uint32_t color; // 0xRRGGBB（kBlit では使わない）
+
+  union {
+    struct {
+      int w, h;
+    } fill;
+
+    struct {
+      int x1, y1;
+    } line;
+
+    struct {
+      const char* s; // NUL 終端（UTF-8）
+    } text;
+
+    struct {
+      int w, h;
+      const uint32_t* pixels;
+      int stride; // 1 行あたりの画素数
+    } blit;
+  } arg;
+};
+
+// SyscallWinDrawPolyline に渡す頂点
+struct WinPoint {
+  int x, y;
+};
+
+// SyscallWinBlit で送る画素の形式
+enum WinPixelFormat {
+  kWinPixelRGB,   // R, G, B の 3 バイト
+  kWinPixelRGBA,  // R, G, B, A の 4 バイト（A は使わない）
+  kWinPixelBGRX,  // B, G, R, X の 4 バイト（uint32_t として見れば 0x??RRGGBB）
+};
+
+struct WinBlitSource {
+  const void* pixels;
+  int stride; // 1 行あたりのバイト数
+  enum WinPixelFormat format;
+  int use_color_key;  // 0 でなければ color_key と同じ色の画素は書かない
+  uint32_t color_key; // 0xRRGGBB
+};
+
+// ウィンドウ全体（タイトルバーを含む）の画素。(x, y) の画素は pixels[y * stride + x]
+struct WinSurface {
+  uint32_t* pixels;
+  int width, height;
+  int stride; // 1 行あたりの画素数
+  // kPixelBGRResv8BitPerColor なら 0x00RRGGBB、kPixelRGBResv8BitPerColor なら 0x00BBGGRR
+  enum PixelFormat format;
+};
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
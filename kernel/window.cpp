@@ -4,6 +4,7 @@
 #include "font.hpp"
 
 #include <algorithm>
+#include <cstring>
 
 const int kCloseButtonWidth = 16;
 const int kCloseButtonHeight = 14;
@@ -78,6 +79,14 @@ void Window::Write(Vector2D<int> pos, PixelColor c){
   shadow_buffer_.Writer().Write(pos, c);
 }
 
+void Window::WriteRow(Vector2D<int> pos, const uint32_t* colors, int n){
+  auto& row = data_[pos.y];
+  for(int i = 0; i < n; ++i){
+    row[pos.x + i] = ToColor(colors[i]);
+  }
+  shadow_buffer_.WriteRow(pos, colors, n);
+}
+
 PixelColor& Window::At(Vector2D<int> pos){
   return data_[pos.y][pos.x];
 }
@@ -106,6 +115,38 @@ WindowRegion Window::GetWindowRegion(Vector2D<int> pos){
   return WindowRegion::kOther;
 }
 
+WithError<std::shared_ptr<SharedFrames>> Window::ShareShadowBuffer(){
+  if(shared_pixels_) {
+    return {shared_pixels_, MAKE_ERROR(Error::kSuccess)};
+  }
+
+  const size_t bytes = BytesPerPixel(shadow_buffer_.Config().pixel_format) * width_ * height_;
+  auto [frames, err] = SharedFrames::Allocate((bytes + kBytesPerFrame - 1) / kBytesPerFrame);
+  if(err) {
+    return {nullptr, err};
+  }
+  memset(frames->Data(), 0, frames->NumFrames() * kBytesPerFrame);
+
+  // メインタスクが描いている途中で差し替えないように、割り込みを禁止して
+  // 今の内容を移してから、共有フレームをシャドウバッファとして使う
+  __asm__("cli");
+  if(shared_pixels_) { // 確保している間に他のタスクが済ませた
+    __asm__("sti");
+    return {shared_pixels_, MAKE_ERROR(Error::kSuccess)};
+  }
+  auto config = shadow_buffer_.Config();
+  memcpy(frames->Data(), config.frame_buffer, bytes);
+  config.frame_buffer = frames->Data();
+  config.pixels_per_scan_line = width_;
+  if(auto err = shadow_buffer_.Initialize(config)) {
+    __asm__("sti");
+    return {nullptr, err};
+  }
+  shared_pixels_ = frames;
+  __asm__("sti");
+  return {frames, MAKE_ERROR(Error::kSuccess)};
+}
+
 
 /**
  * ToplevelWindow
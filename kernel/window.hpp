@@ -3,6 +3,8 @@
 #include "graphics.hpp"
 #include "frame_buffer.hpp"
 #include "frame_buffer_config.hpp"
+#include "memory_manager.hpp"
+#include <memory>
 #include <optional>
 #include <vector>
 #include <string>
@@ -46,6 +48,8 @@ class Window{
     // このインスタンスに紐づいた WindowWriter を取得する
     WindowWriter* Writer();
     void Write(Vector2D<int> pos, PixelColor c);
+    // pos から右へ n 画素に 0xRRGGBB の色を書く。ウィンドウの範囲に切り詰めてから呼ぶこと
+    void WriteRow(Vector2D<int> pos, const uint32_t* colors, int n);
     void Move(Vector2D<int> dst_pos, const Rectangle<int>& src);
 
     // 指定した位置のピクセルを返す
@@ -58,6 +62,14 @@ class Window{
     int Height() const;
     Vector2D<int> Size() const;
 
+    /**
+     * @brief シャドウバッファをアプリと共有できる物理フレームに移して返す。
+     * 2 回目以降は同じフレームを返す。
+     * 共有した後にアプリが直接書いた画素は At() には反映されないので、透過色は使えない
+     */
+    WithError<std::shared_ptr<SharedFrames>> ShareShadowBuffer();
+    const FrameBufferConfig& ShadowConfig() const { return shadow_buffer_.Config(); }
+
     // アクティブ化メソッド
     virtual void Activate(){}
     virtual void Deactivate(){}
@@ -70,6 +82,7 @@ class Window{
     std::optional<PixelColor> transparent_color_{std::nullopt};
 
     FrameBuffer shadow_buffer_{};
+    std::shared_ptr<SharedFrames> shared_pixels_{};
 };
 
 